@@ -1,13 +1,56 @@
+// Compressed CSV input is optional: build with -DET_WITH_ZLIB -lz for .gz
+// and -DET_WITH_ZSTD -lzstd for .zst files. -DET_NO_MAIN leaves out the
+// command-line front end, for tests/expense_tracker_test.cpp.
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
+#ifdef ET_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ET_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 namespace et {
 
@@ -42,6 +85,34 @@ inline std::string to_string(const Date& dt) {
 constexpr bool date_le(const Date& a, const Date& b) noexcept {
     return (a.y < b.y) || (a.y == b.y && (a.m < b.m || (a.m == b.m && a.d <= b.d)));
 }
+constexpr int days_in_month(int y, int m) noexcept {
+    constexpr int md[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+    return md[m-1] + ((m==2 && is_leap(y)) ? 1 : 0);
+}
+// Days since 1970-01-01 (proleptic Gregorian), and back.
+constexpr std::int64_t days_from_civil(const Date& dt) noexcept {
+    const std::int64_t y = dt.y - (dt.m <= 2);
+    const std::int64_t era = (y >= 0 ? y : y-399) / 400;
+    const std::int64_t yoe = y - era*400;
+    const std::int64_t doy = (153*(dt.m + (dt.m > 2 ? -3 : 9)) + 2)/5 + dt.d - 1;
+    const std::int64_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return era*146097 + doe - 719468;
+}
+constexpr Date civil_from_days(std::int64_t z) noexcept {
+    z += 719468;
+    const std::int64_t era = (z >= 0 ? z : z-146096) / 146097;
+    const std::int64_t doe = z - era*146097;
+    const std::int64_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    const std::int64_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+    const std::int64_t mp = (5*doy + 2)/153;
+    const int d = static_cast<int>(doy - (153*mp + 2)/5 + 1);
+    const int m = static_cast<int>(mp < 10 ? mp+3 : mp-9);
+    return Date{ static_cast<int>(yoe + era*400 + (m <= 2)), m, d };
+}
+inline Date today() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return civil_from_days(std::chrono::duration_cast<std::chrono::hours>(now).count() / 24);
+}
 
 inline std::string to_lower(std::string s) {
     std::transform(s.begin(), s.end(), s.begin(),
@@ -51,112 +122,5011 @@ inline std::string to_lower(std::string s) {
 inline bool iequals(const std::string& a, const std::string& b) {
     return to_lower(a) == to_lower(b);
 }
+inline bool has_extension(const std::string& path, const char* ext) {
+    std::size_t k = std::strlen(ext);
+    return path.size() >= k && iequals(path.substr(path.size()-k), ext);
+}
+// Paths with these extensions are read and written as Arrow IPC, others as CSV.
+inline bool is_arrow_path(const std::string& path) {
+    return has_extension(path, ".arrow") || has_extension(path, ".feather") || has_extension(path, ".ipc");
+}
 inline bool icontains(const std::string& hay, const std::string& needle) {
     auto H = to_lower(hay), N = to_lower(needle);
     return H.find(N) != std::string::npos;
 }
 
-// CSV helpers
-inline std::string csv_escape(const std::string& s) {
-    if (s.find_first_of(",\"\n") == std::string::npos) return s;
-    std::string out; out.reserve(s.size()+2); out.push_back('"');
-    for (char c : s) { if (c=='"') out.push_back('"'); out.push_back(c); }
-    out.push_back('"'); return out;
+// CSV helpers
+inline std::string csv_escape(const std::string& s) {
+    if (s.find_first_of(",\"\n") == std::string::npos) return s;
+    std::string out; out.reserve(s.size()+2); out.push_back('"');
+    for (char c : s) { if (c=='"') out.push_back('"'); out.push_back(c); }
+    out.push_back('"'); return out;
+}
+inline std::string csv_unescape(std::string s) {
+    if (s.size()>=2 && s.front()=='"' && s.back()=='"') {
+        s = s.substr(1, s.size()-2);
+        std::string out; out.reserve(s.size());
+        for (std::size_t i=0;i<s.size();++i) {
+            if (s[i]=='"' && i+1<s.size() && s[i+1]=='"') { out.push_back('"'); ++i; }
+            else out.push_back(s[i]);
+        }
+        return out;
+    }
+    return s;
+}
+inline void csv_split_line(const std::string& line, std::vector<std::string>& cols) {
+    cols.clear();
+    std::string cur; bool in_q=false;
+    for (char c : line) {
+        if (c=='"') { in_q=!in_q; cur.push_back(c); }
+        else if (c==',' && !in_q) { cols.push_back(cur); cur.clear(); }
+        else cur.push_back(c);
+    }
+    cols.push_back(cur);
+    for (auto& s : cols) while (!s.empty() && (s.back()=='\r'||s.back()=='\n')) s.pop_back();
+}
+
+struct Expense {
+    Date date{};
+    double amount{0.0};
+    std::string category;
+    std::string description;
+};
+
+constexpr const char* kCsvHeader = "date,amount,category,description";
+// Parses one CSV data line into rows; malformed lines are skipped.
+inline void parse_csv_line(const std::string& line, std::vector<Expense>& rows) {
+    std::vector<std::string> cols; csv_split_line(line, cols);
+    if (cols.size() < 4) return;
+    auto d = parse_date(cols[0]); if (!d) return;
+    double amt=0.0; try { amt = std::stod(cols[1]); } catch (...) { return; }
+    Expense e{ *d, amt, csv_unescape(cols[2]), csv_unescape(cols[3]) };
+    rows.push_back(std::move(e));
+}
+inline void write_csv_row(std::ostream& os, const Expense& e) {
+    os << to_string(e.date) << ',' << e.amount << ','
+       << csv_escape(e.category) << ',' << csv_escape(e.description) << '\n';
+}
+
+// ---- Compressed input ----
+// gzip and zstd inputs are decoded incrementally and fed to a CsvLineParser
+// in order, so neither the compressed nor the decoded file is ever held in
+// memory whole. A zstd file of several frames has its frames decoded in
+// parallel, a window of frames at a time. gzip members cannot be located
+// without inflating them, so decompress_file() reads and inflates on a
+// worker thread that hands each 1 MiB block to the parsing thread through a
+// small bounded queue as soon as it is produced.
+// Splits decoded CSV text into lines across chunk boundaries, keeping the
+// unfinished last line until the next chunk (or finish()) completes it.
+class CsvLineParser {
+public:
+    void feed(const char* p, std::size_t n, std::vector<Expense>& rows) {
+        std::size_t start = 0;
+        for (std::size_t i=0;i<n;++i) {
+            if (p[i] != '\n') continue;
+            if (carry_.empty()) line_(std::string(p+start, i-start), rows);
+            else { carry_.append(p+start, i-start); line_(carry_, rows); carry_.clear(); }
+            start = i+1;
+        }
+        carry_.append(p+start, n-start);
+    }
+    void finish(std::vector<Expense>& rows) {
+        if (!carry_.empty()) { line_(carry_, rows); carry_.clear(); }
+    }
+    void reset() { carry_.clear(); }
+
+private:
+    std::string carry_;
+    static void line_(const std::string& line, std::vector<Expense>& rows) {
+        if (line.rfind(kCsvHeader, 0) != 0) parse_csv_line(line, rows);
+    }
+};
+
+enum class Codec : std::uint8_t { None, Gzip, Zstd };
+
+inline Codec sniff_codec(const char* p, std::size_t n) {
+    auto u = [&](std::size_t i) { return static_cast<unsigned char>(p[i]); };
+    if (n >= 2 && u(0) == 0x1f && u(1) == 0x8b) return Codec::Gzip;
+    if (n >= 4 && u(0) == 0x28 && u(1) == 0xb5 && u(2) == 0x2f && u(3) == 0xfd) return Codec::Zstd;
+    return Codec::None;
+}
+inline Codec codec_for_path(const std::string& path) {
+    if (has_extension(path, ".gz")) return Codec::Gzip;
+    if (has_extension(path, ".zst")) return Codec::Zstd;
+    return Codec::None;
+}
+inline bool codec_available(Codec c) {
+    switch (c) {
+        case Codec::None: return true;
+#ifdef ET_WITH_ZLIB
+        case Codec::Gzip: return true;
+#endif
+#ifdef ET_WITH_ZSTD
+        case Codec::Zstd: return true;
+#endif
+        default: return false;
+    }
+}
+
+// Incremental decoder for one gzip or zstd stream. feed() takes the input
+// in pieces of any size and passes decoded blocks to sink in order; an
+// unfinished gzip member or zstd frame is kept until later input completes
+// it. gzip output is passed on as it is inflated. Complete zstd frames are
+// decoded a window at a time, so feed() may hold some back until flush().
+// After corrupt input (or a codec not built in) feed() and flush() return
+// false until reset().
+class Decompressor {
+public:
+    using Sink = std::function<void(const char*, std::size_t)>;
+    static constexpr std::size_t kBlock = 1 << 20;
+
+    explicit Decompressor(Codec c) : codec_(c) {}
+    ~Decompressor() { reset(); }
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    // Forgets any unfinished member or frame.
+    void reset() {
+#ifdef ET_WITH_ZLIB
+        if (zs_open_) inflateEnd(&zs_);
+        zs_ = z_stream{}; zs_open_ = false;
+#endif
+        in_member_ = false; failed_ = false;
+        pending_.clear();
+    }
+
+    bool feed(const char* p, std::size_t n, const Sink& sink) {
+        if (failed_) return false;
+        switch (codec_) {
+            case Codec::None: if (n) sink(p, n); return true;
+            case Codec::Gzip: return feed_gzip_(p, n, sink) || fail_();
+            case Codec::Zstd:
+                pending_.append(p, n);
+                return decode_frames_(std::max(1u, std::thread::hardware_concurrency()), sink) || fail_();
+        }
+        return fail_();
+    }
+    // Decodes the complete zstd frames that feed() held back.
+    bool flush(const Sink& sink) {
+        if (failed_) return false;
+        return codec_ != Codec::Zstd || decode_frames_(1, sink) || fail_();
+    }
+    // True if everything fed so far has been decoded: the input ended on a
+    // member or frame boundary.
+    bool idle() const { return !in_member_ && pending_.empty(); }
+
+private:
+    Codec codec_;
+    bool in_member_{false}, failed_{false};
+    std::string pending_;  // zstd input not yet decoded, starting at a frame
+#ifdef ET_WITH_ZLIB
+    z_stream zs_{};
+    bool zs_open_{false};
+#endif
+
+    bool fail_() { failed_ = true; return false; }
+
+    bool feed_gzip_(const char* p, std::size_t n, const Sink& sink) {
+#ifdef ET_WITH_ZLIB
+        if (!zs_open_) {
+            if (inflateInit2(&zs_, 16 + MAX_WBITS) != Z_OK) return false;
+            zs_open_ = true;
+        }
+        std::string out(kBlock, '\0');
+        while (n) {
+            std::size_t step = std::min<std::size_t>(n, 0x40000000);
+            zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+            zs_.avail_in = static_cast<uInt>(step);
+            // Keep going while input remains or inflate filled the block and
+            // may hold more output.
+            do {
+                zs_.next_out = reinterpret_cast<Bytef*>(&out[0]);
+                zs_.avail_out = static_cast<uInt>(out.size());
+                int rc = inflate(&zs_, Z_NO_FLUSH);
+                std::size_t produced = out.size() - zs_.avail_out;
+                if (produced) sink(out.data(), produced);
+                if (rc == Z_STREAM_END) { inflateReset(&zs_); in_member_ = false; }
+                else if (rc == Z_OK) in_member_ = true;
+                else if (rc != Z_BUF_ERROR) return false;
+            } while (zs_.avail_in > 0 || zs_.avail_out == 0);
+            p += step; n -= step;
+        }
+        return true;
+#else
+        (void)p; (void)n; (void)sink;
+        return false;
+#endif
+    }
+
+    // Decodes the complete frames at the start of pending_, `window` frames
+    // at a time, leaving fewer than `window` (and any unfinished frame).
+    bool decode_frames_(std::size_t window, const Sink& sink) {
+#ifdef ET_WITH_ZSTD
+        // Frame boundaries come from the frame headers alone.
+        std::vector<std::pair<std::size_t, std::size_t>> frames;
+        for (std::size_t pos = 0; pos < pending_.size(); ) {
+            std::size_t len = ZSTD_findFrameCompressedSize(pending_.data() + pos, pending_.size() - pos);
+            if (ZSTD_isError(len)) break;  // unfinished (or corrupt) tail
+            frames.emplace_back(pos, len);
+            pos += len;
+        }
+        std::size_t done = 0;
+        for (std::size_t base = 0; base + window <= frames.size(); base += window) {
+            std::size_t n = std::min(window, frames.size() - base);
+            std::vector<std::string> out(n);
+            std::vector<char> ok(n, 0);
+            std::vector<std::thread> pool;
+            for (std::size_t i=1;i<n;++i) pool.emplace_back([&, i]{ ok[i] = decode_frame_(frames[base+i], out[i]); });
+            ok[0] = decode_frame_(frames[base], out[0]);
+            for (auto& t : pool) t.join();
+            for (std::size_t i=0;i<n;++i) {
+                if (!ok[i]) return false;
+                if (!out[i].empty()) sink(out[i].data(), out[i].size());
+                done = frames[base+i].first + frames[base+i].second;
+            }
+        }
+        pending_.erase(0, done);
+        return true;
+#else
+        (void)window; (void)sink;
+        return pending_.empty();
+#endif
+    }
+#ifdef ET_WITH_ZSTD
+    bool decode_frame_(std::pair<std::size_t, std::size_t> f, std::string& out) const {
+        const char* src = pending_.data() + f.first;
+        std::size_t len = f.second;
+        unsigned long long size = ZSTD_getFrameContentSize(src, len);
+        if (size == ZSTD_CONTENTSIZE_ERROR) return false;
+        if (size != ZSTD_CONTENTSIZE_UNKNOWN) {
+            out.resize(static_cast<std::size_t>(size));
+            std::size_t got = ZSTD_decompress(&out[0], out.size(), src, len);
+            return !ZSTD_isError(got) && got == out.size();
+        }
+        ZSTD_DStream* ds = ZSTD_createDStream();
+        ZSTD_initDStream(ds);
+        ZSTD_inBuffer ib{ src, len, 0 };
+        std::string buf(ZSTD_DStreamOutSize(), '\0');
+        bool ok = true;
+        while (ib.pos < ib.size) {
+            ZSTD_outBuffer ob{ &buf[0], buf.size(), 0 };
+            std::size_t rc = ZSTD_decompressStream(ds, &ob, &ib);
+            if (ZSTD_isError(rc)) { ok = false; break; }
+            out.append(buf.data(), ob.pos);
+        }
+        ZSTD_freeDStream(ds);
+        return ok;
+    }
+#endif
+};
+
+// Decodes a whole compressed stream, passing decoded blocks to sink on the
+// calling thread. A worker thread reads `in` in 1 MiB chunks and decodes
+// them, handing each block over through a small bounded queue. Returns false
+// on a read error, corrupt input or input that ends inside a member/frame.
+inline bool decompress_file(Codec c, std::istream& in, const std::function<void(const char*, std::size_t)>& sink) {
+    std::mutex mu; std::condition_variable cv;
+    std::deque<std::string> queue; bool done = false, ok = true;
+    constexpr std::size_t kMaxQueued = 4;
+    std::thread worker([&] {
+        auto push = [&](const char* p, std::size_t n) {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&]{ return queue.size() < kMaxQueued; });
+            queue.emplace_back(p, n);
+            cv.notify_all();
+        };
+        Decompressor dec(c);
+        std::string chunk(Decompressor::kBlock, '\0');
+        bool good = true;
+        while (good && in) {
+            in.read(&chunk[0], static_cast<std::streamsize>(chunk.size()));
+            good = dec.feed(chunk.data(), static_cast<std::size_t>(in.gcount()), push);
+        }
+        good = good && in.eof() && dec.flush(push) && dec.idle();
+        std::lock_guard<std::mutex> lk(mu);
+        ok = good; done = true; cv.notify_all();
+    });
+    while (true) {
+        std::string block;
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&]{ return !queue.empty() || done; });
+            if (queue.empty()) break;
+            block = std::move(queue.front()); queue.pop_front();
+            cv.notify_all();
+        }
+        sink(block.data(), block.size());
+    }
+    worker.join();
+    return ok;
+}
+
+// ---- Category dictionary ----
+// Interns category paths such as "Travel/Flights" as nodes of a tree. Paths
+// are compared case-insensitively with blanks around '/' ignored. Parents get
+// smaller ids than their children, so scanning ids downward visits every node
+// before its parent. A subtree is an interval of pre-order ranks.
+class CategoryTree {
+public:
+    using Id = std::uint32_t;
+    static constexpr Id kNone = ~Id{0};
+
+    static std::string normalize(const std::string& path) {
+        std::string out, seg;
+        auto flush = [&] {
+            auto b = seg.find_first_not_of(" \t"), e = seg.find_last_not_of(" \t");
+            if (b != std::string::npos) {
+                if (!out.empty()) out.push_back('/');
+                out.append(seg, b, e-b+1);
+            }
+            seg.clear();
+        };
+        for (char c : path) {
+            if (c=='/') flush();
+            else seg.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        flush();
+        return out;
+    }
+
+    Id intern(const std::string& path) { return intern_normalized_(normalize(path)); }
+    std::optional<Id> find(const std::string& path) const {
+        auto it = ids_.find(normalize(path));
+        if (it == ids_.end()) return std::nullopt;
+        return it->second;
+    }
+    std::size_t size() const { return nodes_.size(); }
+    Id parent(Id id) const { return nodes_[id].parent; }
+    const std::string& path(Id id) const { return nodes_[id].path; }
+
+    // `id` and all its descendants: the nodes ranked [first, last) in
+    // pre-order. Ranks are rebuilt lazily after the tree grows, in two
+    // passes over the nodes, so a Subtree is valid until the next intern().
+    struct Subtree { std::uint32_t first{0}, last{0}; };
+    Subtree subtree(Id id) const {
+        if (rank_.size() != nodes_.size()) rebuild_ranks_();
+        return Subtree{ rank_[id], rank_[id] + size_[id] };
+    }
+    bool contains(Subtree s, Id id) const noexcept { return rank_[id] >= s.first && rank_[id] < s.last; }
+    // Ids in pre-order; a subtree's ids are preorder()[first, last).
+    const std::vector<Id>& preorder() const {
+        if (rank_.size() != nodes_.size()) rebuild_ranks_();
+        return order_;
+    }
+
+private:
+    struct Node { std::string path; Id parent; };
+    std::vector<Node> nodes_;
+    std::unordered_map<std::string, Id> ids_;
+    mutable std::vector<std::uint32_t> rank_, size_;  // by id: pre-order rank, subtree size
+    mutable std::vector<Id> order_;                   // by rank
+
+    Id intern_normalized_(const std::string& norm) {
+        auto it = ids_.find(norm);
+        if (it != ids_.end()) return it->second;
+        Id parent = kNone;
+        auto slash = norm.rfind('/');
+        if (slash != std::string::npos) parent = intern_normalized_(norm.substr(0, slash));
+        Id id = static_cast<Id>(nodes_.size());
+        nodes_.push_back(Node{ norm, parent });
+        ids_.emplace(norm, id);
+        return id;
+    }
+    // Subtree sizes bottom-up, then ranks top-down: each child takes the
+    // next free slot inside its parent's interval.
+    void rebuild_ranks_() const {
+        const std::size_t n = nodes_.size();
+        size_.assign(n, 1);
+        for (std::size_t id = n; id-- > 0; ) {
+            if (nodes_[id].parent != kNone) size_[nodes_[id].parent] += size_[id];
+        }
+        std::vector<std::uint32_t> next(n);
+        std::uint32_t next_root = 0;
+        rank_.resize(n); order_.resize(n);
+        for (std::size_t id = 0; id < n; ++id) {
+            Id p = nodes_[id].parent;
+            std::uint32_t& slot = p == kNone ? next_root : next[p];
+            rank_[id] = slot; slot += size_[id];
+            next[id] = rank_[id] + 1;
+            order_[rank_[id]] = static_cast<Id>(id);
+        }
+    }
+};
+
+// ---- Amount index ----
+// B+tree over (amount in cents, row) used for threshold and top-N queries.
+// Nodes live in two flat pools and refer to each other by index; leaves are
+// doubly linked so ranges scan forward and top-N scans backward. Erase does
+// not rebalance: underfull leaves remain until the next build().
+class AmountIndex {
+public:
+    struct Key {
+        std::int64_t cents;
+        std::uint32_t row;
+        bool operator<(const Key& o) const noexcept {
+            return cents < o.cents || (cents == o.cents && row < o.row);
+        }
+        bool operator==(const Key& o) const noexcept { return cents == o.cents && row == o.row; }
+    };
+    static std::int64_t to_cents(double amount) noexcept {
+        constexpr double lim = 9.0e18;
+        double c = amount * 100.0;
+        if (!(c < lim)) return std::numeric_limits<std::int64_t>::max();
+        if (!(c > -lim)) return std::numeric_limits<std::int64_t>::min();
+        return std::llround(c);
+    }
+
+    std::size_t size() const { return size_; }
+
+    void build(std::vector<Key> keys) {
+        leaves_.clear(); inners_.clear(); root_ = kNil; height_ = 0; size_ = keys.size();
+        if (!std::is_sorted(keys.begin(), keys.end())) std::sort(keys.begin(), keys.end());
+        // Leaves are filled to 3/4 so incremental inserts do not split at once.
+        constexpr std::size_t fill = kLeafCap*3/4;
+        std::vector<std::uint32_t> level;
+        std::vector<Key> firsts;
+        for (std::size_t i=0; i<keys.size() || level.empty(); i+=fill) {
+            std::uint32_t id = new_leaf_();
+            Leaf& lf = leaves_[id];
+            std::size_t n = std::min(fill, keys.size()-std::min(i, keys.size()));
+            std::copy(keys.begin()+i, keys.begin()+i+n, lf.keys);
+            lf.n = static_cast<std::uint32_t>(n);
+            if (!level.empty()) { lf.prev = level.back(); leaves_[level.back()].next = id; }
+            level.push_back(id); firsts.push_back(n ? lf.keys[0] : Key{0,0});
+            if (keys.empty()) break;
+        }
+        tail_ = level.back();
+        while (level.size() > 1) {
+            std::vector<std::uint32_t> up; std::vector<Key> up_firsts;
+            for (std::size_t i=0; i<level.size(); i+=kInnerCap) {
+                std::uint32_t id = new_inner_();
+                Inner& in = inners_[id];
+                std::size_t n = std::min<std::size_t>(kInnerCap, level.size()-i);
+                for (std::size_t j=0;j<n;++j) {
+                    in.kids[j] = level[i+j];
+                    if (j) in.seps[j-1] = firsts[i+j];
+                }
+                in.n = static_cast<std::uint32_t>(n);
+                up.push_back(id); up_firsts.push_back(firsts[i]);
+            }
+            level.swap(up); firsts.swap(up_firsts); ++height_;
+        }
+        root_ = level[0];
+    }
+
+    void insert(Key k) {
+        if (root_ == kNil) build({});
+        Key sep; std::uint32_t right;
+        if (insert_(root_, height_, k, sep, right)) {
+            std::uint32_t id = new_inner_();
+            Inner& in = inners_[id];
+            in.n = 2; in.kids[0] = root_; in.kids[1] = right; in.seps[0] = sep;
+            root_ = id; ++height_;
+        }
+        ++size_;
+    }
+    bool erase(Key k) {
+        if (root_ == kNil) return false;
+        Leaf& lf = leaves_[find_leaf_(k)];
+        Key* end = lf.keys + lf.n;
+        Key* it = std::lower_bound(lf.keys, end, k);
+        if (it == end || !(*it == k)) return false;
+        std::copy(it+1, end, it);
+        --lf.n; --size_;
+        return true;
+    }
+
+    // Calls f(row) for keys with lo <= cents <= hi in ascending order until f returns false.
+    template <class F>
+    void range(std::int64_t lo, std::int64_t hi, F&& f) const {
+        if (root_ == kNil) return;
+        Key start{lo, 0};
+        for (std::uint32_t id = find_leaf_(start); id != kNil; id = leaves_[id].next) {
+            const Leaf& lf = leaves_[id];
+            const Key* b = std::lower_bound(lf.keys, lf.keys + lf.n, start);
+            for (const Key* it = b; it != lf.keys + lf.n; ++it) {
+                if (it->cents > hi) return;
+                if (!f(it->row)) return;
+            }
+        }
+    }
+    // Calls f(row) from the largest amount down until f returns false.
+    template <class F>
+    void descending(F&& f) const {
+        if (root_ == kNil) return;
+        for (std::uint32_t id = tail_; id != kNil; id = leaves_[id].prev) {
+            const Leaf& lf = leaves_[id];
+            for (std::uint32_t i = lf.n; i-- > 0; ) if (!f(lf.keys[i].row)) return;
+        }
+    }
+
+private:
+    static constexpr std::uint32_t kNil = ~std::uint32_t{0};
+    static constexpr std::size_t kLeafCap = 64, kInnerCap = 64;
+    struct Leaf {
+        std::uint32_t n{0}, prev{kNil}, next{kNil};
+        Key keys[kLeafCap];
+    };
+    struct Inner {
+        std::uint32_t n{0};  // number of children
+        Key seps[kInnerCap-1];  // kids[i+1] holds keys >= seps[i]
+        std::uint32_t kids[kInnerCap];
+    };
+    std::vector<Leaf> leaves_;
+    std::vector<Inner> inners_;
+    std::uint32_t root_{kNil}, tail_{kNil};
+    int height_{0};  // 0: root is a leaf
+    std::size_t size_{0};
+
+    std::uint32_t new_leaf_() { leaves_.emplace_back(); return static_cast<std::uint32_t>(leaves_.size()-1); }
+    std::uint32_t new_inner_() { inners_.emplace_back(); return static_cast<std::uint32_t>(inners_.size()-1); }
+
+    static std::uint32_t child_slot_(const Inner& in, const Key& k) {
+        return static_cast<std::uint32_t>(std::upper_bound(in.seps, in.seps + in.n - 1, k) - in.seps);
+    }
+    std::uint32_t find_leaf_(const Key& k) const {
+        std::uint32_t id = root_;
+        for (int h = height_; h > 0; --h) { const Inner& in = inners_[id]; id = in.kids[child_slot_(in, k)]; }
+        return id;
+    }
+    // Inserts below node `id` at height h. On a split, returns true with the
+    // new right sibling and its separator.
+    bool insert_(std::uint32_t id, int h, const Key& k, Key& sep, std::uint32_t& right) {
+        if (h == 0) {
+            Leaf* lf = &leaves_[id];
+            Key* pos = std::upper_bound(lf->keys, lf->keys + lf->n, k);
+            if (lf->n < kLeafCap) {
+                std::copy_backward(pos, lf->keys + lf->n, lf->keys + lf->n + 1);
+                *pos = k; ++lf->n;
+                return false;
+            }
+            Key tmp[kLeafCap+1];
+            std::size_t at = static_cast<std::size_t>(pos - lf->keys);
+            std::copy(lf->keys, pos, tmp); tmp[at] = k; std::copy(pos, lf->keys + kLeafCap, tmp+at+1);
+            right = new_leaf_();
+            lf = &leaves_[id];
+            Leaf& rt = leaves_[right];
+            std::size_t half = (kLeafCap+1)/2;
+            std::copy(tmp, tmp+half, lf->keys); lf->n = static_cast<std::uint32_t>(half);
+            std::copy(tmp+half, tmp+kLeafCap+1, rt.keys); rt.n = static_cast<std::uint32_t>(kLeafCap+1-half);
+            rt.next = lf->next; rt.prev = id; lf->next = right;
+            if (rt.next != kNil) leaves_[rt.next].prev = right; else tail_ = right;
+            sep = rt.keys[0];
+            return true;
+        }
+        std::uint32_t slot = child_slot_(inners_[id], k);
+        Key csep; std::uint32_t cright;
+        if (!insert_(inners_[id].kids[slot], h-1, k, csep, cright)) return false;
+        Inner* in = &inners_[id];
+        if (in->n < kInnerCap) {
+            std::copy_backward(in->seps + slot, in->seps + in->n - 1, in->seps + in->n);
+            std::copy_backward(in->kids + slot + 1, in->kids + in->n, in->kids + in->n + 1);
+            in->seps[slot] = csep; in->kids[slot+1] = cright; ++in->n;
+            return false;
+        }
+        Key tseps[kInnerCap]; std::uint32_t tkids[kInnerCap+1];
+        std::copy(in->seps, in->seps + slot, tseps); tseps[slot] = csep;
+        std::copy(in->seps + slot, in->seps + kInnerCap - 1, tseps + slot + 1);
+        std::copy(in->kids, in->kids + slot + 1, tkids); tkids[slot+1] = cright;
+        std::copy(in->kids + slot + 1, in->kids + kInnerCap, tkids + slot + 2);
+        right = new_inner_();
+        in = &inners_[id];
+        Inner& rt = inners_[right];
+        std::size_t left_kids = (kInnerCap+1)/2, right_kids = kInnerCap+1-left_kids;
+        std::copy(tkids, tkids + left_kids, in->kids);
+        std::copy(tseps, tseps + left_kids - 1, in->seps);
+        in->n = static_cast<std::uint32_t>(left_kids);
+        sep = tseps[left_kids-1];
+        std::copy(tkids + left_kids, tkids + kInnerCap + 1, rt.kids);
+        std::copy(tseps + left_kids, tseps + kInnerCap, rt.seps);
+        rt.n = static_cast<std::uint32_t>(right_kids);
+        return true;
+    }
+};
+
+// ---- Category/date index ----
+// Per category id, the rows sorted by date with a running total in cents, so
+// "category X between A and B" is two binary searches and a contiguous read,
+// and its total is a difference of two prefix sums. Rows added in date order
+// are appended in O(1); any other change marks the list dirty, and dirty
+// lists are rebuilt together in one pass over the ledger on the next query.
+class CategoryDateIndex {
+public:
+    struct Entry { std::int32_t day; std::uint32_t row; };
+
+    void append(CategoryTree::Id cat, std::int32_t day, std::uint32_t row, std::int64_t cents) {
+        List& l = list_(cat);
+        if (l.dirty) return;
+        if (!l.entries.empty() && day < l.entries.back().day) { mark_(l); return; }
+        l.entries.push_back(Entry{ day, row });
+        l.prefix.push_back(l.prefix.back() + cents);
+    }
+    void invalidate(CategoryTree::Id cat) { mark_(list_(cat)); }
+    void invalidate_all() { for (auto& l : lists_) mark_(l); any_dirty_ = true; }
+    // Adopting lists built elsewhere (an index file): reset() leaves `cats`
+    // clean empty lists and assign() fills one with n entries and their n+1
+    // prefix sums.
+    void reset(std::size_t cats) { lists_.assign(cats, List{}); any_dirty_ = false; }
+    void assign(CategoryTree::Id cat, const Entry* first, std::size_t n, const std::int64_t* prefix) {
+        List& l = list_(cat);
+        l.entries.assign(first, first + n);
+        l.prefix.assign(prefix, prefix + n + 1);
+        l.dirty = false;
+    }
+
+    // Rebuilds every dirty list from the ledger columns.
+    void refresh(const std::vector<CategoryTree::Id>& cat_ids, const std::vector<std::int32_t>& days,
+                 const std::vector<Expense>& rows) {
+        if (!any_dirty_) return;
+        // Lists created here hold rows that were never appended.
+        const std::size_t known = lists_.size();
+        for (auto id : cat_ids) list_(id);
+        for (std::size_t i=known;i<lists_.size();++i) lists_[i].dirty = true;
+        for (std::size_t i=0;i<rows.size();++i) {
+            List& l = lists_[cat_ids[i]];
+            if (l.dirty) l.entries.push_back(Entry{ days[i], static_cast<std::uint32_t>(i) });
+        }
+        for (auto& l : lists_) {
+            if (!l.dirty) continue;
+            std::sort(l.entries.begin(), l.entries.end(),
+                      [](const Entry& a, const Entry& b){ return a.day < b.day || (a.day == b.day && a.row < b.row); });
+            l.prefix.assign(1, 0);
+            l.prefix.reserve(l.entries.size()+1);
+            for (const auto& e : l.entries) l.prefix.push_back(l.prefix.back() + AmountIndex::to_cents(rows[e.row].amount));
+            l.dirty = false;
+        }
+        any_dirty_ = false;
+    }
+    bool dirty() const { return any_dirty_; }
+
+    // Half-open [first, last) positions of cat's rows dated within [from, to].
+    std::pair<std::size_t, std::size_t> span(CategoryTree::Id cat, std::int32_t from, std::int32_t to) const {
+        if (cat >= lists_.size()) return {0, 0};
+        const auto& v = lists_[cat].entries;
+        auto lo = std::lower_bound(v.begin(), v.end(), from, [](const Entry& e, std::int32_t d){ return e.day < d; });
+        auto hi = std::upper_bound(lo, v.end(), to, [](std::int32_t d, const Entry& e){ return d < e.day; });
+        return { static_cast<std::size_t>(lo - v.begin()), static_cast<std::size_t>(hi - v.begin()) };
+    }
+    const Entry* entries(CategoryTree::Id cat) const { return cat < lists_.size() ? lists_[cat].entries.data() : nullptr; }
+    std::int64_t cents(CategoryTree::Id cat, std::pair<std::size_t, std::size_t> sp) const {
+        if (cat >= lists_.size() || sp.first >= sp.second) return 0;
+        return lists_[cat].prefix[sp.second] - lists_[cat].prefix[sp.first];
+    }
+
+private:
+    struct List {
+        std::vector<Entry> entries;
+        std::vector<std::int64_t> prefix{0};  // prefix[i] = cents of entries[0..i)
+        bool dirty{false};
+    };
+    std::vector<List> lists_;
+    bool any_dirty_{false};
+
+    List& list_(CategoryTree::Id cat) {
+        if (cat >= lists_.size()) lists_.resize(cat+1);
+        return lists_[cat];
+    }
+    void mark_(List& l) {
+        if (l.dirty) return;
+        l.dirty = true; any_dirty_ = true;
+        l.entries.clear(); l.prefix.assign(1, 0);
+    }
+};
+
+// Optional restrictions that compose with index lookups.
+struct ExpenseFilter {
+    std::optional<Date> from, to;
+    std::optional<std::string> category;  // matches the category's subtree
+};
+
+// Dense period x category matrix produced by ExpenseManager::pivot.
+// Cell (r, c) is at r*categories.size() + c.
+enum class PivotPeriod : std::uint8_t { Month, Week };
+struct PivotTable {
+    std::vector<std::string> periods;     // "YYYY-MM", or the Monday of each week
+    std::vector<std::string> categories;  // category paths with at least one row
+    std::vector<double> sums;
+    std::vector<std::uint32_t> counts;
+};
+
+// ---- Recurring expenses ----
+// A rule stands for an unbounded series of expenses and is expanded only
+// inside date-range queries. Skipped occurrences are kept as a sorted set of
+// occurrence indices; an overridden occurrence is skipped here and stored as
+// an ordinary row.
+enum class Freq : std::uint8_t { Daily, Weekly, Monthly, Yearly };
+
+struct RecurrenceRule {
+    Date start{};
+    std::optional<Date> until;
+    Freq freq{Freq::Monthly};
+    int interval{1};
+    double amount{0.0};
+    std::string category;
+    std::string description;
+    std::set<std::int64_t> skipped;
+
+    // Date of occurrence n (n >= 0). Monthly and yearly rules clamp to the end
+    // of short months, so a rule on the 31st falls on the 30th in April.
+    Date occurrence(std::int64_t n) const noexcept {
+        switch (freq) {
+            case Freq::Daily:  return civil_from_days(days_from_civil(start) + n*interval);
+            case Freq::Weekly: return civil_from_days(days_from_civil(start) + n*7*interval);
+            case Freq::Monthly: {
+                std::int64_t t = (start.m-1) + n*interval;
+                int y = static_cast<int>(start.y + t/12), m = static_cast<int>(t%12 + 1);
+                return Date{ y, m, std::min(start.d, days_in_month(y, m)) };
+            }
+            case Freq::Yearly: {
+                int y = static_cast<int>(start.y + n*interval);
+                return Date{ y, start.m, std::min(start.d, days_in_month(y, start.m)) };
+            }
+        }
+        return start;
+    }
+    // Index of the first occurrence on or after d.
+    std::int64_t first_on_or_after(const Date& d) const noexcept {
+        std::int64_t n = 0;
+        switch (freq) {
+            case Freq::Daily: case Freq::Weekly: {
+                std::int64_t step = (freq==Freq::Daily ? 1 : 7) * std::int64_t(interval);
+                std::int64_t diff = days_from_civil(d) - days_from_civil(start);
+                n = diff > 0 ? (diff + step - 1)/step : 0;
+                break;
+            }
+            case Freq::Monthly: n = ((d.y - start.y)*12 + (d.m - start.m)) / interval; break;
+            case Freq::Yearly:  n = (d.y - start.y) / interval; break;
+        }
+        if (n < 0) n = 0;
+        while (!date_le(d, occurrence(n))) ++n;
+        return n;
+    }
+    // Index one past the last occurrence on or before d (clipped to `until`).
+    std::int64_t end_on_or_before(const Date& d) const noexcept {
+        Date lim = (until && date_le(*until, d)) ? *until : d;
+        return first_on_or_after(civil_from_days(days_from_civil(lim) + 1));
+    }
+    // Index of the occurrence falling on d, if there is one.
+    std::optional<std::int64_t> occurrence_on(const Date& d) const noexcept {
+        if (until && !date_le(d, *until)) return std::nullopt;
+        std::int64_t n = first_on_or_after(d);
+        Date o = occurrence(n);
+        if (!(date_le(o, d) && date_le(d, o))) return std::nullopt;
+        return n;
+    }
+};
+
+// The stored form of a rule is one CSV line:
+//   start,until,freq,interval,amount,category,description,skipped
+// with `until` empty for an open-ended rule, freq one of daily, weekly,
+// monthly or yearly, and the skipped occurrence indices separated by spaces.
+// It is used by the .recurring file beside a saved ledger and by the
+// journal's RuleAdd records.
+constexpr const char* kFreqNames[] = { "daily", "weekly", "monthly", "yearly" };
+
+inline std::string encode_rule(const RecurrenceRule& r) {
+    std::ostringstream os;
+    os << to_string(r.start) << ',' << (r.until ? to_string(*r.until) : std::string()) << ','
+       << kFreqNames[static_cast<int>(r.freq)] << ',' << r.interval << ','
+       << std::setprecision(std::numeric_limits<double>::max_digits10) << r.amount << ','
+       << csv_escape(r.category) << ',' << csv_escape(r.description) << ',';
+    const char* sep = "";
+    for (auto n : r.skipped) { os << sep << n; sep = " "; }
+    return os.str();
+}
+inline bool decode_rule(const std::string& line, RecurrenceRule& r) {
+    std::vector<std::string> cols; csv_split_line(line, cols);
+    if (cols.size() != 8) return false;
+    auto start = parse_date(cols[0]);
+    if (!start) return false;
+    r = RecurrenceRule{};
+    r.start = *start;
+    if (!cols[1].empty()) { r.until = parse_date(cols[1]); if (!r.until) return false; }
+    auto f = std::find(std::begin(kFreqNames), std::end(kFreqNames), cols[2]);
+    if (f == std::end(kFreqNames)) return false;
+    r.freq = static_cast<Freq>(f - std::begin(kFreqNames));
+    try {
+        r.interval = std::stoi(cols[3]);
+        r.amount = std::stod(cols[4]);
+        std::istringstream skipped(cols[7]);
+        for (std::int64_t n; skipped >> n; ) r.skipped.insert(n);
+        if (!skipped.eof()) return false;
+    } catch (...) { return false; }
+    r.category = csv_unescape(cols[5]);
+    r.description = csv_unescape(cols[6]);
+    return r.interval >= 1;
+}
+inline std::string recurring_file_path(const std::string& ledger) { return ledger + ".recurring"; }
+
+// ---- Anomaly detection ----
+// Per-category exponentially weighted mean and variance, updated in O(1) as
+// rows are ingested. A row more than k standard deviations from its
+// category's running mean is flagged. The first `warmup` rows of a category
+// only train it (with alpha = 1/n, i.e. the plain running mean/variance).
+class AnomalyDetector {
+public:
+    struct Flag {
+        Expense e;
+        double mean{0.0}, sigma{0.0}, z{0.0};
+    };
+
+    double threshold() const { return k_; }
+    void set_threshold(double k) { if (k > 0) k_ = k; }
+    std::uint64_t flagged_count() const { return flagged_; }
+    // Most recent flags, oldest first; at most kMaxFlags are kept.
+    const std::deque<Flag>& flags() const { return flags_; }
+
+    // Scores e against its category's history, then folds it in. Returns true if flagged.
+    bool observe(CategoryTree::Id cat, const Expense& e) {
+        if (cat >= stats_.size()) stats_.resize(cat+1);
+        Stats& st = stats_[cat];
+        const double x = e.amount;
+        bool flag = false;
+        if (st.n >= kWarmup) {
+            double sigma = std::sqrt(st.var);
+            double z = sigma > 0 ? (x - st.mean) / sigma : 0.0;
+            if (sigma > 0 && std::fabs(z) > k_) {
+                flag = true; ++flagged_;
+                flags_.push_back(Flag{ e, st.mean, sigma, z });
+                if (flags_.size() > kMaxFlags) flags_.pop_front();
+            }
+        }
+        ++st.n;
+        double a = st.n <= kWarmup ? 1.0 / static_cast<double>(st.n) : kAlpha;
+        double diff = x - st.mean, incr = a * diff;
+        st.mean += incr;
+        st.var = (1.0 - a) * (st.var + diff * incr);
+        return flag;
+    }
+    void clear() { stats_.clear(); flags_.clear(); flagged_ = 0; }
+
+private:
+    struct Stats { double mean{0.0}, var{0.0}; std::uint64_t n{0}; };
+    static constexpr double kAlpha = 0.05;
+    static constexpr std::uint64_t kWarmup = 10;
+    static constexpr std::size_t kMaxFlags = 1000;
+    double k_{4.0};
+    std::vector<Stats> stats_;
+    std::deque<Flag> flags_;
+    std::uint64_t flagged_{0};
+};
+
+// ---- Heavy hitters ----
+// Weighted Space-Saving sketch: at most kCapacity counters, each an upper
+// bound on its key's true weight with a known maximum overestimate. A new
+// key evicts the smallest counter and inherits its value as error.
+// Sketches merge by adding counters, with a key missing from one side
+// charged that side's minimum, then keeping the largest kCapacity.
+struct HeavyHitter {
+    std::string key;
+    double estimate{0.0};  // upper bound on the true weight
+    double error{0.0};     // estimate - error is a lower bound
+};
+
+class SpaceSaving {
+public:
+    static constexpr std::size_t kCapacity = 64;
+
+    void add(const std::string& key, double w) {
+        auto it = slots_.find(key);
+        if (it != slots_.end()) { it->second.value += w; return; }
+        if (slots_.size() < kCapacity) { slots_.emplace(key, Counter{ w, 0.0 }); return; }
+        auto min = std::min_element(slots_.begin(), slots_.end(),
+                                    [](const auto& a, const auto& b){ return a.second.value < b.second.value; });
+        Counter c{ min->second.value + w, min->second.value };
+        slots_.erase(min);
+        slots_.emplace(key, c);
+    }
+    // Takes w back from a tracked key. The estimate stays an upper bound for
+    // that key, but floor() may no longer bound the untracked ones.
+    void retract(const std::string& key, double w) {
+        auto it = slots_.find(key);
+        if (it != slots_.end()) it->second.value -= w;
+    }
+    // Smallest counter when full, else 0: the most any untracked key can weigh.
+    double floor() const {
+        if (slots_.size() < kCapacity) return 0.0;
+        double m = std::numeric_limits<double>::max();
+        for (const auto& kv : slots_) m = std::min(m, kv.second.value);
+        return m;
+    }
+    void merge(const SpaceSaving& o) {
+        double fa = floor(), fb = o.floor();
+        std::unordered_map<std::string, Counter> all;
+        for (const auto& kv : slots_) {
+            auto it = o.slots_.find(kv.first);
+            Counter b = it != o.slots_.end() ? it->second : Counter{ fb, fb };
+            all.emplace(kv.first, Counter{ kv.second.value + b.value, kv.second.error + b.error });
+        }
+        for (const auto& kv : o.slots_) {
+            if (slots_.count(kv.first)) continue;
+            all.emplace(kv.first, Counter{ kv.second.value + fa, kv.second.error + fa });
+        }
+        if (all.size() > kCapacity) {
+            std::vector<std::pair<std::string, Counter>> v(all.begin(), all.end());
+            std::nth_element(v.begin(), v.begin() + kCapacity, v.end(),
+                             [](const auto& a, const auto& b){ return a.second.value > b.second.value; });
+            v.resize(kCapacity);
+            all = std::unordered_map<std::string, Counter>(v.begin(), v.end());
+        }
+        slots_.swap(all);
+    }
+    std::vector<HeavyHitter> top(std::size_t n) const {
+        std::vector<HeavyHitter> out;
+        for (const auto& kv : slots_) out.push_back(HeavyHitter{ kv.first, kv.second.value, kv.second.error });
+        std::sort(out.begin(), out.end(), [](const HeavyHitter& a, const HeavyHitter& b) {
+            return a.estimate > b.estimate || (a.estimate == b.estimate && a.key < b.key);
+        });
+        if (out.size() > n) out.resize(n);
+        return out;
+    }
+
+private:
+    struct Counter { double value; double error; };
+    std::unordered_map<std::string, Counter> slots_;
+};
+
+// Merchant key for a description: lower-case words with digits and
+// punctuation dropped, so "UBER *TRIP 8841" and "Uber trip" agree.
+inline std::string merchant_key(const std::string& desc) {
+    std::string out;
+    bool gap = false;
+    for (unsigned char c : desc) {
+        if (std::isalpha(c)) {
+            if (gap && !out.empty()) out.push_back(' ');
+            out.push_back(static_cast<char>(std::tolower(c)));
+            gap = false;
+        } else {
+            gap = true;
+        }
+    }
+    return out;
+}
+
+// Frequency and spend sketches per calendar month. Window queries merge the
+// months that overlap the window, so windows are rounded out to whole months.
+class MerchantSketches {
+public:
+    void observe(const Expense& e) {
+        auto key = merchant_key(e.description);
+        if (key.empty()) return;
+        Month& m = months_[e.date.y*12 + (e.date.m-1)];
+        m.count.add(key, 1.0);
+        m.spend.add(key, e.amount);
+    }
+    // Undoes observe(e) as far as the sketches allow (see retract()).
+    void forget(const Expense& e) {
+        auto key = merchant_key(e.description);
+        auto it = months_.find(e.date.y*12 + (e.date.m-1));
+        if (key.empty() || it == months_.end()) return;
+        it->second.count.retract(key, 1.0);
+        it->second.spend.retract(key, e.amount);
+    }
+    void clear() { months_.clear(); }
+    static int month_of(const Date& d) { return d.y*12 + (d.m-1); }
+    // The months lying entirely within [from, to]; empty if first > second.
+    static std::pair<int, int> whole_months(const Date& from, const Date& to) {
+        return { month_of(from) + (from.d > 1 ? 1 : 0),
+                 month_of(to) - (to.d < days_in_month(to.y, to.m) ? 1 : 0) };
+    }
+    // Drops the sketches of whole_months(from, to). Rows deleted from the
+    // partially covered months at either end must be forgotten one by one.
+    void drop_months(const Date& from, const Date& to) {
+        auto [lo, hi] = whole_months(from, to);
+        if (lo > hi) return;
+        months_.erase(months_.lower_bound(lo), months_.upper_bound(hi));
+    }
+    std::vector<HeavyHitter> top(const Date& from, const Date& to, std::size_t n, bool by_spend) const {
+        SpaceSaving acc;
+        auto lo = months_.lower_bound(from.y*12 + (from.m-1));
+        auto hi = months_.upper_bound(to.y*12 + (to.m-1));
+        for (auto it = lo; it != hi; ++it) acc.merge(by_spend ? it->second.spend : it->second.count);
+        return acc.top(n);
+    }
+
+private:
+    struct Month { SpaceSaving count, spend; };
+    std::map<int, Month> months_;
+};
+
+// ---- Categorization rules ----
+// Keyword -> category rules compiled into one Aho-Corasick automaton, so a
+// description is matched against every rule in a single pass. Matching is
+// case-insensitive; when several keywords occur, the earliest rule wins.
+// The automaton is a dense DFA over the bytes that occur in keywords (all
+// other bytes share one class), so each input byte is one table lookup.
+class CategoryRules {
+public:
+    void add_rule(const std::string& keyword, const std::string& category) {
+        if (keyword.empty()) return;
+        rules_.push_back(Rule{ to_lower(keyword), category });
+        compiled_ = false;
+    }
+    std::size_t size() const { return rules_.size(); }
+
+    // Reads "keyword,category" lines (CSV quoting allowed; a header is skipped).
+    bool load(const std::string& path) {
+        std::ifstream f(path); if (!f) return false;
+        std::string line; std::vector<std::string> cols;
+        while (std::getline(f, line)) {
+            csv_split_line(line, cols);
+            if (cols.size() < 2) continue;
+            std::string kw = csv_unescape(cols[0]), cat = csv_unescape(cols[1]);
+            if (iequals(kw, "keyword") && iequals(cat, "category")) continue;
+            add_rule(kw, cat);
+        }
+        compile();
+        return true;
+    }
+
+    void compile() {
+        std::fill(std::begin(cls_), std::end(cls_), 0);
+        std::uint32_t nclass = 1;
+        for (const auto& r : rules_) {
+            for (unsigned char c : r.keyword) if (!cls_[c]) cls_[c] = nclass++;
+        }
+        // Upper-case letters share their lower-case class.
+        for (int c='A'; c<='Z'; ++c) cls_[c] = cls_[c - 'A' + 'a'];
+        width_ = nclass;
+
+        // Trie, with 0 meaning "no edge" (the root is never a child).
+        delta_.assign(width_, 0);
+        out_.assign(1, kNoRule);
+        for (std::uint32_t ri=0; ri<rules_.size(); ++ri) {
+            std::uint32_t st = 0;
+            for (unsigned char c : rules_[ri].keyword) {
+                std::uint32_t& next = delta_[st*width_ + cls_[c]];
+                if (!next) {
+                    next = static_cast<std::uint32_t>(out_.size());
+                    out_.push_back(kNoRule);
+                    delta_.resize(delta_.size() + width_, 0);
+                }
+                st = delta_[st*width_ + cls_[c]];
+            }
+            out_[st] = std::min(out_[st], ri);
+        }
+        // BFS: fill missing edges from the failure state and fold each
+        // state's failure output into its own (lowest rule index wins).
+        std::vector<std::uint32_t> fail(out_.size(), 0), queue;
+        for (std::uint32_t c=0; c<width_; ++c) if (std::uint32_t t = delta_[c]) queue.push_back(t);
+        for (std::size_t qi=0; qi<queue.size(); ++qi) {
+            std::uint32_t st = queue[qi];
+            out_[st] = std::min(out_[st], out_[fail[st]]);
+            for (std::uint32_t c=0; c<width_; ++c) {
+                std::uint32_t& t = delta_[st*width_ + c];
+                std::uint32_t via_fail = delta_[fail[st]*width_ + c];
+                if (t) { fail[t] = via_fail; queue.push_back(t); }
+                else t = via_fail;
+            }
+        }
+        compiled_ = true;
+    }
+
+    // Category of the highest-priority rule whose keyword occurs in text.
+    const std::string* match(const std::string& text) const {
+        if (!compiled_ || rules_.empty()) return nullptr;
+        std::uint32_t st = 0, best = kNoRule;
+        for (unsigned char c : text) {
+            st = delta_[st*width_ + cls_[c]];
+            best = std::min(best, out_[st]);
+        }
+        return best == kNoRule ? nullptr : &rules_[best].category;
+    }
+
+private:
+    struct Rule { std::string keyword, category; };
+    static constexpr std::uint32_t kNoRule = ~std::uint32_t{0};
+    std::vector<Rule> rules_;
+    std::uint32_t cls_[256]{};
+    std::uint32_t width_{1};
+    std::vector<std::uint32_t> delta_;  // state * width_ + class -> state
+    std::vector<std::uint32_t> out_;    // lowest rule index matched on reaching state
+    bool compiled_{false};
+};
+
+// ---- Change journal ----
+// Binary change-data-capture stream. The manager appends one frame per
+// mutation batch; consumers keep a byte-offset cursor and read whole frames.
+//   frame  := u32 magic | u32 payload_bytes | u32 record_count | payload
+//   record := u8 kind | u64 seq | u32 row | i32 yyyymmdd | f64 amount
+//             | u32 len | category | u32 len | description
+// Integers are little-endian. Frames written before string lengths were
+// widened carry the "ETJ1" magic and u16 lengths; they are still read. The
+// records of a frame fill its payload exactly. Replaying records in order reproduces the ledger:
+// Remove moves the last row into `row`, Truncate resizes to `row` rows and
+// Reset clears the ledger (it is followed by Adds in the same frame) and
+// SetCategory changes only the category of `row`. DeleteRange removes the rows
+// dated from e.date through `row` (as yyyymmdd), keeping the others in order.
+// RuleAdd appends recurring rule `row`, stored as its encode_rule line in the
+// description; RuleSkip and RuleUnskip skip or restore that rule's
+// occurrence on e.date. Reset also drops the recurring rules. Restore
+// appends like Add, for a row brought back by undo or redo that the
+// streaming statistics have already seen.
+enum class ChangeKind : std::uint8_t { Add=1, Edit=2, Remove=3, Truncate=4, Reset=5, SetCategory=6,
+                                       DeleteRange=7, RuleAdd=8, RuleSkip=9, RuleUnskip=10, Restore=11 };
+
+struct Change {
+    ChangeKind kind{ChangeKind::Add};
+    std::uint64_t seq{0};
+    std::uint32_t row{0};
+    Expense e{};
+};
+
+inline const char* change_kind_name(ChangeKind k) {
+    switch (k) {
+        case ChangeKind::Add: return "add";
+        case ChangeKind::Edit: return "edit";
+        case ChangeKind::Remove: return "remove";
+        case ChangeKind::Truncate: return "truncate";
+        case ChangeKind::Reset: return "reset";
+        case ChangeKind::SetCategory: return "set-category";
+        case ChangeKind::DeleteRange: return "delete-range";
+        case ChangeKind::RuleAdd: return "rule-add";
+        case ChangeKind::RuleSkip: return "rule-skip";
+        case ChangeKind::RuleUnskip: return "rule-unskip";
+        case ChangeKind::Restore: return "restore";
+    }
+    return "?";
+}
+
+constexpr std::uint32_t kJournalMagic = 0x324A5445;   // "ETJ2"
+constexpr std::uint32_t kJournalMagicV1 = 0x314A5445; // "ETJ1": u16 string lengths
+constexpr std::size_t kFrameHeader = 12;
+
+inline void put_le(std::string& out, std::uint64_t v, int bytes) {
+    for (int i=0;i<bytes;++i) out.push_back(static_cast<char>((v >> (8*i)) & 0xFF));
+}
+inline std::uint64_t get_le(const char* p, int bytes) {
+    std::uint64_t v=0;
+    for (int i=0;i<bytes;++i) v |= std::uint64_t(static_cast<unsigned char>(p[i])) << (8*i);
+    return v;
+}
+inline std::int32_t pack_date(const Date& d) noexcept { return d.y*10000 + d.m*100 + d.d; }
+inline Date unpack_date(std::int32_t v) noexcept { return Date{ v/10000, (v/100)%100, v%100 }; }
+
+inline void encode_change(std::string& out, const Change& c) {
+    out.push_back(static_cast<char>(c.kind));
+    put_le(out, c.seq, 8);
+    put_le(out, c.row, 4);
+    put_le(out, static_cast<std::uint32_t>(pack_date(c.e.date)), 4);
+    std::uint64_t bits; std::memcpy(&bits, &c.e.amount, 8); put_le(out, bits, 8);
+    for (const std::string* s : {&c.e.category, &c.e.description}) { put_le(out, s->size(), 4); out += *s; }
+}
+inline bool known_change_kind(std::uint8_t k) {
+    return k >= static_cast<std::uint8_t>(ChangeKind::Add) && k <= static_cast<std::uint8_t>(ChangeKind::Restore);
+}
+// Returns bytes consumed, or 0 if the record is malformed. `len_bytes` is 4,
+// or 2 for ETJ1 frames.
+inline std::size_t decode_change(const char* p, std::size_t n, Change& c, int len_bytes = 4) {
+    constexpr std::size_t fixed = 1+8+4+4+8;
+    if (n < fixed || !known_change_kind(static_cast<std::uint8_t>(p[0]))) return 0;
+    c.kind = static_cast<ChangeKind>(p[0]);
+    c.seq = get_le(p+1, 8);
+    c.row = static_cast<std::uint32_t>(get_le(p+9, 4));
+    c.e.date = unpack_date(static_cast<std::int32_t>(get_le(p+13, 4)));
+    std::uint64_t bits = get_le(p+17, 8); std::memcpy(&c.e.amount, &bits, 8);
+    std::size_t off = fixed;
+    for (std::string* s : {&c.e.category, &c.e.description}) {
+        if (n - off < static_cast<std::size_t>(len_bytes)) return 0;
+        std::size_t len = get_le(p+off, len_bytes); off += len_bytes;
+        if (len > n - off) return 0;
+        s->assign(p+off, len); off += len;
+    }
+    return off;
+}
+
+// Appending side of the journal. Records are buffered and written as one
+// frame per commit(), so a bulk import is a single write. On Linux each
+// commit also waits for fdatasync before returning, so a mutation is durable
+// once the call that made it returns; batching mutations (add_batch, the
+// server's per-shard add batches) is group commit, one sync per batch.
+// Elsewhere frames are only flushed to the OS: the journal survives a crash
+// of this process, not of the machine.
+class ChangeJournal {
+public:
+    ChangeJournal() = default;
+    ChangeJournal(const ChangeJournal&) = delete;
+    ChangeJournal& operator=(const ChangeJournal&) = delete;
+    ~ChangeJournal() { close(); }
+
+    // A torn frame left at the end by a crash is cut off, so new frames
+    // follow the last complete one.
+    bool open(const std::string& path) {
+        close();
+        std::uint64_t last = 0;
+        if (!scan_last_seq_(path, last)) return false;
+        f_ = std::fopen(path.c_str(), "ab");
+        if (!f_) return false;
+        seq_ = last; path_ = path; failed_ = false;
+        return true;
+    }
+    void close() {
+        if (!f_) return;
+        commit();
+        std::fclose(f_); f_ = nullptr;
+    }
+    bool is_open() const { return f_ != nullptr; }
+    const std::string& path() const { return path_; }
+    std::uint64_t last_seq() const { return seq_; }
+    // True once a frame failed to write or sync; later frames may be lost.
+    bool failed() const { return failed_; }
+
+    void record(ChangeKind k, std::size_t row, const Expense& e) {
+        if (!f_) return;
+        encode_change(pending_, Change{ k, ++seq_, static_cast<std::uint32_t>(row), e });
+        ++count_;
+    }
+    bool commit() {
+        if (!f_ || count_ == 0) return !failed_;
+        std::string hdr;
+        put_le(hdr, kJournalMagic, 4); put_le(hdr, pending_.size(), 4); put_le(hdr, count_, 4);
+        bool ok = std::fwrite(hdr.data(), 1, hdr.size(), f_) == hdr.size() &&
+                  std::fwrite(pending_.data(), 1, pending_.size(), f_) == pending_.size() &&
+                  std::fflush(f_) == 0;
+#ifdef __linux__
+        ok = ok && ::fdatasync(::fileno(f_)) == 0;
+#endif
+        if (!ok) failed_ = true;
+        pending_.clear(); count_ = 0;
+        return ok;
+    }
+
+private:
+    std::FILE* f_{nullptr};
+    std::string path_, pending_;
+    std::uint64_t seq_{0};
+    std::uint32_t count_{0};
+    bool failed_{false};
+
+    // Finds the last sequence number and truncates the file after the last
+    // complete frame. False if the journal is corrupt.
+    static bool scan_last_seq_(const std::string& path, std::uint64_t& last);
+};
+
+// Reading side: a byte-offset cursor over a journal file. poll() returns the
+// records of every complete frame past the cursor; a frame still being written
+// is left for the next poll.
+class ChangeCursor {
+public:
+    explicit ChangeCursor(std::string path, std::uint64_t offset = 0)
+        : path_(std::move(path)), offset_(offset) {}
+
+    std::uint64_t offset() const { return offset_; }
+    bool corrupt() const { return corrupt_; }
+
+    std::size_t poll(std::vector<Change>& out,
+                     std::size_t max_frames = std::numeric_limits<std::size_t>::max()) {
+        std::ifstream f(path_, std::ios::binary);
+        if (!f || corrupt_) return 0;
+        f.seekg(0, std::ios::end);
+        std::uint64_t end = static_cast<std::uint64_t>(f.tellg());
+        std::size_t frames = 0, before = out.size();
+        std::string buf;
+        while (frames < max_frames && offset_ + kFrameHeader <= end) {
+            char hdr[kFrameHeader];
+            f.seekg(static_cast<std::streamoff>(offset_));
+            if (!f.read(hdr, kFrameHeader)) break;
+            const std::uint64_t magic = get_le(hdr, 4);
+            if (magic != kJournalMagic && magic != kJournalMagicV1) { corrupt_ = true; break; }
+            const int len_bytes = magic == kJournalMagic ? 4 : 2;
+            std::uint64_t bytes = get_le(hdr+4, 4), count = get_le(hdr+8, 4);
+            if (offset_ + kFrameHeader + bytes > end) break;
+            buf.resize(bytes);
+            if (!f.read(&buf[0], static_cast<std::streamsize>(bytes))) break;
+            std::size_t pos = 0;
+            for (std::uint64_t i=0;i<count;++i) {
+                Change c;
+                std::size_t used = decode_change(buf.data()+pos, buf.size()-pos, c, len_bytes);
+                if (!used) { corrupt_ = true; out.resize(before); return 0; }
+                out.push_back(std::move(c)); pos += used;
+            }
+            if (pos != buf.size()) { corrupt_ = true; out.resize(before); return 0; }
+            offset_ += kFrameHeader + bytes; before = out.size(); ++frames;
+        }
+        return frames;
+    }
+
+private:
+    std::string path_;
+    std::uint64_t offset_{0};
+    bool corrupt_{false};
+};
+
+inline bool ChangeJournal::scan_last_seq_(const std::string& path, std::uint64_t& last) {
+    std::ifstream probe(path, std::ios::binary);
+    if (!probe) { last = 0; return true; }
+    probe.close();
+    ChangeCursor cur(path);
+    std::vector<Change> batch;
+    last = 0;
+    while (cur.poll(batch, 64) > 0) {
+        if (!batch.empty()) last = batch.back().seq;
+        batch.clear();
+    }
+    if (cur.corrupt()) return false;
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (!ec && size > cur.offset()) std::filesystem::resize_file(path, cur.offset(), ec);
+    return !ec;
+}
+
+// ---- Query budget ----
+// Cooperative limits on one query run: a cancel flag, a deadline and a cap
+// on the scratch memory the run allocates (selection vectors, copied rows,
+// group keys). Scan loops step a BudgetMeter per row; every kStride rows it
+// charges the bytes noted since and checks for cancellation and the
+// deadline. A tripped budget stays tripped, the scan drops its scratch and
+// the caller reports reason(). Threads working on the same query share one
+// budget; cancel() is safe from any thread and from a signal handler.
+class QueryBudget {
+public:
+    static constexpr std::size_t kStride = 4096;
+
+    // Set before the run starts.
+    void set_timeout(std::chrono::milliseconds ms) { deadline_ = std::chrono::steady_clock::now() + ms; }
+    void set_memory_limit(std::size_t bytes) { limit_ = bytes; }
+
+    void cancel() { trip_(Cancelled); }
+    bool stopped() {
+        if (state_.load(std::memory_order_relaxed) != Running) return true;
+        if (deadline_ && std::chrono::steady_clock::now() >= *deadline_) trip_(TimedOut);
+        return state_.load(std::memory_order_relaxed) != Running;
+    }
+    // Accounts bytes of scratch. False once the limit is passed.
+    bool charge(std::size_t bytes) {
+        if (limit_ && used_.fetch_add(bytes, std::memory_order_relaxed) + bytes > limit_) trip_(OverMemory);
+        return state_.load(std::memory_order_relaxed) != OverMemory;
+    }
+    const char* reason() const {
+        switch (state_.load(std::memory_order_relaxed)) {
+            case Cancelled: return "query cancelled";
+            case TimedOut: return "query timed out";
+            case OverMemory: return "query exceeded its memory limit";
+        }
+        return "";
+    }
+
+private:
+    enum State : int { Running, Cancelled, TimedOut, OverMemory };
+    std::atomic<int> state_{Running};
+    std::atomic<std::size_t> used_{0};
+    std::optional<std::chrono::steady_clock::time_point> deadline_;
+    std::size_t limit_{0};
+
+    void trip_(State s) { int r = Running; state_.compare_exchange_strong(r, s); }
+};
+
+// Per-loop view of an optional budget. step() is cheap between strides.
+class BudgetMeter {
+public:
+    explicit BudgetMeter(QueryBudget* budget) : budget_(budget) {}
+    // Counts one row and `bytes` of scratch. False once the run must stop.
+    bool step(std::size_t bytes = 0) {
+        if (!budget_) return true;
+        bytes_ += bytes;
+        if (++n_ % QueryBudget::kStride) return true;
+        return flush();
+    }
+    bool flush() {
+        if (!budget_) return true;
+        bool ok = budget_->charge(bytes_) && !budget_->stopped();
+        bytes_ = 0;
+        return ok;
+    }
+
+private:
+    QueryBudget* budget_;
+    std::size_t n_{0}, bytes_{0};
+};
+
+inline std::size_t scratch_bytes(const Expense& e) {
+    return sizeof(Expense) + e.category.size() + e.description.size();
+}
+
+// ---- Index files ----
+// save_arrow writes the ledger's indexes next to the snapshot, in
+// <snapshot>.idx, so load_arrow adopts them instead of interning every
+// category and sorting every amount again. The file is a 64-byte header and
+// 8-byte aligned arrays in the host's (little-endian) layout. load_arrow
+// maps it read-only and validates it in place, then copies the arrays into
+// the manager's own indexes; adopting saves the sorting, not that copy:
+//   header  := u64 magic | u64 version | u64 ledger_bytes | u64 ledger_digest
+//              | u64 rows | u64 categories | u64 names_bytes | u64 payload_digest
+//   payload := u64 name_end[categories] | names            category paths by id
+//              | u32 cat_id[rows]                          per row
+//              | i64 cents[rows] | u32 key_row[rows]       amount keys, ascending
+//              | u64 list_end[categories]                  per category, rows by date:
+//              | (i32 day, u32 row)[rows] | i64 prefix[rows+categories]
+// Each array is zero-padded to a multiple of 8 bytes. A category's prefix
+// sums start at list_begin + id. The snapshot's size and digest tie the file
+// to one version of the ledger and the payload digest catches torn or
+// damaged files; a file failing either check is stale and is rewritten.
+constexpr std::uint64_t kIndexMagic = 0x0000315844495445;  // "ETIDX1"
+constexpr std::uint64_t kIndexVersion = 1;
+
+inline std::string index_file_path(const std::string& snapshot) { return snapshot + ".idx"; }
+
+// 64-bit digest of a byte stream fed in pieces of any size; equal streams
+// give equal digests however they are split. Not cryptographic.
+class StreamDigest {
+public:
+    void update(const void* data, std::size_t n) {
+        const char* p = static_cast<const char*>(data);
+        bytes_ += n;
+        while (n && fill_) { tail_[fill_++] = *p++; --n; if (fill_ == 8) { mix_(tail_); fill_ = 0; } }
+        if (fill_) return;
+        for (; n >= 8; p += 8, n -= 8) mix_(p);
+        if (n) std::memcpy(tail_, p, n);
+        fill_ = n;
+    }
+    std::uint64_t value() const {
+        char last[8]{};
+        std::memcpy(last, tail_, fill_);
+        std::uint64_t w; std::memcpy(&w, last, 8);
+        std::uint64_t h = (h_ ^ w * kMul1) + bytes_;
+        h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull; h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull; h ^= h >> 33;
+        return h;
+    }
+    std::uint64_t bytes() const { return bytes_; }
+
+private:
+    static constexpr std::uint64_t kMul1 = 0x9E3779B97F4A7C15ull, kMul2 = 0xD6E8FEB86659FD93ull;
+    std::uint64_t h_{0x27D4EB2F165667C5ull}, bytes_{0};
+    char tail_[8]{};
+    std::size_t fill_{0};
+
+    void mix_(const char* p) {
+        std::uint64_t w; std::memcpy(&w, p, 8);
+        h_ ^= w * kMul1;
+        h_ = ((h_ << 29) | (h_ >> 35)) * kMul2;
+    }
+};
+
+// Whole-file read-only view: mapped on Linux, read into memory elsewhere.
+class FileView {
+public:
+    explicit FileView(const std::string& path) {
+#ifdef __linux__
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) { map_ = p; data_ = static_cast<const char*>(p); size_ = static_cast<std::size_t>(st.st_size); }
+        }
+        ::close(fd);
+#else
+        std::ifstream f(path, std::ios::binary);
+        copy_.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        data_ = copy_.data(); size_ = copy_.size();
+#endif
+    }
+    ~FileView() {
+#ifdef __linux__
+        if (map_) munmap(map_, size_);
+#endif
+    }
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const char* data_{nullptr};
+    std::size_t size_{0};
+#ifdef __linux__
+    void* map_{nullptr};
+#else
+    std::string copy_;
+#endif
+};
+
+// Ledger columns an index file is built from; ids index `names`.
+struct IndexColumns {
+    std::vector<std::string> names;
+    std::vector<std::uint32_t> cat_ids;
+    std::vector<std::int32_t> days;
+    std::vector<std::int64_t> cents;
+};
+
+// Builds the indexes from the columns and writes them for the snapshot
+// described by `ledger`. The file is written beside its final name and
+// renamed into place, so readers never see a partial file.
+inline bool write_index_file(const std::string& path, const StreamDigest& ledger, const IndexColumns& c) {
+    const std::size_t rows = c.cat_ids.size(), cats = c.names.size();
+    std::vector<std::uint64_t> name_end;
+    std::string names;
+    for (const auto& s : c.names) { names += s; name_end.push_back(names.size()); }
+
+    std::vector<std::uint32_t> order(rows);
+    for (std::size_t i=0;i<rows;++i) order[i] = static_cast<std::uint32_t>(i);
+    std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return c.cents[a] < c.cents[b] || (c.cents[a] == c.cents[b] && a < b);
+    });
+    std::vector<std::int64_t> key_cents(rows);
+    for (std::size_t i=0;i<rows;++i) key_cents[i] = c.cents[order[i]];
+
+    // Rows bucketed by category, then sorted by date within each bucket.
+    std::vector<std::uint64_t> list_end(cats, 0);
+    for (auto id : c.cat_ids) ++list_end[id];
+    for (std::size_t i=1;i<cats;++i) list_end[i] += list_end[i-1];
+    std::vector<CategoryDateIndex::Entry> entries(rows);
+    {
+        std::vector<std::uint64_t> at(cats, 0);
+        for (std::size_t i=1;i<cats;++i) at[i] = list_end[i-1];
+        for (std::size_t i=0;i<rows;++i) entries[at[c.cat_ids[i]]++] = { c.days[i], static_cast<std::uint32_t>(i) };
+    }
+    std::vector<std::int64_t> prefix;
+    prefix.reserve(rows + cats);
+    for (std::size_t id=0, begin=0; id<cats; begin = list_end[id++]) {
+        std::sort(entries.begin() + begin, entries.begin() + list_end[id],
+                  [](const CategoryDateIndex::Entry& a, const CategoryDateIndex::Entry& b) {
+                      return a.day < b.day || (a.day == b.day && a.row < b.row);
+                  });
+        prefix.push_back(0);
+        for (std::size_t i=begin;i<list_end[id];++i) prefix.push_back(prefix.back() + c.cents[entries[i].row]);
+    }
+
+    const std::string tmp = path + ".tmp";
+    std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    std::uint64_t header[8] = { kIndexMagic, kIndexVersion, ledger.bytes(), ledger.value(), rows, cats, names.size(), 0 };
+    f.write(reinterpret_cast<const char*>(header), sizeof header);
+    StreamDigest payload;
+    auto put = [&](const void* p, std::size_t n) {
+        static const char zeros[8]{};
+        f.write(static_cast<const char*>(p), static_cast<std::streamsize>(n));
+        payload.update(p, n);
+        if (n % 8) { f.write(zeros, static_cast<std::streamsize>(8 - n % 8)); payload.update(zeros, 8 - n % 8); }
+    };
+    put(name_end.data(), 8*cats);
+    put(names.data(), names.size());
+    put(c.cat_ids.data(), 4*rows);
+    put(key_cents.data(), 8*rows);
+    put(order.data(), 4*rows);
+    put(list_end.data(), 8*cats);
+    put(entries.data(), 8*rows);
+    put(prefix.data(), 8*prefix.size());
+    header[7] = payload.value();
+    f.seekp(0);
+    f.write(reinterpret_cast<const char*>(header), sizeof header);
+    f.close();
+    if (!f) { std::remove(tmp.c_str()); return false; }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// A validated index file, viewed in place.
+class IndexFile {
+public:
+    // Maps the file and checks it against the snapshot just read. False if
+    // it is missing, stale, damaged or inconsistent.
+    bool open(const std::string& path, const StreamDigest& ledger, std::size_t rows) {
+        view_ = std::make_unique<FileView>(path);
+        const char* p = view_->data();
+        std::uint64_t h[8];
+        if (view_->size() < sizeof h) return false;
+        std::memcpy(h, p, sizeof h);
+        if (h[0] != kIndexMagic || h[1] != kIndexVersion || h[2] != ledger.bytes() || h[3] != ledger.value()
+            || h[4] != rows || h[5] > std::numeric_limits<std::uint32_t>::max() || h[6] > view_->size()) return false;
+        cats_ = static_cast<std::size_t>(h[5]);
+        auto pad = [](std::size_t n) { return (n + 7) / 8 * 8; };
+        std::size_t off = sizeof h;
+        auto take = [&](std::size_t n) { const char* at = p + off; off += pad(n); return at; };
+        if (view_->size() - off != 8*cats_ + pad(h[6]) + 2*pad(4*rows) + 8*rows + 8*cats_ + 8*rows + 8*(rows + cats_))
+            return false;
+        StreamDigest payload;
+        payload.update(p + off, view_->size() - off);
+        if (payload.value() != h[7]) return false;
+
+        name_end_ = reinterpret_cast<const std::uint64_t*>(take(8*cats_));
+        names_ = take(h[6]);
+        cat_ids_ = reinterpret_cast<const std::uint32_t*>(take(4*rows));
+        cents_ = reinterpret_cast<const std::int64_t*>(take(8*rows));
+        key_rows_ = reinterpret_cast<const std::uint32_t*>(take(4*rows));
+        list_end_ = reinterpret_cast<const std::uint64_t*>(take(8*cats_));
+        entries_ = reinterpret_cast<const CategoryDateIndex::Entry*>(take(8*rows));
+        prefix_ = reinterpret_cast<const std::int64_t*>(take(8*(rows + cats_)));
+
+        // Bounds the adopting code relies on.
+        for (std::size_t i=0;i<cats_;++i) {
+            if (name_end_[i] > h[6] || (i && name_end_[i] < name_end_[i-1])) return false;
+            if (list_end_[i] > rows || (i && list_end_[i] < list_end_[i-1])) return false;
+        }
+        if ((cats_ ? list_end_[cats_-1] : 0) != rows) return false;
+        for (std::size_t i=0;i<rows;++i) {
+            if (cat_ids_[i] >= cats_ || key_rows_[i] >= rows) return false;
+            if (entries_[i].row >= rows) return false;
+        }
+        return true;
+    }
+
+    std::size_t categories() const { return cats_; }
+    std::string name(std::size_t id) const {
+        std::size_t b = id ? name_end_[id-1] : 0;
+        return std::string(names_ + b, name_end_[id] - b);
+    }
+    std::uint32_t category(std::size_t row) const { return cat_ids_[row]; }
+    AmountIndex::Key key(std::size_t i) const { return AmountIndex::Key{ cents_[i], key_rows_[i] }; }
+    // Category id's rows ordered by date, with their prefix sums.
+    std::pair<std::size_t, std::size_t> list(std::size_t id) const { return { id ? list_end_[id-1] : 0, list_end_[id] }; }
+    const CategoryDateIndex::Entry* entries() const { return entries_; }
+    const std::int64_t* prefix(std::size_t id) const { return prefix_ + list(id).first + id; }
+
+private:
+    std::unique_ptr<FileView> view_;
+    std::size_t cats_{0};
+    const std::uint64_t *name_end_{nullptr}, *list_end_{nullptr};
+    const char* names_{nullptr};
+    const CategoryDateIndex::Entry* entries_{nullptr};
+    const std::uint32_t *cat_ids_{nullptr}, *key_rows_{nullptr};
+    const std::int64_t *cents_{nullptr}, *prefix_{nullptr};
+};
+
+// ---- Arrow IPC ----
+// Reads and writes the Arrow IPC format so pyarrow, pandas and polars can
+// open a ledger directly (pyarrow.ipc.open_file, pandas.read_feather,
+// polars.read_ipc). The writer emits the file format with one record batch:
+//   date: date32 (the day column, written as is), amount: float64,
+//   category: dictionary<int32, utf8>, description: utf8.
+// Body buffers start on 64-byte file offsets, so a consumer that memory-maps
+// the file uses them in place. The reader accepts the stream or file format
+// with flat columns, and looks columns up by name.
+enum ArrowType : std::uint8_t {
+    kArrowNull = 1, kArrowInt = 2, kArrowFloat = 3, kArrowBinary = 4, kArrowUtf8 = 5,
+    kArrowDate = 8, kArrowLargeBinary = 19, kArrowLargeUtf8 = 20,
+};
+enum ArrowHeader : std::uint8_t { kArrowSchema = 1, kArrowDictionaryBatch = 2, kArrowRecordBatch = 3 };
+constexpr std::uint16_t kArrowV5 = 4;
+constexpr std::size_t kArrowAlign = 64;
+
+// Minimal flatbuffer writer for the Arrow metadata. Objects are laid out
+// front to back: a table is written before the objects it references, and
+// each reference is patched once its target is written, since flatbuffer
+// offsets only point forward.
+class FlatBuilder {
+public:
+    using Child = std::function<std::size_t(FlatBuilder&)>;
+    struct Field { std::uint16_t slot; std::uint8_t size; std::uint64_t value; Child child; };
+    static Field scalar(std::uint16_t slot, std::uint8_t size, std::uint64_t value) { return Field{ slot, size, value, nullptr }; }
+    static Field offset(std::uint16_t slot, Child child) { return Field{ slot, 4, 0, std::move(child) }; }
+
+    static std::string finish(const Child& root) {
+        FlatBuilder b;
+        b.buf_.assign(4, '\0');
+        b.patch_(0, root(b));
+        return std::move(b.buf_);
+    }
+
+    // Writes the table and then its children; returns the table's position.
+    std::size_t table(std::vector<Field> fields) {
+        std::stable_sort(fields.begin(), fields.end(), [](const Field& a, const Field& b){ return a.size > b.size; });
+        std::size_t slots = 0, inline_size = 4;
+        for (const auto& f : fields) { slots = std::max<std::size_t>(slots, f.slot + 1u); inline_size += f.size; }
+        const std::size_t vt = 4 + 2*slots;
+        // The vtable sits right before the table, which starts at 4 mod 8 so
+        // the fields after its 4-byte vtable offset are 8-byte aligned.
+        while ((buf_.size() + vt) % 8 != 4) buf_.push_back('\0');
+        const std::size_t pos = buf_.size() + vt;
+        std::vector<std::size_t> at(slots, 0);
+        std::size_t off = 4;
+        for (const auto& f : fields) { at[f.slot] = off; off += f.size; }
+        put_le(buf_, vt, 2); put_le(buf_, inline_size, 2);
+        for (auto a : at) put_le(buf_, a, 2);
+        put_le(buf_, vt, 4);
+        for (const auto& f : fields) put_le(buf_, f.value, f.size);
+        for (const auto& f : fields) if (f.child) patch_(pos + at[f.slot], f.child(*this));
+        return pos;
+    }
+    std::size_t string(const std::string& s) {
+        while (buf_.size() % 4) buf_.push_back('\0');
+        std::size_t pos = buf_.size();
+        put_le(buf_, s.size(), 4); buf_ += s; buf_.push_back('\0');
+        return pos;
+    }
+    std::size_t tables(const std::vector<Child>& items) {
+        while (buf_.size() % 4) buf_.push_back('\0');
+        std::size_t pos = buf_.size();
+        put_le(buf_, items.size(), 4);
+        buf_.append(4*items.size(), '\0');
+        for (std::size_t i=0;i<items.size();++i) patch_(pos + 4 + 4*i, items[i](*this));
+        return pos;
+    }
+    // A vector of structs made of 8-byte words (all Arrow's structs are).
+    std::size_t structs(const std::vector<std::uint64_t>& words, std::size_t per_struct) {
+        while ((buf_.size() + 4) % 8) buf_.push_back('\0');
+        std::size_t pos = buf_.size();
+        put_le(buf_, words.size() / per_struct, 4);
+        for (auto w : words) put_le(buf_, w, 8);
+        return pos;
+    }
+
+private:
+    std::string buf_;
+    void patch_(std::size_t at, std::size_t target) {
+        auto rel = static_cast<std::uint32_t>(target - at);
+        for (int i=0;i<4;++i) buf_[at+i] = static_cast<char>((rel >> (8*i)) & 0xFF);
+    }
+};
+
+// Bounds-checked view of a flatbuffer table; lookups on a missing or
+// malformed table return defaults.
+class FlatTable {
+public:
+    FlatTable() = default;
+    static FlatTable root(const char* buf, std::size_t size) {
+        FlatTable b(buf, size, 0);
+        return b.in_(0, 4) ? b.follow_(0) : FlatTable{};
+    }
+    bool valid() const { return buf_ != nullptr; }
+    std::uint64_t scalar(std::uint16_t slot, int bytes, std::uint64_t def = 0) const {
+        std::size_t p = field_(slot);
+        return p && in_(p, bytes) ? get_le(buf_+p, bytes) : def;
+    }
+    FlatTable table(std::uint16_t slot) const {
+        std::size_t p = field_(slot);
+        return p && in_(p, 4) ? follow_(p) : FlatTable{};
+    }
+    std::string string(std::uint16_t slot) const {
+        std::size_t first = 0, n = 0;
+        return vector(slot, 1, first, n) ? std::string(buf_+first, n) : std::string();
+    }
+    // Locates a vector field: position of its first element and its length.
+    bool vector(std::uint16_t slot, std::size_t elem, std::size_t& first, std::size_t& count) const {
+        std::size_t p = field_(slot);
+        if (!p || !in_(p, 4)) return false;
+        std::size_t v = p + get_le(buf_+p, 4);
+        if (!in_(v, 4)) return false;
+        count = get_le(buf_+v, 4); first = v + 4;
+        return count <= (size_ - first) / elem;
+    }
+    FlatTable element(std::size_t at) const { return in_(at, 4) ? follow_(at) : FlatTable{}; }
+    std::uint64_t word(std::size_t at) const { return in_(at, 8) ? get_le(buf_+at, 8) : 0; }
+
+private:
+    const char* buf_{nullptr};
+    std::size_t size_{0}, pos_{0}, vt_{0};
+    FlatTable(const char* buf, std::size_t size, std::size_t pos) : buf_(buf), size_(size), pos_(pos) {}
+    bool in_(std::size_t p, std::size_t n) const { return p <= size_ && n <= size_ - p; }
+    FlatTable follow_(std::size_t at) const {
+        std::size_t t = at + get_le(buf_+at, 4);
+        if (!in_(t, 4)) return {};
+        auto vt = static_cast<std::int64_t>(t) - static_cast<std::int32_t>(get_le(buf_+t, 4));
+        if (vt < 0 || !in_(static_cast<std::size_t>(vt), 4)) return {};
+        FlatTable out(buf_, size_, t);
+        out.vt_ = static_cast<std::size_t>(vt);
+        return out;
+    }
+    std::size_t field_(std::uint16_t slot) const {
+        if (!buf_) return 0;
+        std::size_t entry = 4 + 2*std::size_t(slot);
+        if (entry + 2 > get_le(buf_+vt_, 2) || !in_(vt_, entry + 2)) return 0;
+        std::size_t off = get_le(buf_+vt_+entry, 2);
+        return off ? pos_ + off : 0;
+    }
+};
+
+// Column buffers for write_arrow_file. `days` and the description bytes are
+// written straight from the caller's memory.
+struct ArrowColumns {
+    std::size_t rows{0};
+    const std::int32_t* days{nullptr};
+    const double* amounts{nullptr};
+    const std::int32_t* categories{nullptr};     // indices into dictionary
+    const std::vector<std::string>* dictionary{nullptr};
+    const std::int32_t* desc_offsets{nullptr};   // rows+1 entries into desc_data
+    const std::string* desc_data{nullptr};
+};
+
+// Receives the encoded bytes in order.
+using ArrowSink = std::function<void(const void*, std::size_t)>;
+
+// Encodes the columns as an Arrow IPC file. Fails only if a string column
+// outgrows 32-bit offsets.
+inline bool write_arrow(const ArrowColumns& c, const ArrowSink& out) {
+    using FB = FlatBuilder;
+    constexpr std::size_t kMaxOffset = static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max());
+    std::vector<std::int32_t> dict_offsets{0};
+    std::string dict_data;
+    for (const auto& s : *c.dictionary) {
+        dict_data += s;
+        if (dict_data.size() > kMaxOffset) return false;
+        dict_offsets.push_back(static_cast<std::int32_t>(dict_data.size()));
+    }
+    if (c.rows > kMaxOffset) return false;
+
+    std::uint64_t pos = 0;
+    auto write = [&](const void* p, std::size_t n) { if (n) out(p, n); pos += n; };
+    auto pad = [&](std::size_t align) { static const char zeros[kArrowAlign] = {}; write(zeros, (align - pos % align) % align); };
+    auto round_up = [](std::uint64_t n) { return (n + kArrowAlign - 1) / kArrowAlign * kArrowAlign; };
+    auto str = [](std::string s) -> FB::Child { return [s](FB& b) { return b.string(s); }; };
+    auto empty = [](FB& b) { return b.tables({}); };
+
+    // Schema: nullable flags are left false, since the ledger has no nulls.
+    auto field = [&](const char* name, std::uint8_t type, FB::Child type_table, bool dict) -> FB::Child {
+        return [=](FB& b) {
+            std::vector<FB::Field> fs{ FB::offset(0, str(name)), FB::scalar(2, 1, type),
+                                       FB::offset(3, type_table), FB::offset(5, empty) };
+            if (dict) fs.push_back(FB::offset(4, [](FB& d) {
+                return d.table({ FB::scalar(0, 8, 0), FB::offset(1, [](FB& i) {
+                    return i.table({ FB::scalar(0, 4, 32), FB::scalar(1, 1, 1) }); }) });
+            }));
+            return b.table(fs);
+        };
+    };
+    FB::Child schema = [&](FB& b) {
+        return b.table({ FB::offset(1, [&](FB& v) { return v.tables({
+            field("date", kArrowDate, [](FB& t) { return t.table({ FB::scalar(0, 2, 0) }); }, false),
+            field("amount", kArrowFloat, [](FB& t) { return t.table({ FB::scalar(0, 2, 2) }); }, false),
+            field("category", kArrowUtf8, [](FB& t) { return t.table({}); }, true),
+            field("description", kArrowUtf8, [](FB& t) { return t.table({}); }, false) }); }) });
+    };
+
+    // Writes one encapsulated message; metadata is padded so the body starts
+    // on an aligned file offset. Returns its footer Block (offset, metadata
+    // length, body length).
+    struct Buf { const void* p; std::size_t n; };
+    auto message = [&](std::uint8_t header_type, const std::function<FB::Child(const std::vector<std::uint64_t>&, std::uint64_t)>& header,
+                       const std::vector<Buf>& body) {
+        std::vector<std::uint64_t> layout;  // (offset, length) per buffer
+        std::uint64_t body_len = 0;
+        for (const auto& b : body) { layout.push_back(body_len); layout.push_back(b.n); body_len += round_up(b.n); }
+        std::string meta = FB::finish([&](FB& b) {
+            return b.table({ FB::scalar(0, 2, kArrowV5), FB::scalar(1, 1, header_type),
+                             FB::offset(2, header(layout, body_len)), FB::scalar(3, 8, body_len) });
+        });
+        std::uint64_t start = pos;
+        std::uint64_t meta_len = round_up(start + 8 + meta.size()) - start - 8;
+        std::string prefix; put_le(prefix, 0xFFFFFFFFu, 4); put_le(prefix, meta_len, 4);
+        write(prefix.data(), prefix.size()); write(meta.data(), meta.size()); pad(kArrowAlign);
+        for (const auto& b : body) { write(b.p, b.n); pad(kArrowAlign); }
+        return std::vector<std::uint64_t>{ start, 8 + meta_len, body_len };
+    };
+    auto record_batch = [&](std::uint64_t length, std::vector<std::uint64_t> nodes) {
+        return [=](const std::vector<std::uint64_t>& layout, std::uint64_t) -> FB::Child {
+            return [=](FB& b) {
+                return b.table({ FB::scalar(0, 8, length),
+                                 FB::offset(1, [=](FB& v) { return v.structs(nodes, 2); }),
+                                 FB::offset(2, [=](FB& v) { return v.structs(layout, 2); }) });
+            };
+        };
+    };
+
+    write("ARROW1\0\0", 8);
+    message(kArrowSchema, [&](const std::vector<std::uint64_t>&, std::uint64_t) { return schema; }, {});
+    const std::uint64_t k = c.dictionary->size(), n = c.rows;
+    auto dict_batch = record_batch(k, { k, 0 });
+    auto dict_block = message(kArrowDictionaryBatch, [&](const std::vector<std::uint64_t>& layout, std::uint64_t len) -> FB::Child {
+        FB::Child data = dict_batch(layout, len);
+        return [=](FB& b) { return b.table({ FB::scalar(0, 8, 0), FB::offset(1, data) }); };
+    }, { {nullptr, 0}, {dict_offsets.data(), 4*(k+1)}, {dict_data.data(), dict_data.size()} });
+    auto batch_block = message(kArrowRecordBatch, record_batch(n, { n, 0, n, 0, n, 0, n, 0 }), {
+        {nullptr, 0}, {c.days, 4*n},
+        {nullptr, 0}, {c.amounts, 8*n},
+        {nullptr, 0}, {c.categories, 4*n},
+        {nullptr, 0}, {c.desc_offsets, 4*(n+1)}, {c.desc_data->data(), c.desc_data->size()} });
+    std::string eos; put_le(eos, 0xFFFFFFFFu, 4); put_le(eos, 0, 4);
+    write(eos.data(), eos.size());
+
+    std::string footer = FB::finish([&](FB& b) {
+        return b.table({ FB::scalar(0, 2, kArrowV5), FB::offset(1, schema),
+                         FB::offset(2, [&](FB& v) { return v.structs(dict_block, 3); }),
+                         FB::offset(3, [&](FB& v) { return v.structs(batch_block, 3); }) });
+    });
+    std::string tail; put_le(tail, footer.size(), 4); tail += "ARROW1";
+    write(footer.data(), footer.size()); write(tail.data(), tail.size());
+    return true;
+}
+
+// With `digest`, also digests the bytes written.
+inline bool write_arrow_file(const std::string& path, const ArrowColumns& c, StreamDigest* digest = nullptr) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    bool ok = write_arrow(c, [&](const void* p, std::size_t n) {
+        f.write(static_cast<const char*>(p), static_cast<std::streamsize>(n));
+        if (digest) digest->update(p, n);
+    });
+    return ok && static_cast<bool>(f);
+}
+
+// Column-major copy of a list of rows, for ArrowColumns. Categories are
+// dictionary-encoded in first-seen order.
+struct ArrowRows {
+    std::vector<std::int32_t> days;
+    std::vector<double> amounts;
+    std::vector<std::int32_t> categories, desc_offsets;
+    std::vector<std::string> dictionary;
+    std::string desc;
+
+    // `with_days` fills `days`; callers holding a day column pass their own.
+    bool build(const std::vector<Expense>& rows, bool with_days) {
+        const std::size_t n = rows.size();
+        if (with_days) days.resize(n);
+        amounts.resize(n); categories.resize(n); desc_offsets.assign(n+1, 0);
+        std::unordered_map<std::string, std::int32_t> index;
+        for (std::size_t i=0;i<n;++i) {
+            const Expense& e = rows[i];
+            if (with_days) days[i] = static_cast<std::int32_t>(days_from_civil(e.date));
+            amounts[i] = e.amount;
+            auto it = index.emplace(e.category, static_cast<std::int32_t>(dictionary.size()));
+            if (it.second) dictionary.push_back(e.category);
+            categories[i] = it.first->second;
+            desc += e.description;
+            if (desc.size() > static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max())) return false;
+            desc_offsets[i+1] = static_cast<std::int32_t>(desc.size());
+        }
+        return true;
+    }
+    ArrowColumns columns(const std::int32_t* day_column) const {
+        return ArrowColumns{ amounts.size(), day_column, amounts.data(), categories.data(), &dictionary, desc_offsets.data(), &desc };
+    }
+};
+
+namespace arrow_detail {
+
+struct FieldInfo {
+    std::string name;
+    std::uint8_t type{0};
+    std::uint64_t param{0};           // Date unit, FloatingPoint precision or Int bit width
+    bool is_signed{true};
+    std::int64_t dict_id{-1};
+    std::uint64_t index_bits{32};
+    bool index_signed{true};
+    std::size_t buffer{0};            // index of its validity buffer in a batch
+};
+
+// One record batch's buffers, bounds-checked against its message body.
+struct Batch {
+    std::uint64_t length{0};
+    std::vector<std::pair<const char*, std::uint64_t>> buffers;
+    bool parse(const FlatTable& rb, const char* body, std::uint64_t body_len, std::string& err) {
+        length = rb.scalar(0, 8);
+        if (rb.table(3).valid()) { err = "compressed Arrow buffers are not supported"; return false; }
+        std::size_t first = 0, count = 0;
+        if (!rb.vector(2, 16, first, count)) { err = "record batch has no buffers"; return false; }
+        for (std::size_t i=0;i<count;++i) {
+            std::uint64_t off = rb.word(first + 16*i), len = rb.word(first + 16*i + 8);
+            if (off > body_len || len > body_len - off) { err = "buffer outside message body"; return false; }
+            buffers.emplace_back(body + off, len);
+        }
+        return true;
+    }
+};
+
+inline std::int64_t int_at(const char* p, std::uint64_t bytes, bool is_signed) {
+    std::uint64_t v = get_le(p, static_cast<int>(bytes));
+    if (is_signed && bytes < 8 && ((v >> (8*bytes - 1)) & 1)) v |= ~std::uint64_t{0} << (8*bytes);
+    return static_cast<std::int64_t>(v);
+}
+
+// Typed access to one flat column of a batch.
+class Column {
+public:
+    bool bind(const FieldInfo& f, const Batch& b, const std::map<std::int64_t, std::vector<std::string>>& dicts, std::string& err) {
+        f_ = &f; n_ = b.length;
+        std::size_t want = f.dict_id >= 0 ? 2 : (f.type == kArrowUtf8 || f.type == kArrowLargeUtf8
+                                               || f.type == kArrowBinary || f.type == kArrowLargeBinary) ? 3 : 2;
+        if (f.buffer + want > b.buffers.size()) { err = "missing buffers for column " + f.name; return false; }
+        std::tie(valid_, valid_len_) = b.buffers[f.buffer];
+        if (valid_len_ == 0) valid_ = nullptr;
+        else if (valid_len_ < (n_ + 7) / 8) { err = "short validity bitmap for column " + f.name; return false; }
+        std::tie(values_, values_len_) = b.buffers[f.buffer + 1];
+        if (want == 3) std::tie(data_, data_len_) = b.buffers[f.buffer + 2];
+        if (f.dict_id >= 0) {
+            auto it = dicts.find(f.dict_id);
+            if (it == dicts.end()) { err = "missing dictionary for column " + f.name; return false; }
+            dict_ = &it->second; width_ = f.index_bits / 8;
+        } else {
+            switch (f.type) {
+                case kArrowDate: width_ = f.param == 0 ? 4 : 8; break;
+                case kArrowFloat: width_ = f.param == 2 ? 8 : f.param == 1 ? 4 : 0; break;
+                case kArrowInt: width_ = f.param / 8; break;
+                case kArrowUtf8: case kArrowBinary: width_ = 4; break;
+                case kArrowLargeUtf8: case kArrowLargeBinary: width_ = 8; break;
+                default: width_ = 0;
+            }
+        }
+        if (width_ == 0 || width_ > 8) { err = "unsupported type for column " + f.name; return false; }
+        if (values_len_ / width_ < n_ + (want == 3 ? 1 : 0)) { err = "short buffer for column " + f.name; return false; }
+        return true;
+    }
+    bool null(std::uint64_t i) const { return valid_ && !((static_cast<unsigned char>(valid_[i >> 3]) >> (i & 7)) & 1); }
+    std::int64_t integer(std::uint64_t i) const { return int_at(values_ + width_*i, width_, f_->is_signed); }
+    double real(std::uint64_t i) const {
+        if (f_->type == kArrowInt) return static_cast<double>(integer(i));
+        if (width_ == 4) { float v; std::memcpy(&v, values_ + 4*i, 4); return v; }
+        double v; std::memcpy(&v, values_ + 8*i, 8); return v;
+    }
+    std::int64_t day(std::uint64_t i) const {
+        std::int64_t v = int_at(values_ + width_*i, width_, true);
+        if (f_->param == 0) return v;
+        return v / 86400000 - (v % 86400000 < 0 ? 1 : 0);  // date64: milliseconds
+    }
+    bool text(std::uint64_t i, std::string& out) const {
+        if (null(i)) { out.clear(); return true; }
+        if (dict_) {
+            std::int64_t k = int_at(values_ + width_*i, width_, f_->index_signed);
+            if (k < 0 || static_cast<std::uint64_t>(k) >= dict_->size()) return false;
+            out = (*dict_)[static_cast<std::size_t>(k)];
+            return true;
+        }
+        std::int64_t b = int_at(values_ + width_*i, width_, true), e = int_at(values_ + width_*(i+1), width_, true);
+        if (b < 0 || e < b || static_cast<std::uint64_t>(e) > data_len_) return false;
+        out.assign(data_ + b, static_cast<std::size_t>(e - b));
+        return true;
+    }
+    bool is_text() const { return dict_ || f_->type == kArrowUtf8 || f_->type == kArrowLargeUtf8; }
+
+private:
+    const FieldInfo* f_{nullptr};
+    const std::vector<std::string>* dict_{nullptr};
+    std::uint64_t n_{0}, width_{0}, valid_len_{0}, values_len_{0}, data_len_{0};
+    const char *valid_{nullptr}, *values_{nullptr}, *data_{nullptr};
+};
+
+} // namespace arrow_detail
+
+// Reads the rows of an Arrow IPC stream or file with columns date, amount,
+// category and description (any order, other flat columns ignored). Rows
+// with a null or invalid date or amount are skipped, like malformed CSV
+// lines; null strings read as empty. With `digest`, also digests the file.
+inline bool read_arrow_file(const std::string& path, std::vector<Expense>& rows, std::string& err,
+                            StreamDigest* digest = nullptr) {
+    using namespace arrow_detail;
+    if (!std::ifstream(path, std::ios::binary)) { err = "cannot open " + path; return false; }
+    // Mapped, not read: column values are copied once, straight into rows.
+    FileView view(path);
+    const char* data = view.data();
+    const std::size_t size = view.size();
+    if (digest && size) digest->update(data, size);
+    std::size_t pos = size >= 6 && std::memcmp(data, "ARROW1", 6) == 0 ? 8 : 0;
+
+    std::vector<FieldInfo> fields;
+    std::map<std::int64_t, std::vector<std::string>> dicts;
+    int col[4] = { -1, -1, -1, -1 };
+    static const char* const kNames[4] = { "date", "amount", "category", "description" };
+    while (true) {
+        if (pos + 4 > size) { err = "truncated Arrow stream"; return false; }
+        std::uint64_t len = get_le(data + pos, 4); pos += 4;
+        if (len == 0xFFFFFFFFu) {
+            if (pos + 4 > size) { err = "truncated Arrow stream"; return false; }
+            len = get_le(data + pos, 4); pos += 4;
+        }
+        if (len == 0) break;
+        if (len > size - pos) { err = "truncated Arrow message"; return false; }
+        FlatTable msg = FlatTable::root(data + pos, len);
+        pos += len;
+        std::uint64_t body_len = msg.scalar(3, 8);
+        if (!msg.valid() || body_len > size - pos) { err = "malformed Arrow message"; return false; }
+        const char* body = data + pos;
+        pos += body_len;
+        FlatTable header = msg.table(2);
+
+        switch (msg.scalar(1, 1)) {
+        case kArrowSchema: {
+            std::size_t first = 0, count = 0, buffer = 0;
+            if (!header.vector(1, 4, first, count)) { err = "schema has no fields"; return false; }
+            fields.clear();
+            for (std::size_t i=0;i<count;++i) {
+                FlatTable fb = header.element(first + 4*i);
+                FieldInfo fi;
+                fi.name = fb.string(0);
+                fi.type = static_cast<std::uint8_t>(fb.scalar(2, 1));
+                FlatTable type = fb.table(3);
+                if (fi.type == kArrowDate) fi.param = type.scalar(0, 2, 1);
+                else if (fi.type == kArrowFloat) fi.param = type.scalar(0, 2, 0);
+                else if (fi.type == kArrowInt) { fi.param = type.scalar(0, 4); fi.is_signed = type.scalar(1, 1) != 0; }
+                FlatTable dict = fb.table(4);
+                if (dict.valid()) {
+                    fi.dict_id = static_cast<std::int64_t>(dict.scalar(0, 8));
+                    FlatTable index = dict.table(1);
+                    if (index.valid()) { fi.index_bits = index.scalar(0, 4); fi.index_signed = index.scalar(1, 1) != 0; }
+                }
+                std::size_t cf = 0, children = 0;
+                if (fb.vector(5, 4, cf, children) && children > 0) { err = "nested column " + fi.name + " is not supported"; return false; }
+                fi.buffer = buffer;
+                bool var = fi.dict_id < 0 && (fi.type == kArrowUtf8 || fi.type == kArrowLargeUtf8
+                                             || fi.type == kArrowBinary || fi.type == kArrowLargeBinary);
+                buffer += fi.type == kArrowNull && fi.dict_id < 0 ? 0 : var ? 3 : 2;
+                for (int k=0;k<4;++k) if (iequals(fi.name, kNames[k])) col[k] = static_cast<int>(fields.size());
+                fields.push_back(std::move(fi));
+            }
+            for (int k=0;k<4;++k) if (col[k] < 0) { err = std::string("missing column ") + kNames[k]; return false; }
+            break;
+        }
+        case kArrowDictionaryBatch: {
+            auto id = static_cast<std::int64_t>(header.scalar(0, 8));
+            const FieldInfo* owner = nullptr;
+            for (const auto& fi : fields) if (fi.dict_id == id) owner = &fi;
+            if (!owner) break;  // dictionary of a column we do not read
+            FieldInfo value = *owner; value.dict_id = -1; value.buffer = 0;
+            Batch b; Column c;
+            if (!b.parse(header.table(1), body, body_len, err) || !c.bind(value, b, dicts, err)) return false;
+            if (!c.is_text()) { err = "dictionary for column " + owner->name + " is not text"; return false; }
+            auto& d = dicts[id];
+            if (header.scalar(2, 1) == 0) d.clear();  // not a delta
+            std::string s;
+            for (std::uint64_t i=0;i<b.length;++i) {
+                if (!c.text(i, s)) { err = "malformed dictionary for column " + owner->name; return false; }
+                d.push_back(s);
+            }
+            break;
+        }
+        case kArrowRecordBatch: {
+            if (fields.empty()) { err = "record batch before schema"; return false; }
+            Batch b; Column c[4];
+            if (!b.parse(header, body, body_len, err)) return false;
+            for (int k=0;k<4;++k) if (!c[k].bind(fields[col[k]], b, dicts, err)) return false;
+            if (fields[col[0]].type != kArrowDate || fields[col[0]].dict_id >= 0) { err = "column date must be date32 or date64"; return false; }
+            if (c[1].is_text()) { err = "column amount must be numeric"; return false; }
+            if (!c[2].is_text() || !c[3].is_text()) { err = "columns category and description must be strings"; return false; }
+            rows.reserve(rows.size() + b.length);
+            for (std::uint64_t i=0;i<b.length;++i) {
+                if (c[0].null(i) || c[1].null(i)) continue;
+                Expense e{ civil_from_days(c[0].day(i)), c[1].real(i), {}, {} };
+                if (!valid_date(e.date) || !std::isfinite(e.amount)) continue;
+                if (!c[2].text(i, e.category) || !c[3].text(i, e.description)) { err = "malformed string column"; return false; }
+                rows.push_back(std::move(e));
+            }
+            break;
+        }
+        default: break;
+        }
+    }
+    return true;
+}
+
+// ---- Parquet ----
+// Writes the ledger as a Parquet file with one row group per calendar month,
+// rows sorted by date within each group. All columns are required:
+//   date: INT32 (DATE), DELTA_BINARY_PACKED
+//   amount: DOUBLE, PLAIN
+//   category: BYTE_ARRAY (UTF8), dictionary page + RLE_DICTIONARY indices
+//   description: BYTE_ARRAY (UTF8), PLAIN
+// Each column chunk is a single uncompressed page. Chunks carry min/max
+// statistics under a type-defined column order, so engines can skip row
+// groups by date, amount or category. Row groups are encoded in parallel and
+// written in month order.
+inline void put_varint(std::string& out, std::uint64_t v) {
+    while (v >= 0x80) { out.push_back(static_cast<char>((v & 0x7F) | 0x80)); v >>= 7; }
+    out.push_back(static_cast<char>(v));
+}
+inline void put_zigzag(std::string& out, std::int64_t v) {
+    put_varint(out, (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+}
+inline unsigned bit_width(std::uint64_t v) {
+    unsigned w = 0;
+    while (v) { ++w; v >>= 1; }
+    return w;
+}
+// Packs values LSB first, `width` (at most 32) bits each.
+inline void bitpack(std::string& out, const std::uint64_t* v, std::size_t n, unsigned width) {
+    std::uint64_t acc = 0; unsigned bits = 0;
+    for (std::size_t i=0;i<n;++i) {
+        acc |= v[i] << bits; bits += width;
+        while (bits >= 8) { out.push_back(static_cast<char>(acc & 0xFF)); acc >>= 8; bits -= 8; }
+    }
+    if (bits) out.push_back(static_cast<char>(acc & 0xFF));
+}
+
+// Thrift compact protocol writer, covering what Parquet metadata needs.
+// Structs nest with begin_struct/end_struct; a list of structs is list()
+// followed by begin_element()/end_struct() per element.
+class ThriftWriter {
+public:
+    enum Type : std::uint8_t { kTrue = 1, kFalse = 2, kI32 = 5, kI64 = 6, kBinary = 8, kList = 9, kStruct = 12 };
+    void i32(std::int16_t id, std::int64_t v) { field_(id, kI32); put_zigzag(out_, v); }
+    void i64(std::int16_t id, std::int64_t v) { field_(id, kI64); put_zigzag(out_, v); }
+    void binary(std::int16_t id, const std::string& s) { field_(id, kBinary); value(s); }
+    void boolean(std::int16_t id, bool v) { field_(id, v ? kTrue : kFalse); }
+    void begin_struct(std::int16_t id) { field_(id, kStruct); last_.push_back(0); }
+    void begin_element() { last_.push_back(0); }
+    void end_struct() { out_.push_back('\0'); last_.pop_back(); }
+    void list(std::int16_t id, Type elem, std::size_t n) {
+        field_(id, kList);
+        if (n < 15) out_.push_back(static_cast<char>(n << 4 | elem));
+        else { out_.push_back(static_cast<char>(0xF0 | elem)); put_varint(out_, n); }
+    }
+    void value(std::int64_t v) { put_zigzag(out_, v); }
+    void value(const std::string& s) { put_varint(out_, s.size()); out_ += s; }
+    // Closes the top-level struct and returns the encoding.
+    std::string finish() { out_.push_back('\0'); return std::move(out_); }
+
+private:
+    std::string out_;
+    std::vector<std::int16_t> last_{0};
+    void field_(std::int16_t id, std::uint8_t type) {
+        int delta = id - last_.back();
+        if (delta > 0 && delta <= 15) out_.push_back(static_cast<char>(delta << 4 | type));
+        else { out_.push_back(static_cast<char>(type)); put_zigzag(out_, id); }
+        last_.back() = id;
+    }
+};
+
+namespace parquet_detail {
+
+enum PhysicalType { kInt32 = 1, kDouble = 5, kByteArray = 6 };
+enum Encoding { kPlain = 0, kDeltaBinaryPacked = 5, kRleDictionary = 8 };
+enum PageType { kDataPage = 0, kDictionaryPage = 2 };
+constexpr std::size_t kMaxStat = 4096;   // longer string bounds are left out
+
+struct Chunk {
+    std::string bytes;         // optional dictionary page, then the data page
+    std::size_t dict_bytes{0};
+    std::string min, max;
+    bool stats{false};
+};
+struct Group {
+    std::uint64_t rows{0};
+    Chunk cols[4];
+    bool ok{true};
+};
+
+inline void page(Chunk& c, PageType type, std::size_t values, Encoding enc, const std::string& body, bool& ok) {
+    if (body.size() > static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max())) { ok = false; return; }
+    ThriftWriter h;
+    h.i32(1, type);
+    h.i32(2, static_cast<std::int64_t>(body.size()));
+    h.i32(3, static_cast<std::int64_t>(body.size()));
+    if (type == kDictionaryPage) {
+        h.begin_struct(7); h.i32(1, static_cast<std::int64_t>(values)); h.i32(2, kPlain); h.end_struct();
+    } else {
+        // Levels are RLE-encoded, though required columns have none.
+        h.begin_struct(5); h.i32(1, static_cast<std::int64_t>(values)); h.i32(2, enc); h.i32(3, 3); h.i32(4, 3); h.end_struct();
+    }
+    c.bytes += h.finish();
+    c.bytes += body;
+}
+inline void plain_string(std::string& out, const std::string& s) { put_le(out, s.size(), 4); out += s; }
+inline std::string le_bytes(std::uint64_t v, int bytes) { std::string s; put_le(s, v, bytes); return s; }
+
+// DELTA_BINARY_PACKED: blocks of 128 deltas in 4 miniblocks of 32.
+inline void delta_encode(std::string& out, const std::vector<std::int32_t>& v) {
+    constexpr std::size_t kBlock = 128, kMinis = 4, kPer = kBlock / kMinis;
+    put_varint(out, kBlock); put_varint(out, kMinis); put_varint(out, v.size());
+    put_zigzag(out, v.empty() ? 0 : v[0]);
+    for (std::size_t b = 1; b < v.size(); b += kBlock) {
+        const std::size_t n = std::min(kBlock, v.size() - b);
+        std::int64_t delta[kBlock], lo = std::numeric_limits<std::int64_t>::max();
+        for (std::size_t i=0;i<n;++i) { delta[i] = std::int64_t(v[b+i]) - v[b+i-1]; lo = std::min(lo, delta[i]); }
+        std::uint64_t rel[kBlock] = {};
+        for (std::size_t i=0;i<n;++i) rel[i] = static_cast<std::uint64_t>(delta[i] - lo);
+        put_zigzag(out, lo);
+        const std::size_t minis = (n + kPer - 1) / kPer;
+        unsigned width[kMinis] = {};
+        for (std::size_t m=0;m<minis;++m)
+            for (std::size_t i=m*kPer;i<std::min(n, (m+1)*kPer);++i) width[m] = std::max(width[m], bit_width(rel[i]));
+        for (auto w : width) out.push_back(static_cast<char>(w));
+        for (std::size_t m=0;m<minis;++m) bitpack(out, rel + m*kPer, kPer, width[m]);
+    }
+}
+
+// RLE/bit-packed hybrid for dictionary indices: runs of 8 or more become
+// RLE runs, everything else is bit-packed in groups of 8.
+inline void rle_hybrid(std::string& out, const std::vector<std::uint64_t>& v, unsigned width) {
+    std::vector<std::uint64_t> lit;
+    auto flush = [&] {
+        if (lit.empty()) return;
+        std::size_t groups = (lit.size() + 7) / 8;
+        lit.resize(groups * 8, 0);
+        put_varint(out, groups << 1 | 1);
+        bitpack(out, lit.data(), lit.size(), width);
+        lit.clear();
+    };
+    for (std::size_t i = 0; i < v.size(); ) {
+        std::size_t run = 1;
+        while (i + run < v.size() && v[i+run] == v[i]) ++run;
+        // Literal groups must hold exactly 8 values, so top them up from the run first.
+        std::size_t top = (8 - lit.size() % 8) % 8;
+        if (run >= 8 + top) {
+            lit.insert(lit.end(), top, v[i]);
+            flush();
+            put_varint(out, (run - top) << 1);
+            put_le(out, v[i], static_cast<int>((width + 7) / 8));
+        } else {
+            lit.insert(lit.end(), run, v[i]);
+        }
+        i += run;
+    }
+    flush();
+}
+
+inline Group encode_group(const std::vector<Expense>& rows, const std::vector<std::int32_t>& days,
+                          const std::vector<std::uint32_t>& ids) {
+    Group g; g.rows = ids.size();
+    const std::size_t n = ids.size();
+    {   // date
+        std::vector<std::int32_t> v(n);
+        for (std::size_t i=0;i<n;++i) v[i] = days[ids[i]];
+        std::string body; delta_encode(body, v);
+        Chunk& c = g.cols[0];
+        page(c, kDataPage, n, kDeltaBinaryPacked, body, g.ok);
+        auto mm = std::minmax_element(v.begin(), v.end());
+        if (n) { c.min = le_bytes(static_cast<std::uint32_t>(*mm.first), 4); c.max = le_bytes(static_cast<std::uint32_t>(*mm.second), 4); c.stats = true; }
+    }
+    {   // amount
+        std::string body;
+        double lo = std::numeric_limits<double>::infinity(), hi = -lo;
+        for (auto id : ids) {
+            double a = rows[id].amount; std::uint64_t bits; std::memcpy(&bits, &a, 8);
+            put_le(body, bits, 8);
+            lo = std::min(lo, a); hi = std::max(hi, a);
+        }
+        Chunk& c = g.cols[1];
+        page(c, kDataPage, n, kPlain, body, g.ok);
+        std::uint64_t bl, bh; std::memcpy(&bl, &lo, 8); std::memcpy(&bh, &hi, 8);
+        if (n) { c.min = le_bytes(bl, 8); c.max = le_bytes(bh, 8); c.stats = true; }
+    }
+    {   // category
+        std::unordered_map<std::string, std::uint64_t> index;
+        std::vector<const std::string*> dict;
+        std::vector<std::uint64_t> idx(n);
+        for (std::size_t i=0;i<n;++i) {
+            const std::string& cat = rows[ids[i]].category;
+            auto it = index.emplace(cat, dict.size());
+            if (it.second) dict.push_back(&cat);
+            idx[i] = it.first->second;
+        }
+        Chunk& c = g.cols[2];
+        std::string dict_body;
+        for (const auto* s : dict) plain_string(dict_body, *s);
+        page(c, kDictionaryPage, dict.size(), kPlain, dict_body, g.ok);
+        c.dict_bytes = c.bytes.size();
+        unsigned width = std::max(1u, bit_width(dict.empty() ? 0 : dict.size() - 1));
+        std::string body(1, static_cast<char>(width));
+        rle_hybrid(body, idx, width);
+        page(c, kDataPage, n, kRleDictionary, body, g.ok);
+        if (!dict.empty()) {
+            auto mm = std::minmax_element(dict.begin(), dict.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+            c.min = **mm.first; c.max = **mm.second;
+            c.stats = c.min.size() <= kMaxStat && c.max.size() <= kMaxStat;
+        }
+    }
+    {   // description
+        std::string body;
+        const std::string *lo = nullptr, *hi = nullptr;
+        for (auto id : ids) {
+            const std::string& d = rows[id].description;
+            plain_string(body, d);
+            if (!lo || d < *lo) lo = &d;
+            if (!hi || *hi < d) hi = &d;
+        }
+        Chunk& c = g.cols[3];
+        page(c, kDataPage, n, kPlain, body, g.ok);
+        if (lo && lo->size() <= kMaxStat && hi->size() <= kMaxStat) { c.min = *lo; c.max = *hi; c.stats = true; }
+    }
+    return g;
+}
+
+} // namespace parquet_detail
+
+inline bool write_parquet_file(const std::string& path, const std::vector<Expense>& rows, const std::vector<std::int32_t>& days) {
+    using namespace parquet_detail;
+    struct Column { const char* name; PhysicalType type; std::vector<std::int64_t> encodings; };
+    static const Column kColumns[4] = {
+        { "date", kInt32, { kDeltaBinaryPacked } },
+        { "amount", kDouble, { kPlain } },
+        { "category", kByteArray, { kPlain, kRleDictionary } },
+        { "description", kByteArray, { kPlain } },
+    };
+
+    std::map<std::int32_t, std::vector<std::uint32_t>> months;
+    for (std::size_t i=0;i<rows.size();++i) months[rows[i].date.y*12 + rows[i].date.m-1].push_back(static_cast<std::uint32_t>(i));
+    std::vector<std::vector<std::uint32_t>*> groups;
+    for (auto& kv : months) {
+        std::stable_sort(kv.second.begin(), kv.second.end(), [&](std::uint32_t a, std::uint32_t b) { return days[a] < days[b]; });
+        groups.push_back(&kv.second);
+    }
+
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    f.write("PAR1", 4);
+    std::uint64_t pos = 4;
+
+    ThriftWriter meta;
+    meta.i32(1, 2);
+    meta.list(2, ThriftWriter::kStruct, 5);
+    meta.begin_element(); meta.binary(4, "schema"); meta.i32(5, 4); meta.end_struct();
+    for (const auto& col : kColumns) {
+        meta.begin_element();
+        meta.i32(1, col.type);
+        meta.i32(3, 0);  // REQUIRED
+        meta.binary(4, col.name);
+        if (col.type == kInt32) {
+            meta.i32(6, 6);  // DATE
+            meta.begin_struct(10); meta.begin_struct(6); meta.end_struct(); meta.end_struct();
+        } else if (col.type == kByteArray) {
+            meta.i32(6, 0);  // UTF8
+            meta.begin_struct(10); meta.begin_struct(1); meta.end_struct(); meta.end_struct();
+        }
+        meta.end_struct();
+    }
+    meta.i64(3, static_cast<std::int64_t>(rows.size()));
+    meta.list(4, ThriftWriter::kStruct, groups.size());
+
+    const std::size_t window = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t base = 0; base < groups.size(); base += window) {
+        const std::size_t n = std::min(window, groups.size() - base);
+        std::vector<Group> enc(n);
+        std::vector<std::thread> pool;
+        for (std::size_t i=1;i<n;++i) pool.emplace_back([&, i] { enc[i] = encode_group(rows, days, *groups[base+i]); });
+        enc[0] = encode_group(rows, days, *groups[base]);
+        for (auto& t : pool) t.join();
+
+        for (const Group& g : enc) {
+            if (!g.ok) return false;
+            std::uint64_t group_bytes = 0;
+            meta.begin_element();
+            meta.list(1, ThriftWriter::kStruct, 4);
+            for (int k=0;k<4;++k) {
+                const Chunk& c = g.cols[k];
+                const std::uint64_t start = pos;
+                f.write(c.bytes.data(), static_cast<std::streamsize>(c.bytes.size()));
+                pos += c.bytes.size();
+                group_bytes += c.bytes.size();
+                meta.begin_element();
+                meta.i64(2, static_cast<std::int64_t>(start));
+                meta.begin_struct(3);
+                meta.i32(1, kColumns[k].type);
+                meta.list(2, ThriftWriter::kI32, kColumns[k].encodings.size());
+                for (auto e : kColumns[k].encodings) meta.value(e);
+                meta.list(3, ThriftWriter::kBinary, 1); meta.value(std::string(kColumns[k].name));
+                meta.i32(4, 0);  // UNCOMPRESSED
+                meta.i64(5, static_cast<std::int64_t>(g.rows));
+                meta.i64(6, static_cast<std::int64_t>(c.bytes.size()));
+                meta.i64(7, static_cast<std::int64_t>(c.bytes.size()));
+                meta.i64(9, static_cast<std::int64_t>(start + c.dict_bytes));
+                if (c.dict_bytes) meta.i64(11, static_cast<std::int64_t>(start));
+                if (c.stats) {
+                    meta.begin_struct(12);
+                    meta.i64(3, 0);
+                    meta.binary(5, c.max); meta.binary(6, c.min);
+                    meta.end_struct();
+                }
+                meta.end_struct();
+                meta.end_struct();
+            }
+            meta.i64(2, static_cast<std::int64_t>(group_bytes));
+            meta.i64(3, static_cast<std::int64_t>(g.rows));
+            meta.list(4, ThriftWriter::kStruct, 1);  // sorted by date
+            meta.begin_element(); meta.i32(1, 0); meta.boolean(2, false); meta.boolean(3, false); meta.end_struct();
+            meta.end_struct();
+        }
+    }
+    meta.binary(6, "expense_tracker");
+    meta.list(7, ThriftWriter::kStruct, 4);
+    for (int k=0;k<4;++k) { meta.begin_element(); meta.begin_struct(1); meta.end_struct(); meta.end_struct(); }
+    std::string footer = meta.finish();
+    put_le(footer, footer.size(), 4);
+    footer += "PAR1";
+    f.write(footer.data(), static_cast<std::streamsize>(footer.size()));
+    return static_cast<bool>(f);
+}
+
+class ExpenseManager {
+public:
+    ExpenseManager() = default;
+    ExpenseManager(const ExpenseManager&) = delete;
+    ExpenseManager& operator=(const ExpenseManager&) = delete;
+    ~ExpenseManager() { wait_index_writer_(); }
+
+    void add(Expense e) {
+        categorize_(e);
+        insert_row_(std::move(e));
+        Op op; op.kind = Op::Kind::Add; op.row = expenses_.size()-1;
+        push_undo_(std::move(op));
+    }
+    // Appends rows as one undoable bulk import.
+    void add_batch(std::vector<Expense> rows) {
+        Op op; op.kind = Op::Kind::Import; op.row = expenses_.size(); op.count = rows.size();
+        // Grow geometrically: an exact reserve would reallocate the whole
+        // ledger on every small batch.
+        const std::size_t need = expenses_.size() + rows.size();
+        if (expenses_.capacity() < need) expenses_.reserve(std::max(need, 2 * expenses_.capacity()));
+        for (auto& e : rows) {
+            categorize_(e);
+            insert_row_(std::move(e));
+        }
+        push_undo_(std::move(op));
+    }
+    bool edit(std::size_t idx, const Expense& e) {
+        if (idx >= expenses_.size()) return false;
+        Op op; op.kind = Op::Kind::Edit; op.row = idx; op.before = expenses_[idx]; op.after = e;
+        set_row_(idx, e);
+        push_undo_(std::move(op));
+        return true;
+    }
+    // O(1): the last row is moved into the freed slot, so it takes over idx.
+    bool remove(std::size_t idx) {
+        if (idx >= expenses_.size()) return false;
+        Op op; op.kind = Op::Kind::Remove; op.row = idx; op.before = erase_row_(idx);
+        push_undo_(std::move(op));
+        return true;
+    }
+
+    // Sets the category of the given rows as one undoable operation and one
+    // journal frame. Only the category column and the category/date lists of
+    // the affected categories change. Returns the number of rows updated.
+    std::size_t set_category(const std::vector<std::uint32_t>& rows, const std::string& cat) {
+        Op op; op.kind = Op::Kind::Recategorize; op.after.category = cat;
+        op.ids.reserve(rows.size()); op.cats.reserve(rows.size());
+        auto id = cats_.intern(cat);
+        for (auto r : rows) {
+            if (r >= expenses_.size() || cat_ids_[r] == id) continue;
+            op.ids.push_back(r); op.cats.push_back(expenses_[r].category);
+            set_category_(r, cat, id);
+        }
+        std::size_t n = op.ids.size();
+        if (n) push_undo_(std::move(op));
+        return n;
+    }
+
+    // Deletes every row dated within [from, to] in one compaction pass, then
+    // rebuilds the indexes once. The merchant sketches of months the range
+    // covers are dropped whole; deleted rows of the months at either end are
+    // retracted from theirs. Journaled as a single record. Purges are not undoable and clear
+    // the undo/redo log, whose entries refer to row positions. Returns the
+    // number of rows deleted.
+    std::size_t remove_date_range(const Date& from, const Date& to) {
+        std::size_t n = remove_range_(from, to);
+        clear_history_();
+        journal_.commit();
+        return n;
+    }
+    // Retention: deletes rows more than `years` years older than `now`.
+    std::size_t apply_retention(int years, const Date& now) {
+        int y = now.y - years;
+        Date cutoff{ y, now.m, std::min(now.d, days_in_month(y, now.m)) };
+        return remove_date_range(Date{1, 1, 1}, civil_from_days(days_from_civil(cutoff) - 1));
+    }
+
+    // The undo log keeps at most kMaxUndo ops and, beyond the newest one, at
+    // most this many bytes; a Load op holds a whole ledger.
+    void set_undo_limit(std::size_t bytes) { undo_limit_ = bytes; trim_undo_(); }
+    bool can_undo() const { return !undo_.empty(); }
+    bool can_redo() const { return !redo_.empty(); }
+    bool undo() {
+        if (undo_.empty()) return false;
+        Op op = std::move(undo_.back()); undo_.pop_back();
+        undo_bytes_ -= op.bytes;
+        switch (op.kind) {
+            case Op::Kind::Add:    op.after = erase_row_(op.row); break;
+            case Op::Kind::Edit:   set_row_(op.row, op.before); break;
+            case Op::Kind::Remove: restore_row_(op.row, std::move(op.before)); break;
+            case Op::Kind::Import:
+                truncate_(op.row, &op.rows);
+                break;
+            case Op::Kind::Load:
+                if (op.recurring) swap_recurring_(*op.recurring);
+                swap_ledger_(op.rows);
+                break;
+            case Op::Kind::Recategorize:
+                for (std::size_t i=0;i<op.ids.size();++i) set_category_(op.ids[i], op.cats[i], cats_.intern(op.cats[i]));
+                break;
+            case Op::Kind::Override:
+                op.after = erase_row_(op.row);
+                if (op.occurrence) unskip_(op.rule, *op.occurrence);
+                break;
+        }
+        redo_.push_back(std::move(op));
+        journal_.commit();
+        return true;
+    }
+    bool redo() {
+        if (redo_.empty()) return false;
+        Op op = std::move(redo_.back()); redo_.pop_back();
+        switch (op.kind) {
+            case Op::Kind::Add:    insert_row_(std::move(op.after), false); break;
+            case Op::Kind::Edit:   set_row_(op.row, op.after); break;
+            case Op::Kind::Remove: op.before = erase_row_(op.row); break;
+            case Op::Kind::Import:
+                for (auto& e : op.rows) insert_row_(std::move(e), false);
+                op.rows.clear(); op.rows.shrink_to_fit();
+                break;
+            case Op::Kind::Load:
+                if (op.recurring) swap_recurring_(*op.recurring);
+                swap_ledger_(op.rows);
+                break;
+            case Op::Kind::Recategorize: {
+                auto id = cats_.intern(op.after.category);
+                for (auto r : op.ids) set_category_(r, op.after.category, id);
+                break;
+            }
+            case Op::Kind::Override:
+                if (op.occurrence) skip_(op.rule, *op.occurrence);
+                insert_row_(std::move(op.after), false);
+                break;
+        }
+        keep_undo_(std::move(op));
+        journal_.commit();
+        return true;
+    }
+
+    // Starts streaming mutations to a change journal. The current ledger is
+    // written first as a Reset snapshot so a reader starting at offset 0 can
+    // rebuild it.
+    bool attach_journal(const std::string& path) {
+        if (!journal_.open(path)) return false;
+        journal_snapshot_();
+        journal_.commit();
+        return true;
+    }
+    const ChangeJournal& journal() const { return journal_; }
+
+    // Applies one record from another manager's journal. Used by followers;
+    // bypasses the undo log. Returns false if the record does not fit the
+    // current ledger (the follower has diverged).
+    bool apply_change(const Change& c) {
+        switch (c.kind) {
+            case ChangeKind::Add: case ChangeKind::Restore:
+                if (c.row != expenses_.size()) return false;
+                insert_row_(c.e, c.kind == ChangeKind::Add); break;
+            case ChangeKind::Edit:
+                if (c.row >= expenses_.size()) return false;
+                set_row_(c.row, c.e); break;
+            case ChangeKind::Remove:
+                if (c.row >= expenses_.size()) return false;
+                erase_row_(c.row); break;
+            case ChangeKind::Truncate:
+                if (c.row > expenses_.size()) return false;
+                truncate_(c.row); break;
+            case ChangeKind::SetCategory:
+                if (c.row >= expenses_.size()) return false;
+                set_category_(c.row, c.e.category, cats_.intern(c.e.category)); break;
+            case ChangeKind::DeleteRange:
+                remove_range_(c.e.date, unpack_date(static_cast<std::int32_t>(c.row))); break;
+            case ChangeKind::Reset: {
+                std::vector<Expense> none; swap_ledger_(none);
+                rules_.clear();
+                clear_history_();
+                break;
+            }
+            case ChangeKind::RuleAdd: {
+                RecurrenceRule r;
+                if (c.row != rules_.size() || !decode_rule(c.e.description, r)) return false;
+                cats_.intern(r.category);
+                rules_.push_back(std::move(r));
+                break;
+            }
+            case ChangeKind::RuleSkip: case ChangeKind::RuleUnskip: {
+                if (c.row >= rules_.size()) return false;
+                auto n = rules_[c.row].occurrence_on(c.e.date);
+                if (!n) return false;
+                if (c.kind == ChangeKind::RuleSkip) rules_[c.row].skipped.insert(*n);
+                else rules_[c.row].skipped.erase(*n);
+                break;
+            }
+            default: return false;
+        }
+        return true;
+    }
+
+    std::vector<Expense> all() const { return expenses_; }
+    std::size_t size() const { return expenses_.size(); }
+
+    // Includes occurrences of recurring rules in the range, after the stored rows.
+    // The scans below return nothing once their budget trips.
+    std::vector<Expense> filter_by_date_range(const Date& from, const Date& to, QueryBudget* budget = nullptr) const {
+        std::vector<Expense> out;
+        BudgetMeter meter(budget);
+        for (const auto& e : expenses_) {
+            bool hit = date_le(from,e.date) && date_le(e.date,to);
+            if (hit) out.push_back(e);
+            if (!meter.step(hit ? scratch_bytes(e) : 0)) return {};
+        }
+        bool stopped = false;
+        for_each_occurrence(from, to, [&](const RecurrenceRule& r, const Date& d) {
+            if (stopped) return;
+            out.push_back(Expense{ d, r.amount, r.category, r.description });
+            stopped = !meter.step(scratch_bytes(out.back()));
+        });
+        if (stopped || !meter.flush()) return {};
+        return out;
+    }
+    // Range total without materializing occurrences: each rule contributes
+    // amount * (occurrences in range - skipped ones).
+    double total_in_range(const Date& from, const Date& to) const {
+        double s=0.0;
+        for (const auto& e : expenses_) if (date_le(from,e.date) && date_le(e.date,to)) s += e.amount;
+        for (const auto& r : rules_) s += r.amount * static_cast<double>(occurrence_count_(r, from, to));
+        return s;
+    }
+
+    // Recurring rules. Returns the new rule's id.
+    std::size_t add_recurring(RecurrenceRule r) {
+        if (r.interval < 1) r.interval = 1;
+        cats_.intern(r.category);
+        rules_.push_back(std::move(r));
+        record_rule_(rules_.size()-1);
+        journal_.commit();
+        return rules_.size()-1;
+    }
+    const std::vector<RecurrenceRule>& recurring() const { return rules_; }
+    // Drops the occurrence of `rule` falling on `on`. False if there is none.
+    bool skip_occurrence(std::size_t rule, const Date& on) {
+        if (rule >= rules_.size()) return false;
+        auto n = rules_[rule].occurrence_on(on);
+        if (!n) return false;
+        if (!rules_[rule].skipped.count(*n)) { skip_(rule, *n); journal_.commit(); }
+        return true;
+    }
+    // Replaces one occurrence with a stored row; the only way rule output is
+    // materialized. Undo restores the occurrence along with removing the row.
+    bool override_occurrence(std::size_t rule, const Date& on, Expense e) {
+        if (rule >= rules_.size()) return false;
+        auto n = rules_[rule].occurrence_on(on);
+        if (!n) return false;
+        Op op; op.kind = Op::Kind::Override; op.rule = rule;
+        if (!rules_[rule].skipped.count(*n)) { skip_(rule, *n); op.occurrence = *n; }
+        categorize_(e);
+        insert_row_(std::move(e));
+        op.row = expenses_.size()-1;
+        push_undo_(std::move(op));
+        return true;
+    }
+    template <class F>
+    void for_each_occurrence(const Date& from, const Date& to, F&& f) const {
+        for (const auto& r : rules_) {
+            std::int64_t hi = r.end_on_or_before(to);
+            for (std::int64_t n = r.first_on_or_after(from); n < hi; ++n) {
+                if (!r.skipped.count(n)) f(r, r.occurrence(n));
+            }
+        }
+    }
+    // Matches the category and everything below it ("Travel" includes "Travel/Hotels").
+    std::vector<Expense> filter_by_category(const std::string& cat, QueryBudget* budget = nullptr) const {
+        std::vector<Expense> out;
+        auto root = cats_.find(cat); if (!root) return out;
+        const auto sub = cats_.subtree(*root);
+        BudgetMeter meter(budget);
+        for (std::size_t i=0;i<expenses_.size();++i) {
+            bool hit = cats_.contains(sub, cat_ids_[i]);
+            if (hit) out.push_back(expenses_[i]);
+            if (!meter.step(hit ? scratch_bytes(expenses_[i]) : 0)) return {};
+        }
+        if (!meter.flush()) return {};
+        return out;
+    }
+    std::vector<Expense> search(const std::string& q, QueryBudget* budget = nullptr) const {
+        std::vector<Expense> out;
+        BudgetMeter meter(budget);
+        for (const auto& e : expenses_) {
+            bool hit = icontains(e.category,q) || icontains(e.description,q);
+            if (hit) out.push_back(e);
+            if (!meter.step(hit ? scratch_bytes(e) : 0)) return {};
+        }
+        if (!meter.flush()) return {};
+        return out;
+    }
+
+    double total(const std::vector<Expense>& list) const {
+        double s=0.0; for (const auto& e : list) s += e.amount; return s;
+    }
+    // Totals per category path, rolled up so "travel" includes "travel/flights".
+    // The ledger's rows are summed into their own node by interned id, then one
+    // reverse-id pass pushes each node's sum into its parent.
+    std::map<std::string,double> totals_by_category() const {
+        std::vector<double> sum(cats_.size(), 0.0);
+        std::vector<char> seen(cats_.size(), 0);
+        for (std::size_t i=0;i<expenses_.size();++i) { sum[cat_ids_[i]] += expenses_[i].amount; seen[cat_ids_[i]] = 1; }
+        return rollup_(sum, seen, {});
+    }
+    // Same for any list of rows; each distinct category string is resolved once.
+    std::map<std::string,double> totals_by_category(const std::vector<Expense>& list) const {
+        std::map<std::string,double> other;
+        std::vector<double> sum(cats_.size(), 0.0);
+        std::vector<char> seen(cats_.size(), 0);
+        std::unordered_map<std::string, std::optional<CategoryTree::Id>> ids;
+        for (const auto& e : list) {
+            auto it = ids.find(e.category);
+            if (it == ids.end()) it = ids.emplace(e.category, cats_.find(e.category)).first;
+            if (it->second) { sum[*it->second] += e.amount; seen[*it->second] = 1; }
+            else other[CategoryTree::normalize(e.category)] += e.amount;
+        }
+        return rollup_(sum, seen, std::move(other));
+    }
+    const CategoryTree& categories() const { return cats_; }
+
+    // Rows with min <= amount <= max (to the cent), ascending by amount.
+    std::vector<Expense> filter_by_amount(double min, double max, const ExpenseFilter& f = {}) const {
+        std::vector<Expense> out;
+        std::optional<CategoryTree::Subtree> sub; if (!subtree_(f, sub)) return out;
+        amounts_.range(AmountIndex::to_cents(min), AmountIndex::to_cents(max), [&](std::uint32_t r) {
+            if (matches_(r, f, sub)) out.push_back(expenses_[r]);
+            return true;
+        });
+        return out;
+    }
+    // Rows of the category's subtree dated within [from, to], by category then
+    // date, followed by matching recurring occurrences.
+    std::vector<Expense> filter_by_category_in_range(const std::string& cat, const Date& from, const Date& to) const {
+        std::vector<Expense> out;
+        for_each_category_span_(cat, from, to, [&](CategoryTree::Id id, std::pair<std::size_t, std::size_t> sp) {
+            const auto* ent = by_cat_date_.entries(id);
+            for (std::size_t i=sp.first;i<sp.second;++i) out.push_back(expenses_[ent[i].row]);
+        });
+        for_each_occurrence(from, to, [&](const RecurrenceRule& r, const Date& d) {
+            if (in_subtree_(cat, r.category)) out.push_back(Expense{ d, r.amount, r.category, r.description });
+        });
+        return out;
+    }
+    // Same rows as filter_by_category_in_range, summed from the prefix sums.
+    double category_total_in_range(const std::string& cat, const Date& from, const Date& to) const {
+        std::int64_t cents = 0;
+        for_each_category_span_(cat, from, to, [&](CategoryTree::Id id, std::pair<std::size_t, std::size_t> sp) {
+            cents += by_cat_date_.cents(id, sp);
+        });
+        double s = static_cast<double>(cents) / 100.0;
+        for (const auto& r : rules_) {
+            if (in_subtree_(cat, r.category)) s += r.amount * static_cast<double>(occurrence_count_(r, from, to));
+        }
+        return s;
+    }
+
+    // Sums and counts per (month or week, category) in one pass over the packed
+    // day and category columns. Rows are split across threads, each filling a
+    // private flat matrix; the matrices are added together at the end.
+    // Recurring occurrences are included when both bounds are given.
+    PivotTable pivot(PivotPeriod per, std::optional<Date> from = std::nullopt,
+                     std::optional<Date> to = std::nullopt, unsigned threads = 0) const {
+        PivotTable out;
+        std::int32_t dlo = std::numeric_limits<std::int32_t>::max(), dhi = std::numeric_limits<std::int32_t>::min();
+        if (from) dlo = day_of_(*from);
+        if (to) dhi = day_of_(*to);
+        if (!from || !to) {
+            std::int32_t mn = std::numeric_limits<std::int32_t>::max(), mx = std::numeric_limits<std::int32_t>::min();
+            for (auto d : days_) { mn = std::min(mn, d); mx = std::max(mx, d); }
+            if (!from) dlo = mn;
+            if (!to) dhi = mx;
+        }
+        if (dlo > dhi) return out;
+        auto period = [per](std::int32_t day) -> std::int64_t {
+            if (per == PivotPeriod::Week) return (day + 3 >= 0 ? day + 3 : day - 3) / 7;
+            Date d = civil_from_days(day);
+            return std::int64_t(d.y)*12 + (d.m-1);
+        };
+        const std::int64_t plo = period(dlo);
+        const std::size_t nper = static_cast<std::size_t>(period(dhi) - plo + 1), ncat = cats_.size();
+        const std::size_t cells = nper * ncat, n = expenses_.size();
+
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::min<std::size_t>(threads, std::max<std::size_t>(1, n / 65536)));
+        std::vector<std::vector<double>> sums(threads, std::vector<double>(cells, 0.0));
+        std::vector<std::vector<std::uint32_t>> counts(threads, std::vector<std::uint32_t>(cells, 0));
+        auto work = [&](unsigned t) {
+            std::size_t b = n * t / threads, e = n * (t+1) / threads;
+            double* S = sums[t].data(); std::uint32_t* C = counts[t].data();
+            for (std::size_t i=b;i<e;++i) {
+                std::int32_t d = days_[i];
+                if (d < dlo || d > dhi) continue;
+                std::size_t cell = static_cast<std::size_t>(period(d) - plo) * ncat + cat_ids_[i];
+                S[cell] += expenses_[i].amount; ++C[cell];
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t=1;t<threads;++t) pool.emplace_back(work, t);
+        work(0);
+        for (auto& th : pool) th.join();
+        for (unsigned t=1;t<threads;++t) {
+            for (std::size_t c=0;c<cells;++c) { sums[0][c] += sums[t][c]; counts[0][c] += counts[t][c]; }
+        }
+        if (from && to) {
+            for_each_occurrence(*from, *to, [&](const RecurrenceRule& r, const Date& d) {
+                auto id = cats_.find(r.category); if (!id) return;
+                std::size_t cell = static_cast<std::size_t>(period(day_of_(d)) - plo) * ncat + *id;
+                sums[0][cell] += r.amount; ++counts[0][cell];
+            });
+        }
+
+        std::vector<std::size_t> keep;
+        for (std::size_t c=0;c<ncat;++c) {
+            for (std::size_t r=0;r<nper;++r) if (counts[0][r*ncat + c]) { keep.push_back(c); break; }
+        }
+        for (auto c : keep) out.categories.push_back(cats_.path(static_cast<CategoryTree::Id>(c)));
+        for (std::size_t r=0;r<nper;++r) {
+            std::int64_t p = plo + static_cast<std::int64_t>(r);
+            if (per == PivotPeriod::Week) out.periods.push_back(to_string(civil_from_days(p*7 - 3)));
+            else out.periods.push_back(to_string(Date{ static_cast<int>(p/12), static_cast<int>(p%12 + 1), 1 }).substr(0, 7));
+            for (auto c : keep) { out.sums.push_back(sums[0][r*ncat + c]); out.counts.push_back(counts[0][r*ncat + c]); }
+        }
+        return out;
+    }
+
+    // Rules that fill in the category of uncategorized rows (blank or
+    // "Uncategorized") as they are added, imported or loaded.
+    void set_rules(CategoryRules rules) { rules.compile(); rules_engine_ = std::move(rules); }
+    const CategoryRules& rules() const { return rules_engine_; }
+
+    // Rows flagged on ingest (add, add_batch, imports, load_csv). Flags are an
+    // audit trail and are not withdrawn by undo.
+    const AnomalyDetector& anomalies() const { return anomalies_; }
+    void set_anomaly_threshold(double k) { anomalies_.set_threshold(k); }
+
+    // Approximate top merchants (normalized descriptions) by spend or by
+    // count over the months overlapping [from, to]: the window is widened to
+    // whole months, since each month has its own sketch. Edits, deletes and
+    // undo take their rows back out of the sketches, so estimates follow the
+    // current ledger, within the error bounds that retract() describes.
+    std::vector<HeavyHitter> top_merchants(const Date& from, const Date& to, std::size_t n, bool by_spend) const {
+        return merchants_.top(from, to, n, by_spend);
+    }
+
+    // Row-level access for the query engine. Row ids are ledger positions and
+    // stay valid until the next mutation.
+    const Expense& at(std::size_t row) const { return expenses_[row]; }
+    CategoryTree::Id category_id(std::size_t row) const { return cat_ids_[row]; }
+    std::int32_t day(std::size_t row) const { return days_[row]; }
+    std::vector<std::uint32_t> rows_in_category_range(const std::string& cat, const Date& from, const Date& to) const {
+        std::vector<std::uint32_t> out;
+        for_each_category_span_(cat, from, to, [&](CategoryTree::Id id, std::pair<std::size_t, std::size_t> sp) {
+            const auto* ent = by_cat_date_.entries(id);
+            for (std::size_t i=sp.first;i<sp.second;++i) out.push_back(ent[i].row);
+        });
+        return out;
+    }
+    std::vector<std::uint32_t> rows_by_amount(double min, double max) const {
+        std::vector<std::uint32_t> out;
+        amounts_.range(AmountIndex::to_cents(min), AmountIndex::to_cents(max),
+                       [&](std::uint32_t r) { out.push_back(r); return true; });
+        return out;
+    }
+
+    // The n largest rows, descending by amount.
+    std::vector<Expense> top_by_amount(std::size_t n, const ExpenseFilter& f = {}) const {
+        std::vector<Expense> out;
+        std::optional<CategoryTree::Subtree> sub; if (!subtree_(f, sub) || n == 0) return out;
+        amounts_.descending([&](std::uint32_t r) {
+            if (matches_(r, f, sub)) out.push_back(expenses_[r]);
+            return out.size() < n;
+        });
+        return out;
+    }
+
+    // Optional persistence. Saving a ledger also writes its recurring rules
+    // to <path>.recurring (see encode_rule), or removes that file if there
+    // are none; loading one takes the rules from that file if it exists and
+    // keeps the current rules otherwise.
+    bool save_csv(const std::string& path) const {
+        std::ofstream f(path); if (!f) return false;
+        f << kCsvHeader << '\n';
+        for (const auto& e : expenses_) write_csv_row(f, e);
+        return static_cast<bool>(f) && write_recurring_(path);
+    }
+    // Replaces the ledger; undo swaps the previous ledger back in.
+    bool load_csv(const std::string& path) {
+        std::vector<Expense> rows;
+        if (!read_csv_(path, rows)) return false;
+        load_rows_(std::move(rows), read_recurring_(path));
+        return true;
+    }
+    // Appends the file's rows as a single undoable import.
+    bool import_csv(const std::string& path) {
+        std::vector<Expense> rows;
+        if (!read_csv_(path, rows)) return false;
+        add_batch(std::move(rows));
+        return true;
+    }
+    // Arrow IPC counterparts of save_csv/load_csv/import_csv. The date
+    // column is written straight from days_. save_arrow also writes the
+    // index file (see write_index_file); failing to is not a failed save,
+    // the next load_arrow just rebuilds.
+    bool save_arrow(const std::string& path) const {
+        ArrowRows cols;
+        StreamDigest digest;
+        if (!cols.build(expenses_, false) || !write_arrow_file(path, cols.columns(days_.data()), &digest)) return false;
+        wait_index_writer_();
+        write_index_file(index_file_path(path), digest, index_columns_());
+        return write_recurring_(path);
+    }
+    // Writes one row group per month; see write_parquet_file.
+    bool save_parquet(const std::string& path) const { return write_parquet_file(path, expenses_, days_); }
+    // Adopts the snapshot's index file when it is current. Otherwise the
+    // indexes are built as for CSV and a fresh index file is written by a
+    // background thread, so this load does not wait for it. If rules
+    // recategorized any row the ledger no longer matches the snapshot: the
+    // index file is neither adopted nor written, since it is keyed on the
+    // snapshot's digest alone.
+    bool load_arrow(const std::string& path, std::string& err) {
+        std::vector<Expense> rows;
+        StreamDigest digest;
+        if (!read_arrow_file(path, rows, err, &digest)) return false;
+        IndexFile idx;
+        bool current = idx.open(index_file_path(path), digest, rows.size());
+        if (load_rows_(std::move(rows), read_recurring_(path), current ? &idx : nullptr) && !current) {
+            wait_index_writer_();
+            index_writer_ = std::thread([cols = index_columns_(), file = index_file_path(path), digest] {
+                write_index_file(file, digest, cols);
+            });
+        }
+        return true;
+    }
+    bool import_arrow(const std::string& path, std::string& err) {
+        std::vector<Expense> rows;
+        if (!read_arrow_file(path, rows, err)) return false;
+        add_batch(std::move(rows));
+        return true;
+    }
+
+private:
+    // Undo/redo log entry. Each entry holds only what its inverse needs, so
+    // undoing an import moves the rows out instead of copying the ledger.
+    struct Op {
+        enum class Kind { Add, Edit, Remove, Import, Load, Recategorize, Override } kind{Kind::Add};
+        std::size_t row{0};         // Add/Edit/Remove/Override: row; Import: first appended row
+        std::size_t count{0};       // Import: rows appended
+        Expense before, after;      // Edit: both; Remove: before; Add/Override: after (while undone)
+        std::vector<Expense> rows;  // Import: rows (while undone); Load: the other ledger
+        std::vector<std::uint32_t> ids;   // Recategorize: rows; after.category is the new category
+        std::vector<std::string> cats;    // Recategorize: their previous categories
+        std::optional<std::vector<RecurrenceRule>> recurring;  // Load: the other rules, if it replaced them
+        std::size_t rule{0};              // Override: the rule and the occurrence it skipped,
+        std::optional<std::int64_t> occurrence;  // unless that was skipped already
+        std::size_t bytes{0};       // op_bytes_ while on the undo stack
+    };
+    static constexpr std::size_t kMaxUndo = 256;
+    static constexpr std::size_t kMaxUndoBytes = std::size_t{64} << 20;
+
+    std::vector<Expense> expenses_;
+    CategoryTree cats_;
+    // Packed columns parallel to expenses_.
+    std::vector<CategoryTree::Id> cat_ids_;
+    std::vector<std::int32_t> days_;  // days_from_civil(date)
+    AmountIndex amounts_;
+    mutable CategoryDateIndex by_cat_date_;
+    AnomalyDetector anomalies_;
+    MerchantSketches merchants_;
+    CategoryRules rules_engine_;
+    std::vector<RecurrenceRule> rules_;
+    std::deque<Op> undo_, redo_;
+    std::size_t undo_bytes_{0}, undo_limit_{kMaxUndoBytes};
+    ChangeJournal journal_;
+    mutable std::thread index_writer_;  // rewrites a stale index file
+
+    static std::int64_t occurrence_count_(const RecurrenceRule& r, const Date& from, const Date& to) {
+        std::int64_t lo = r.first_on_or_after(from), hi = r.end_on_or_before(to);
+        if (hi <= lo) return 0;
+        auto skipped = std::distance(r.skipped.lower_bound(lo), r.skipped.lower_bound(hi));
+        return (hi - lo) - skipped;
+    }
+
+    static bool uncategorized_(const std::string& cat) {
+        return cat.find_first_not_of(" \t") == std::string::npos || iequals(cat, "Uncategorized");
+    }
+    // True if a rule set the category.
+    bool categorize_(Expense& e) const {
+        if (!uncategorized_(e.category)) return false;
+        const std::string* cat = rules_engine_.match(e.description);
+        if (cat) e.category = *cat;
+        return cat != nullptr;
+    }
+
+    // Streaming statistics, fed by every new row and reset when the ledger
+    // is replaced. Followers get the same stream by replaying the journal.
+    // Removed and edited rows are taken back out of the merchant sketches;
+    // the anomaly statistics are never retracted, and rows that undo or redo
+    // bring back are not observed again.
+    void ingest_(std::size_t row) {
+        anomalies_.observe(cat_ids_[row], expenses_[row]);
+        merchants_.observe(expenses_[row]);
+    }
+
+    void push_undo_(Op op) {
+        keep_undo_(std::move(op));
+        redo_.clear();
+        journal_.commit();
+    }
+    void keep_undo_(Op op) {
+        op.bytes = op_bytes_(op);
+        undo_bytes_ += op.bytes;
+        undo_.push_back(std::move(op));
+        trim_undo_();
+    }
+    void trim_undo_() {
+        while (undo_.size() > kMaxUndo || (undo_.size() > 1 && undo_bytes_ > undo_limit_)) {
+            undo_bytes_ -= undo_.front().bytes;
+            undo_.pop_front();
+        }
+    }
+    void clear_history_() { undo_.clear(); redo_.clear(); undo_bytes_ = 0; }
+    // Approximate heap footprint of an op.
+    static std::size_t op_bytes_(const Op& op) {
+        std::size_t n = sizeof(Op) + scratch_bytes(op.before) + scratch_bytes(op.after);
+        for (const auto& e : op.rows) n += scratch_bytes(e);
+        n += op.ids.size() * sizeof(std::uint32_t);
+        for (const auto& c : op.cats) n += sizeof(std::string) + c.size();
+        if (op.recurring) n += op.recurring->size() * sizeof(RecurrenceRule);
+        return n;
+    }
+
+    // All mutations go through these primitives so derived state stays in sync.
+    // `fresh` is false for a row that undo or redo brings back.
+    void insert_row_(Expense e, bool fresh = true) {
+        cat_ids_.push_back(cats_.intern(e.category));
+        days_.push_back(day_of_(e.date));
+        amounts_.insert(amount_key_(e.amount, expenses_.size()));
+        by_cat_date_.append(cat_ids_.back(), days_.back(),
+                            static_cast<std::uint32_t>(expenses_.size()), AmountIndex::to_cents(e.amount));
+        expenses_.push_back(std::move(e));
+        journal_.record(fresh ? ChangeKind::Add : ChangeKind::Restore, expenses_.size()-1, expenses_.back());
+        if (fresh) ingest_(expenses_.size()-1);
+        else merchants_.observe(expenses_.back());
+    }
+    void set_row_(std::size_t idx, const Expense& e) {
+        by_cat_date_.invalidate(cat_ids_[idx]);
+        cat_ids_[idx] = cats_.intern(e.category);
+        days_[idx] = day_of_(e.date);
+        by_cat_date_.invalidate(cat_ids_[idx]);
+        amounts_.erase(amount_key_(expenses_[idx].amount, idx));
+        amounts_.insert(amount_key_(e.amount, idx));
+        merchants_.forget(expenses_[idx]);
+        merchants_.observe(e);
+        expenses_[idx] = e;
+        journal_.record(ChangeKind::Edit, idx, e);
+    }
+    Expense erase_row_(std::size_t idx) {
+        Expense out = std::move(expenses_[idx]);
+        merchants_.forget(out);
+        std::size_t last = expenses_.size()-1;
+        amounts_.erase(amount_key_(out.amount, idx));
+        by_cat_date_.invalidate(cat_ids_[idx]);
+        if (idx != last) {
+            by_cat_date_.invalidate(cat_ids_[last]);
+            amounts_.erase(amount_key_(expenses_[last].amount, last));
+            amounts_.insert(amount_key_(expenses_[last].amount, idx));
+            expenses_[idx] = std::move(expenses_.back());
+            cat_ids_[idx] = cat_ids_.back();
+            days_[idx] = days_.back();
+        }
+        expenses_.pop_back(); cat_ids_.pop_back(); days_.pop_back();
+        journal_.record(ChangeKind::Remove, idx, out);
+        return out;
+    }
+    std::size_t remove_range_(const Date& from, const Date& to) {
+        const std::int32_t lo = day_of_(from), hi = day_of_(to);
+        const auto whole = MerchantSketches::whole_months(from, to);
+        std::size_t k = 0;
+        for (std::size_t i=0;i<expenses_.size();++i) {
+            if (days_[i] >= lo && days_[i] <= hi) {
+                int mo = MerchantSketches::month_of(expenses_[i].date);
+                if (mo < whole.first || mo > whole.second) merchants_.forget(expenses_[i]);
+                continue;
+            }
+            if (k != i) expenses_[k] = std::move(expenses_[i]);
+            ++k;
+        }
+        std::size_t removed = expenses_.size() - k;
+        if (removed) {
+            expenses_.resize(k);
+            rebuild_derived_();
+        }
+        merchants_.drop_months(from, to);
+        journal_.record(ChangeKind::DeleteRange, static_cast<std::uint32_t>(pack_date(to)), Expense{ from, 0.0, {}, {} });
+        return removed;
+    }
+    void set_category_(std::size_t idx, const std::string& cat, CategoryTree::Id id) {
+        by_cat_date_.invalidate(cat_ids_[idx]);
+        by_cat_date_.invalidate(id);
+        cat_ids_[idx] = id;
+        expenses_[idx].category = cat;
+        journal_.record(ChangeKind::SetCategory, idx, Expense{ Date{}, 0.0, cat, std::string() });
+    }
+    // Inverse of erase_row_: the row moved into idx goes back to the end.
+    void restore_row_(std::size_t idx, Expense e) {
+        if (idx == expenses_.size()) { insert_row_(std::move(e), false); return; }
+        insert_row_(expenses_[idx], false);
+        set_row_(idx, e);
+    }
+    // Drops rows from n on, moving them into *out if given.
+    void truncate_(std::size_t n, std::vector<Expense>* out = nullptr) {
+        for (std::size_t i=n;i<cat_ids_.size();++i) {
+            by_cat_date_.invalidate(cat_ids_[i]);
+            merchants_.forget(expenses_[i]);
+        }
+        if (out) {
+            out->reserve(expenses_.size() - n);
+            for (std::size_t i=n;i<expenses_.size();++i) out->push_back(std::move(expenses_[i]));
+        }
+        if (expenses_.size() - n > n) {
+            expenses_.resize(n); cat_ids_.resize(n); days_.resize(n); rebuild_amounts_();
+        } else {
+            for (std::size_t i=n;i<expenses_.size();++i) amounts_.erase(amount_key_(expenses_[i].amount, i));
+            expenses_.resize(n); cat_ids_.resize(n); days_.resize(n);
+        }
+        journal_.record(ChangeKind::Truncate, n, Expense{});
+    }
+    void swap_ledger_(std::vector<Expense>& rows, const IndexFile* idx = nullptr) {
+        expenses_.swap(rows);
+        if (idx) adopt_indexes_(*idx); else rebuild_derived_();
+        anomalies_.clear(); merchants_.clear();
+        for (std::size_t i=0;i<expenses_.size();++i) ingest_(i);
+        journal_snapshot_();
+    }
+    void rebuild_derived_() {
+        cat_ids_.clear(); cat_ids_.reserve(expenses_.size());
+        days_.clear(); days_.reserve(expenses_.size());
+        for (const auto& e : expenses_) {
+            cat_ids_.push_back(cats_.intern(e.category));
+            days_.push_back(day_of_(e.date));
+        }
+        rebuild_amounts_();
+        by_cat_date_.invalidate_all();
+    }
+    // rebuild_derived_ from a validated index file of this ledger. Its
+    // category ids are mapped onto ours by interning its names in id order.
+    // The arrays are copied: the amount keys arrive sorted, so the B+tree is
+    // bulk-built without a sort, and the category/date lists are assigned
+    // as they are.
+    void adopt_indexes_(const IndexFile& idx) {
+        std::vector<CategoryTree::Id> ids(idx.categories());
+        for (std::size_t i=0;i<ids.size();++i) ids[i] = cats_.intern(idx.name(i));
+        cat_ids_.clear(); cat_ids_.reserve(expenses_.size());
+        days_.clear(); days_.reserve(expenses_.size());
+        std::vector<AmountIndex::Key> keys; keys.reserve(expenses_.size());
+        for (std::size_t i=0;i<expenses_.size();++i) {
+            cat_ids_.push_back(ids[idx.category(i)]);
+            days_.push_back(day_of_(expenses_[i].date));
+            keys.push_back(idx.key(i));
+        }
+        amounts_.build(std::move(keys));
+        by_cat_date_.reset(cats_.size());
+        for (std::size_t i=0;i<ids.size();++i) {
+            auto sp = idx.list(i);
+            by_cat_date_.assign(ids[i], idx.entries() + sp.first, sp.second - sp.first, idx.prefix(i));
+        }
+    }
+    IndexColumns index_columns_() const {
+        IndexColumns c;
+        for (std::size_t id=0;id<cats_.size();++id) c.names.push_back(cats_.path(static_cast<CategoryTree::Id>(id)));
+        c.cat_ids = cat_ids_;
+        c.days = days_;
+        c.cents.reserve(expenses_.size());
+        for (const auto& e : expenses_) c.cents.push_back(AmountIndex::to_cents(e.amount));
+        return c;
+    }
+    void wait_index_writer_() const {
+        if (index_writer_.joinable()) index_writer_.join();
+    }
+    void rebuild_amounts_() {
+        std::vector<AmountIndex::Key> keys; keys.reserve(expenses_.size());
+        for (std::size_t i=0;i<expenses_.size();++i) keys.push_back(amount_key_(expenses_[i].amount, i));
+        amounts_.build(std::move(keys));
+    }
+    static std::int32_t day_of_(const Date& d) { return static_cast<std::int32_t>(days_from_civil(d)); }
+    static AmountIndex::Key amount_key_(double amount, std::size_t row) {
+        return AmountIndex::Key{ AmountIndex::to_cents(amount), static_cast<std::uint32_t>(row) };
+    }
+    template <class F>
+    void for_each_category_span_(const std::string& cat, const Date& from, const Date& to, F&& f) const {
+        auto root = cats_.find(cat); if (!root) return;
+        by_cat_date_.refresh(cat_ids_, days_, expenses_);
+        const auto sub = cats_.subtree(*root);
+        const auto& order = cats_.preorder();
+        auto lo = static_cast<std::int32_t>(days_from_civil(from)), hi = static_cast<std::int32_t>(days_from_civil(to));
+        for (auto r = sub.first; r < sub.last; ++r) {
+            auto sp = by_cat_date_.span(order[r], lo, hi);
+            if (sp.first < sp.second) f(order[r], sp);
+        }
+    }
+    bool in_subtree_(const std::string& root, const std::string& cat) const {
+        auto r = cats_.find(root), c = cats_.find(cat);
+        return r && c && cats_.contains(cats_.subtree(*r), *c);
+    }
+    bool matches_(std::size_t row, const ExpenseFilter& f, const std::optional<CategoryTree::Subtree>& sub) const {
+        const Date& d = expenses_[row].date;
+        if (f.from && !date_le(*f.from, d)) return false;
+        if (f.to && !date_le(d, *f.to)) return false;
+        return !sub || cats_.contains(*sub, cat_ids_[row]);
+    }
+    // Resolves f.category to its subtree; false if the category is unknown.
+    bool subtree_(const ExpenseFilter& f, std::optional<CategoryTree::Subtree>& sub) const {
+        sub.reset();
+        if (!f.category) return true;
+        auto id = cats_.find(*f.category); if (!id) return false;
+        sub = cats_.subtree(*id);
+        return true;
+    }
+    // Adds each seen node's sum to its parent, deepest ids first, and names
+    // the results. `out` holds totals already keyed by path.
+    std::map<std::string,double> rollup_(std::vector<double>& sum, std::vector<char>& seen,
+                                         std::map<std::string,double> out) const {
+        for (auto id = cats_.size(); id-- > 0; ) {
+            if (!seen[id]) continue;
+            auto p = cats_.parent(static_cast<CategoryTree::Id>(id));
+            if (p != CategoryTree::kNone) { sum[p] += sum[id]; seen[p] = 1; }
+            out[cats_.path(static_cast<CategoryTree::Id>(id))] += sum[id];
+        }
+        return out;
+    }
+    // Returns false if a rule recategorized a row, so the ledger differs
+    // from the file it was read from. `idx` is then not adopted, since it
+    // recorded the categories before the rules ran.
+    bool load_rows_(std::vector<Expense> rows, std::optional<std::vector<RecurrenceRule>> recurring,
+                    const IndexFile* idx = nullptr) {
+        bool recategorized = false;
+        for (auto& e : rows) recategorized |= categorize_(e);
+        if (recategorized) idx = nullptr;
+        if (recurring) swap_recurring_(*recurring);
+        swap_ledger_(rows, idx);
+        Op op; op.kind = Op::Kind::Load; op.rows = std::move(rows); op.recurring = std::move(recurring);
+        push_undo_(std::move(op));
+        return !recategorized;
+    }
+
+    void journal_snapshot_() {
+        journal_.record(ChangeKind::Reset, 0, Expense{});
+        for (std::size_t i=0;i<expenses_.size();++i) journal_.record(ChangeKind::Add, i, expenses_[i]);
+        for (std::size_t i=0;i<rules_.size();++i) record_rule_(i);
+    }
+
+    // Recurring rule primitives; like the row primitives they journal.
+    void record_rule_(std::size_t id) {
+        const auto& r = rules_[id];
+        journal_.record(ChangeKind::RuleAdd, id, Expense{ r.start, r.amount, r.category, encode_rule(r) });
+    }
+    void skip_(std::size_t rule, std::int64_t n) {
+        rules_[rule].skipped.insert(n);
+        journal_.record(ChangeKind::RuleSkip, rule, Expense{ rules_[rule].occurrence(n), 0.0, {}, {} });
+    }
+    void unskip_(std::size_t rule, std::int64_t n) {
+        rules_[rule].skipped.erase(n);
+        journal_.record(ChangeKind::RuleUnskip, rule, Expense{ rules_[rule].occurrence(n), 0.0, {}, {} });
+    }
+    // The caller journals the new set, as part of a ledger snapshot.
+    void swap_recurring_(std::vector<RecurrenceRule>& rules) {
+        rules_.swap(rules);
+        for (const auto& r : rules_) cats_.intern(r.category);
+    }
+    // Rules from the ledger's .recurring file; nullopt if there is none.
+    // Malformed lines are skipped, like malformed CSV rows.
+    static std::optional<std::vector<RecurrenceRule>> read_recurring_(const std::string& ledger) {
+        std::ifstream f(recurring_file_path(ledger));
+        if (!f) return std::nullopt;
+        std::vector<RecurrenceRule> rules;
+        std::string line;
+        RecurrenceRule r;
+        while (std::getline(f, line)) if (decode_rule(line, r)) rules.push_back(std::move(r));
+        return rules;
+    }
+    bool write_recurring_(const std::string& ledger) const {
+        const std::string path = recurring_file_path(ledger);
+        if (rules_.empty()) { std::remove(path.c_str()); return true; }
+        std::ofstream f(path);
+        for (const auto& r : rules_) f << encode_rule(r) << '\n';
+        return static_cast<bool>(f);
+    }
+
+    // Plain files stream line by line; gzip/zstd input (sniffed from the
+    // magic bytes) is decoded as it is read, and fails if support is not
+    // built in.
+    static bool read_csv_(const std::string& path, std::vector<Expense>& rows) {
+        std::ifstream f(path, std::ios::binary); if (!f) return false;
+        char magic[4]{};
+        f.read(magic, sizeof magic);
+        Codec codec = sniff_codec(magic, static_cast<std::size_t>(f.gcount()));
+        f.clear(); f.seekg(0);
+        if (codec != Codec::None) {
+            if (!codec_available(codec)) return false;
+            CsvLineParser parser;
+            if (!decompress_file(codec, f, [&](const char* p, std::size_t n) { parser.feed(p, n, rows); })) return false;
+            parser.finish(rows);
+            return true;
+        }
+        std::string line;
+        if (std::getline(f,line)) {
+            if (line.rfind(kCsvHeader,0)!=0) parse_csv_line(line, rows);
+        }
+        while (std::getline(f,line)) parse_csv_line(line, rows);
+        return true;
+    }
+};
+
+// ---- CSV tailing ----
+// Follows a CSV file that another process appends to. poll() reads only the
+// bytes after the committed offset and parses them up to the last newline; a
+// partially written last line stays in the file and the offset stops before
+// it. If the file shrinks below the offset (truncated or replaced), reading
+// restarts from the beginning. A .gz or .zst file is read to its end on each
+// poll and decoded incrementally: the decoder keeps an unfinished member
+// (frame) in memory until the rest is appended, and the parser keeps a line
+// split across members. Corrupt compressed data stops the tail; failed()
+// reports it.
+class CsvTail {
+public:
+    explicit CsvTail(std::string path, std::uint64_t offset = 0)
+        : path_(std::move(path)), offset_(offset), codec_(codec_for_path(path_)), dec_(codec_) {}
+
+    const std::string& path() const { return path_; }
+    std::uint64_t offset() const { return offset_; }
+    bool readable() const { return codec_available(codec_) && std::ifstream(path_, std::ios::binary).good(); }
+    bool failed() const { return failed_; }
+    // Moves the offset to the end of the file, skipping what is already there.
+    void seek_to_end() {
+        std::ifstream f(path_, std::ios::binary | std::ios::ate);
+        if (f) offset_ = static_cast<std::uint64_t>(f.tellg());
+        parser_.reset(); dec_.reset();
+    }
+
+    // Appends the newly completed rows to mgr as one batch; returns how many.
+    std::size_t poll(ExpenseManager& mgr) {
+        if (failed_) return 0;
+        std::ifstream f(path_, std::ios::binary | std::ios::ate);
+        if (!f) return 0;
+        auto end = static_cast<std::uint64_t>(f.tellg());
+        if (end < offset_) { offset_ = 0; parser_.reset(); dec_.reset(); }
+        if (end == offset_) return 0;
+        f.seekg(static_cast<std::streamoff>(offset_));
+        std::vector<Expense> rows;
+        if (codec_ == Codec::None) {
+            std::string buf(static_cast<std::size_t>(end - offset_), '\0');
+            if (!f.read(&buf[0], static_cast<std::streamsize>(buf.size()))) return 0;
+            auto last = buf.rfind('\n');
+            if (last == std::string::npos) return 0;
+            parser_.feed(buf.data(), last + 1, rows);
+            offset_ += last + 1;
+        } else {
+            auto sink = [&](const char* p, std::size_t n) { parser_.feed(p, n, rows); };
+            std::string chunk(Decompressor::kBlock, '\0');
+            while (offset_ < end && !failed_) {
+                std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(chunk.size(), end - offset_));
+                if (!f.read(&chunk[0], static_cast<std::streamsize>(want))) break;
+                failed_ = !dec_.feed(chunk.data(), want, sink);
+                offset_ += want;
+            }
+            failed_ = failed_ || !dec_.flush(sink);
+        }
+        std::size_t n = rows.size();
+        if (n) mgr.add_batch(std::move(rows));
+        return n;
+    }
+
+private:
+    std::string path_;
+    std::uint64_t offset_{0};
+    Codec codec_;
+    CsvLineParser parser_;
+    Decompressor dec_;
+    bool failed_{false};
+};
+
+// ---- Query language ----
+// A small filter/aggregate language, e.g.
+//   where category=food and date>=2026-01-01 and desc~"uber"
+//   group by month sum amount order by sum desc limit 10
+// Fields: category (matches the subtree), date, amount, desc. Operators:
+// = != < <= > >= and ~ (contains, case-insensitive). A value may be a bare
+// word, a "quoted string" ("" escapes a quote) or ? for a bind parameter.
+// Groups: month, week (starting Monday), year, category. Aggregates: sum,
+// count, avg. Order by: sum, count, avg, key, date, amount.
+//
+// prepare() parses once and picks an access path from which fields are
+// constrained (not their values), so a PreparedQuery is reused with
+// different parameters without re-parsing or re-planning.
+enum class QField : std::uint8_t { Category, Date, Amount, Desc };
+enum class QOp : std::uint8_t { Eq, Ne, Lt, Le, Gt, Ge, Contains };
+enum class QGroup : std::uint8_t { None, Month, Week, Year, Category };
+enum class QAgg : std::uint8_t { None, Sum, Count, Avg };
+enum class QOrder : std::uint8_t { None, Sum, Count, Avg, Key, Date, Amount };
+enum class QAccess : std::uint8_t { Scan, CategoryDate, Amount };
+
+struct QPred {
+    QField field{QField::Category};
+    QOp op{QOp::Eq};
+    int param{-1};      // bind slot, or -1 for a literal
+    std::string text;   // literal as written
+    // Bound value.
+    Date date{};
+    std::int64_t cents{0};
+    std::string str;    // lower-cased for desc, as given for category
+};
+
+struct GroupRow {
+    std::string key;
+    std::size_t count{0};
+    double value{0.0};
+};
+
+struct QueryResult {
+    bool grouped{false};
+    std::vector<Expense> rows;
+    std::vector<GroupRow> groups;
+};
+
+class PreparedQuery {
+public:
+    std::size_t param_count() const { return params_; }
+    QAccess access() const { return access_; }
+    const char* access_name() const {
+        switch (access_) {
+            case QAccess::CategoryDate: return "category/date index";
+            case QAccess::Amount: return "amount index";
+            case QAccess::Scan: break;
+        }
+        return "scan";
+    }
+
+    // True if the query is a bare filter (no grouping, aggregate, order or limit).
+    bool is_filter_only() const {
+        return group_ == QGroup::None && agg_ == QAgg::None && order_ == QOrder::None && !limit_;
+    }
+
+    // Ids of the stored rows matching the where clause, in access-path order.
+    bool select(const ExpenseManager& mgr, const std::vector<std::string>& args,
+                std::vector<std::uint32_t>& sel, std::string& err) const {
+        std::vector<QPred> preds;
+        if (!bind_all_(args, preds, err)) return false;
+        select_(mgr, preds, bounds_(preds), sel);
+        return true;
+    }
+
+    // With a budget, a run that is cancelled, times out or passes its memory
+    // limit fails with the budget's reason and releases what it allocated.
+    bool execute(const ExpenseManager& mgr, const std::vector<std::string>& args,
+                 QueryResult& out, std::string& err, QueryBudget* budget = nullptr) const {
+        if (!execute_partial(mgr, args, out, err, budget)) return false;
+        if (out.grouped) {
+            std::vector<QueryResult> parts(1);
+            parts[0] = std::move(out);
+            out = merge(std::move(parts));
+        }
+        return true;
+    }
+
+    // The query over one partition of a ledger, for merge(). Rows come back
+    // ordered and limited; groups come back keyed but unordered, unlimited
+    // and with the raw sum of amounts as their value.
+    bool execute_partial(const ExpenseManager& mgr, const std::vector<std::string>& args,
+                         QueryResult& out, std::string& err, QueryBudget* budget = nullptr) const {
+        out = QueryResult{};
+        auto stop = [&] { out = QueryResult{}; err = budget->reason(); return false; };
+        if (budget && budget->stopped()) return stop();
+        std::vector<QPred> preds;
+        if (!bind_all_(args, preds, err)) return false;
+        Bound b = bounds_(preds);
+        std::vector<std::uint32_t> sel;
+        select_(mgr, preds, b, sel, budget);
+        if (budget && budget->stopped()) return stop();
+
+        // Recurring occurrences take part only when the date range is bounded.
+        std::vector<Expense> virt;
+        BudgetMeter meter(budget);
+        bool stopped = false;
+        if (b.from && b.to) {
+            mgr.for_each_occurrence(*b.from, *b.to, [&](const RecurrenceRule& r, const Date& d) {
+                if (stopped) return;
+                Expense e{ d, r.amount, r.category, r.description };
+                bool hit = true;
+                for (const auto& p : preds) if (!match_(mgr, p, e)) { hit = false; break; }
+                if (hit) virt.push_back(std::move(e));
+                stopped = !meter.step(hit ? scratch_bytes(virt.back()) : 0);
+            });
+        }
+        if (stopped) return stop();
+
+        if (group_ == QGroup::None && agg_ == QAgg::None) {
+            out.rows.reserve(sel.size() + virt.size());
+            for (auto r : sel) {
+                out.rows.push_back(mgr.at(r));
+                if (!meter.step(scratch_bytes(out.rows.back()))) return stop();
+            }
+            for (auto& e : virt) out.rows.push_back(std::move(e));
+            if (!meter.flush()) return stop();
+            order_rows_(out.rows);
+            return true;
+        }
+
+        out.grouped = true;
+        std::map<std::string, GroupRow> groups;
+        auto add = [&](const Expense& e, std::optional<CategoryTree::Id> cat) {
+            std::string key = group_key_(mgr, e, cat);
+            auto it = groups.find(key);
+            std::size_t bytes = 0;
+            if (it == groups.end()) {
+                bytes = sizeof(GroupRow) + 2 * key.size();
+                it = groups.emplace(key, GroupRow{}).first;
+                it->second.key = std::move(key);
+            }
+            ++it->second.count; it->second.value += e.amount;
+            return meter.step(bytes);
+        };
+        for (auto r : sel) if (!add(mgr.at(r), mgr.category_id(r))) return stop();
+        for (const auto& e : virt) if (!add(e, mgr.categories().find(e.category))) return stop();
+        if (!meter.flush()) return stop();
+        for (auto& kv : groups) out.groups.push_back(std::move(kv.second));
+        return true;
+    }
+
+    // Combines execute_partial() results from disjoint partitions into the
+    // result execute() would give over their union. Rows keep partition order
+    // unless the query orders them.
+    QueryResult merge(std::vector<QueryResult> parts) const {
+        QueryResult out;
+        if (parts.empty()) return out;
+        out.grouped = parts[0].grouped;
+        if (!out.grouped) {
+            for (auto& p : parts) {
+                if (out.rows.empty()) out.rows = std::move(p.rows);
+                else std::move(p.rows.begin(), p.rows.end(), std::back_inserter(out.rows));
+            }
+            if (parts.size() > 1) order_rows_(out.rows);
+            return out;
+        }
+
+        std::map<std::string, GroupRow> groups;
+        for (auto& p : parts) {
+            for (auto& g : p.groups) {
+                GroupRow& m = groups[g.key];
+                if (m.key.empty()) m.key = std::move(g.key);
+                m.count += g.count; m.value += g.value;
+            }
+        }
+        for (auto& kv : groups) {
+            GroupRow g = std::move(kv.second);
+            if (agg_ == QAgg::Count) g.value = static_cast<double>(g.count);
+            else if (agg_ == QAgg::Avg) g.value = g.count ? g.value / static_cast<double>(g.count) : 0.0;
+            out.groups.push_back(std::move(g));
+        }
+        if (order_ != QOrder::None && order_ != QOrder::Key) {
+            std::stable_sort(out.groups.begin(), out.groups.end(), [&](const GroupRow& a, const GroupRow& c) {
+                double x = order_ == QOrder::Count ? double(a.count) : a.value;
+                double y = order_ == QOrder::Count ? double(c.count) : c.value;
+                return desc_ ? y < x : x < y;
+            });
+        } else if (desc_) {
+            std::reverse(out.groups.begin(), out.groups.end());
+        }
+        if (limit_ && out.groups.size() > *limit_) out.groups.resize(*limit_);
+        return out;
+    }
+
+private:
+    friend std::shared_ptr<PreparedQuery> prepare_query(const std::string&, std::string&);
+
+    std::vector<QPred> preds_;
+    std::size_t params_{0};
+    QAccess access_{QAccess::Scan};
+    QGroup group_{QGroup::None};
+    QAgg agg_{QAgg::None};
+    QOrder order_{QOrder::None};
+    bool desc_{false};
+    std::optional<std::size_t> limit_;
+
+    void order_rows_(std::vector<Expense>& rows) const {
+        if (order_ == QOrder::Date || order_ == QOrder::Amount || order_ == QOrder::Key) {
+            bool by_amount = order_ == QOrder::Amount;
+            std::stable_sort(rows.begin(), rows.end(), [&](const Expense& a, const Expense& c) {
+                bool lt = by_amount ? a.amount < c.amount : (date_le(a.date, c.date) && !date_le(c.date, a.date));
+                bool gt = by_amount ? c.amount < a.amount : (date_le(c.date, a.date) && !date_le(a.date, c.date));
+                return desc_ ? gt : lt;
+            });
+        }
+        if (limit_ && rows.size() > *limit_) rows.resize(*limit_);
+    }
+    bool bind_all_(const std::vector<std::string>& args, std::vector<QPred>& preds, std::string& err) const {
+        if (args.size() != params_) { err = "expected " + std::to_string(params_) + " parameter(s)"; return false; }
+        preds = preds_;
+        for (auto& p : preds) if (!bind_(p, p.param >= 0 ? args[static_cast<std::size_t>(p.param)] : p.text, err)) return false;
+        return true;
+    }
+    struct Bound;
+    void select_(const ExpenseManager& mgr, const std::vector<QPred>& preds, const Bound& b,
+                 std::vector<std::uint32_t>& sel, QueryBudget* budget = nullptr) const;
+
+    struct Bound {
+        std::optional<Date> from, to;
+        double amin{-std::numeric_limits<double>::infinity()};
+        double amax{std::numeric_limits<double>::infinity()};
+        std::size_t cat{0};
+    };
+    // Inclusive bounds implied by the predicates; strict ones are left to the residual filter.
+    static Bound bounds_(const std::vector<QPred>& preds) {
+        Bound b;
+        for (std::size_t i=0;i<preds.size();++i) {
+            const auto& p = preds[i];
+            if (p.field == QField::Category && p.op == QOp::Eq) b.cat = i;
+            if (p.field == QField::Date) {
+                if (p.op == QOp::Ge || p.op == QOp::Gt || p.op == QOp::Eq) if (!b.from || date_le(*b.from, p.date)) b.from = p.date;
+                if (p.op == QOp::Le || p.op == QOp::Lt || p.op == QOp::Eq) if (!b.to || date_le(p.date, *b.to)) b.to = p.date;
+            }
+            if (p.field == QField::Amount) {
+                double v = static_cast<double>(p.cents) / 100.0;
+                if (p.op == QOp::Ge || p.op == QOp::Gt || p.op == QOp::Eq) b.amin = std::max(b.amin, v);
+                if (p.op == QOp::Le || p.op == QOp::Lt || p.op == QOp::Eq) b.amax = std::min(b.amax, v);
+            }
+        }
+        return b;
+    }
+    static bool bind_(QPred& p, const std::string& v, std::string& err) {
+        switch (p.field) {
+            case QField::Date: {
+                auto d = parse_date(v); if (!d) { err = "invalid date '" + v + "'"; return false; }
+                p.date = *d; return true;
+            }
+            case QField::Amount: {
+                try { std::size_t pos=0; double a = std::stod(v, &pos); if (pos==v.size()) { p.cents = AmountIndex::to_cents(a); return true; } } catch (...) {}
+                err = "invalid amount '" + v + "'"; return false;
+            }
+            case QField::Category: p.str = v; return true;
+            case QField::Desc: p.str = to_lower(v); return true;
+        }
+        return false;
+    }
+    template <class T>
+    static bool cmp_(QOp op, const T& a, const T& b) {
+        switch (op) {
+            case QOp::Eq: return a == b;
+            case QOp::Ne: return !(a == b);
+            case QOp::Lt: return a < b;
+            case QOp::Le: return !(b < a);
+            case QOp::Gt: return b < a;
+            case QOp::Ge: return !(a < b);
+            case QOp::Contains: return false;
+        }
+        return false;
+    }
+    static bool match_desc_(const QPred& p, const std::string& desc) {
+        if (p.op == QOp::Contains) return to_lower(desc).find(p.str) != std::string::npos;
+        return cmp_(p.op, to_lower(desc), p.str);
+    }
+    // Keeps the rows of sel that pass keep. A scan stopped by the budget
+    // leaves sel empty.
+    template <class F>
+    static void keep_(std::vector<std::uint32_t>& sel, QueryBudget* budget, F keep) {
+        BudgetMeter meter(budget);
+        std::size_t k = 0;
+        for (auto r : sel) {
+            if (keep(r)) sel[k++] = r;
+            if (!meter.step()) { sel.clear(); sel.shrink_to_fit(); return; }
+        }
+        sel.resize(k);
+    }
+    // Filters one predicate over the selection vector in place. Returns
+    // false if nothing can match (unknown category).
+    static bool filter_(const ExpenseManager& mgr, const QPred& p, std::vector<std::uint32_t>& sel, QueryBudget* budget) {
+        switch (p.field) {
+            case QField::Date: {
+                auto v = static_cast<std::int32_t>(days_from_civil(p.date));
+                keep_(sel, budget, [&](std::uint32_t r) { return cmp_(p.op, mgr.day(r), v); });
+                break;
+            }
+            case QField::Amount:
+                keep_(sel, budget, [&](std::uint32_t r) { return cmp_(p.op, AmountIndex::to_cents(mgr.at(r).amount), p.cents); });
+                break;
+            case QField::Desc:
+                keep_(sel, budget, [&](std::uint32_t r) { return match_desc_(p, mgr.at(r).description); });
+                break;
+            case QField::Category: {
+                auto id = mgr.categories().find(p.str);
+                if (p.op == QOp::Contains) {
+                    std::string needle = to_lower(p.str);
+                    keep_(sel, budget, [&](std::uint32_t r) { return mgr.categories().path(mgr.category_id(r)).find(needle) != std::string::npos; });
+                    break;
+                }
+                bool want = p.op == QOp::Eq;
+                if (!id) return !want;
+                const auto& cats = mgr.categories();
+                const auto sub = cats.subtree(*id);
+                keep_(sel, budget, [&](std::uint32_t r) { return cats.contains(sub, mgr.category_id(r)) == want; });
+                break;
+            }
+        }
+        return true;
+    }
+    static bool match_(const ExpenseManager& mgr, const QPred& p, const Expense& e) {
+        switch (p.field) {
+            case QField::Date: return cmp_(p.op, days_from_civil(e.date), days_from_civil(p.date));
+            case QField::Amount: return cmp_(p.op, AmountIndex::to_cents(e.amount), p.cents);
+            case QField::Desc: return match_desc_(p, e.description);
+            case QField::Category: {
+                if (p.op == QOp::Contains) return CategoryTree::normalize(e.category).find(to_lower(p.str)) != std::string::npos;
+                auto root = mgr.categories().find(p.str), id = mgr.categories().find(e.category);
+                bool in = root && id && mgr.categories().contains(mgr.categories().subtree(*root), *id);
+                return (p.op == QOp::Eq) == in;
+            }
+        }
+        return false;
+    }
+    std::string group_key_(const ExpenseManager& mgr, const Expense& e, std::optional<CategoryTree::Id> cat) const {
+        switch (group_) {
+            case QGroup::Month: return to_string(e.date).substr(0, 7);
+            case QGroup::Year: return to_string(e.date).substr(0, 4);
+            case QGroup::Week: {
+                auto d = days_from_civil(e.date);
+                auto monday = d - ((d + 3) % 7 + 7) % 7;  // 1970-01-01 was a Thursday
+                return to_string(civil_from_days(monday));
+            }
+            case QGroup::Category: return cat ? mgr.categories().path(*cat) : CategoryTree::normalize(e.category);
+            case QGroup::None: break;
+        }
+        return "all";
+    }
+};
+
+inline void PreparedQuery::select_(const ExpenseManager& mgr, const std::vector<QPred>& preds, const Bound& b,
+                                   std::vector<std::uint32_t>& sel, QueryBudget* budget) const {
+    // Access path: candidate row ids, narrowed by an index where possible.
+    // A full scan is charged before its selection vector is allocated.
+    if (access_ == QAccess::CategoryDate && b.from && b.to) {
+        sel = mgr.rows_in_category_range(preds[b.cat].str, *b.from, *b.to);
+        if (budget && !budget->charge(sel.size() * sizeof(std::uint32_t))) { sel = {}; return; }
+    } else if (access_ == QAccess::Amount) {
+        sel = mgr.rows_by_amount(b.amin, b.amax);
+        if (budget && !budget->charge(sel.size() * sizeof(std::uint32_t))) { sel = {}; return; }
+    } else {
+        if (budget && !budget->charge(mgr.size() * sizeof(std::uint32_t))) return;
+        sel.resize(mgr.size());
+        for (std::size_t i=0;i<sel.size();++i) sel[i] = static_cast<std::uint32_t>(i);
+    }
+    // Residual filters, one predicate at a time over the selection vector.
+    for (const auto& p : preds) if (!filter_(mgr, p, sel, budget)) { sel.clear(); break; }
+}
+
+// Tokenizer and parser for the grammar above. Returns nullptr and sets err on failure.
+inline std::shared_ptr<PreparedQuery> prepare_query(const std::string& text, std::string& err) {
+    std::vector<std::pair<char, std::string>> toks;  // kind: w(ord), s(tring), o(perator), ?(param)
+    for (std::size_t i=0;i<text.size();) {
+        char c = text[i];
+        if (std::isspace(static_cast<unsigned char>(c))) { ++i; continue; }
+        if (c=='"') {
+            std::string v; ++i;
+            while (true) {
+                if (i >= text.size()) { err = "unterminated string"; return nullptr; }
+                if (text[i]=='"') { if (i+1 < text.size() && text[i+1]=='"') { v.push_back('"'); i += 2; continue; } ++i; break; }
+                v.push_back(text[i++]);
+            }
+            toks.emplace_back('s', v);
+        } else if (c=='?') {
+            toks.emplace_back('?', "?"); ++i;
+        } else if (std::strchr("=!<>~", c)) {
+            std::string op(1, c); ++i;
+            if (i < text.size() && text[i]=='=' && c!='=' && c!='~') op.push_back(text[i++]);
+            if (op=="!") { err = "expected != "; return nullptr; }
+            toks.emplace_back('o', op);
+        } else {
+            std::string v;
+            while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])) && !std::strchr("=!<>~\"?", text[i])) v.push_back(text[i++]);
+            toks.emplace_back('w', v);
+        }
+    }
+
+    auto q = std::make_shared<PreparedQuery>();
+    std::size_t pos = 0;
+    auto peek_kw = [&](const char* kw) { return pos < toks.size() && toks[pos].first=='w' && to_lower(toks[pos].second)==kw; };
+    auto expect_kw = [&](const char* kw) {
+        if (peek_kw(kw)) { ++pos; return true; }
+        err = std::string("expected '") + kw + "'"; return false;
+    };
+    auto word = [&](std::string& out) {
+        if (pos < toks.size() && toks[pos].first=='w') { out = to_lower(toks[pos++].second); return true; }
+        err = "unexpected end of query"; return false;
+    };
+
+    if (peek_kw("where")) {
+        ++pos;
+        while (true) {
+            QPred p; std::string f;
+            if (!word(f)) return nullptr;
+            if (f=="category" || f=="cat") p.field = QField::Category;
+            else if (f=="date") p.field = QField::Date;
+            else if (f=="amount") p.field = QField::Amount;
+            else if (f=="desc" || f=="description") p.field = QField::Desc;
+            else { err = "unknown field '" + f + "'"; return nullptr; }
+            if (pos >= toks.size() || toks[pos].first!='o') { err = "expected operator after " + f; return nullptr; }
+            const std::string& op = toks[pos++].second;
+            if (op=="=") p.op = QOp::Eq; else if (op=="!=") p.op = QOp::Ne;
+            else if (op=="<") p.op = QOp::Lt; else if (op=="<=") p.op = QOp::Le;
+            else if (op==">") p.op = QOp::Gt; else if (op==">=") p.op = QOp::Ge;
+            else if (op=="~") p.op = QOp::Contains;
+            else { err = "unknown operator '" + op + "'"; return nullptr; }
+            if (p.op == QOp::Contains && (p.field == QField::Date || p.field == QField::Amount)) { err = "~ applies to text fields"; return nullptr; }
+            if (pos >= toks.size() || toks[pos].first=='o') { err = "expected value after " + f + op; return nullptr; }
+            if (toks[pos].first=='?') p.param = static_cast<int>(q->params_++);
+            else p.text = toks[pos].second;
+            ++pos;
+            if (p.param < 0) { QPred probe = p; if (!PreparedQuery::bind_(probe, p.text, err)) return nullptr; }
+            q->preds_.push_back(std::move(p));
+            if (!peek_kw("and")) break;
+            ++pos;
+        }
+    }
+    if (peek_kw("group")) {
+        ++pos; if (!expect_kw("by")) return nullptr;
+        std::string g; if (!word(g)) return nullptr;
+        if (g=="month") q->group_ = QGroup::Month; else if (g=="week") q->group_ = QGroup::Week;
+        else if (g=="year") q->group_ = QGroup::Year; else if (g=="category") q->group_ = QGroup::Category;
+        else { err = "cannot group by '" + g + "'"; return nullptr; }
+    }
+    if (peek_kw("sum") || peek_kw("count") || peek_kw("avg")) {
+        std::string a; word(a);
+        q->agg_ = a=="sum" ? QAgg::Sum : a=="count" ? QAgg::Count : QAgg::Avg;
+        if (peek_kw("amount")) ++pos;
+    }
+    if (q->group_ != QGroup::None && q->agg_ == QAgg::None) q->agg_ = QAgg::Sum;
+    if (peek_kw("order")) {
+        ++pos; if (!expect_kw("by")) return nullptr;
+        std::string o; if (!word(o)) return nullptr;
+        if (o=="sum") q->order_ = QOrder::Sum; else if (o=="count") q->order_ = QOrder::Count;
+        else if (o=="avg") q->order_ = QOrder::Avg; else if (o=="key") q->order_ = QOrder::Key;
+        else if (o=="date") q->order_ = QOrder::Date; else if (o=="amount") q->order_ = QOrder::Amount;
+        else { err = "cannot order by '" + o + "'"; return nullptr; }
+        if (peek_kw("desc")) { q->desc_ = true; ++pos; } else if (peek_kw("asc")) ++pos;
+    }
+    if (peek_kw("limit")) {
+        ++pos; std::string n; if (!word(n)) return nullptr;
+        try { std::size_t used=0; q->limit_ = std::stoul(n, &used); if (used != n.size()) throw 0; }
+        catch (...) { err = "invalid limit '" + n + "'"; return nullptr; }
+    }
+    if (pos != toks.size()) { err = "unexpected '" + toks[pos].second + "'"; return nullptr; }
+
+    // Plan: category + both date bounds use the composite index, otherwise an
+    // amount bound uses the amount index, otherwise scan.
+    bool cat_eq=false, date_lo=false, date_hi=false, amount=false;
+    for (const auto& p : q->preds_) {
+        if (p.field == QField::Category && p.op == QOp::Eq) cat_eq = true;
+        if (p.field == QField::Date && (p.op == QOp::Ge || p.op == QOp::Gt || p.op == QOp::Eq)) date_lo = true;
+        if (p.field == QField::Date && (p.op == QOp::Le || p.op == QOp::Lt || p.op == QOp::Eq)) date_hi = true;
+        if (p.field == QField::Amount && p.op != QOp::Ne) amount = true;
+    }
+    if (cat_eq && date_lo && date_hi) q->access_ = QAccess::CategoryDate;
+    else if (amount) q->access_ = QAccess::Amount;
+    return q;
+}
+
+// Bulk recategorization: sets `category` on every stored row matching the
+// where clause (e.g. `where desc~"uber"`), as a single undoable, journaled
+// operation. Returns the number of rows changed, or nullopt with err set.
+inline std::optional<std::size_t> update_category_where(ExpenseManager& mgr, const std::string& where,
+                                                        const std::string& category, std::string& err) {
+    auto q = prepare_query(where, err);
+    if (!q) return std::nullopt;
+    if (!q->is_filter_only() || q->param_count()) { err = "expected only a where clause"; return std::nullopt; }
+    std::vector<std::uint32_t> sel;
+    if (!q->select(mgr, {}, sel, err)) return std::nullopt;
+    return mgr.set_category(sel, category);
 }
-inline std::string csv_unescape(std::string s) {
-    if (s.size()>=2 && s.front()=='"' && s.back()=='"') {
-        s = s.substr(1, s.size()-2);
-        std::string out; out.reserve(s.size());
-        for (std::size_t i=0;i<s.size();++i) {
-            if (s[i]=='"' && i+1<s.size() && s[i+1]=='"') { out.push_back('"'); ++i; }
-            else out.push_back(s[i]);
-        }
-        return out;
+
+// Prepared statements keyed by query text, so repeated queries skip parsing
+// and planning. Bounded; cleared wholesale when full.
+class QueryCache {
+public:
+    std::shared_ptr<PreparedQuery> get(const std::string& text, std::string& err) {
+        auto it = cache_.find(text);
+        if (it != cache_.end()) return it->second;
+        auto q = prepare_query(text, err);
+        if (!q) return nullptr;
+        if (cache_.size() >= kMaxEntries) cache_.clear();
+        cache_.emplace(text, q);
+        return q;
     }
-    return s;
+    std::size_t size() const { return cache_.size(); }
+
+private:
+    static constexpr std::size_t kMaxEntries = 128;
+    std::unordered_map<std::string, std::shared_ptr<PreparedQuery>> cache_;
+};
+
+#ifdef __linux__
+// ---- Server ----
+// `--serve <socket>` answers local clients over a Unix stream socket. A
+// request is one line; a response is a status line, followed for row and
+// group results by that many payload lines:
+//   ping               -> ok pong
+//   add <csv row>      -> ok              (date,amount,category,description)
+//   query <text>       -> rows <n> + n CSV rows, or groups <n> + n key,count,value lines
+//   summary            -> groups <n>      (totals by category)
+//   shm on|off         -> ok
+//   release <name>     -> ok
+//   cancel <id>        -> ok              (stops the running query tagged #<id>)
+//   export <path>      -> ok <rows>       (writes the ledger as .parquet, .arrow or CSV)
+//   reload <path>      -> ok <rows>       (replaces the ledger from a CSV or Arrow file)
+// Failures answer "err <message>". Responses come back in request order,
+// unless the request is tagged: "#<id> <request>", with any token as id, is
+// answered "#<id> <response>" as soon as it is ready, ahead of slower
+// requests sent earlier. Clients may pipeline requests of either kind.
+// Consecutive adds that arrive together are applied as one add_batch per
+// shard, so a burst of adds costs one journal frame and one sync per shard,
+// not one per row. Adds are acknowledged after their frame is synced; if the
+// journal cannot be written they answer "err journal write failed".
+//
+// Every query runs under a QueryBudget: a deadline (kQueryTimeout by
+// default) and a cap on its scratch memory (kQueryMemory). A query that
+// trips either, or is cancelled, stops at the shards' next checkpoint and
+// answers "err <reason>". A client that shuts down only its sending side
+// still gets every answer; once it hangs up, or a response cannot be
+// written to it, all of its queries are cancelled at once.
+//
+// After "shm on", row results of kShmMinRows or more skip the socket: they
+// are written as an Arrow IPC file into a new POSIX shared-memory object and
+// the response is "shm <name> <bytes> <rows>". The client maps
+// /dev/shm/<name> and reads the columns in place (with pyarrow,
+// ipc.open_file(memory_map(path))), then sends "release <name>". Objects a
+// client has not released are removed when it disconnects.
+//
+// The server is thread-per-core and shared-nothing. Each shard is a thread
+// with its own poll loop, its own ExpenseManager holding the months that
+// hash to it, its own query cache and the connections handed to it. Shards
+// never touch each other's state: they post closures to each other's
+// mailbox (a short mutex-guarded queue plus an eventfd that wakes the loop).
+// An add runs on the shard owning its month; a query runs on every shard
+// over its own partition, and the partial results are merged on the shard
+// that owns the connection. Requests are classed and scheduled per shard
+// (see WorkClass); bulk and maintenance work does its file I/O on one
+// background thread and touches the shards only in short steps.
+constexpr std::size_t kShmMinRows = 4096;
+constexpr std::size_t kMaxRequestLine = 1 << 20;
+constexpr std::chrono::milliseconds kQueryTimeout{30000};
+constexpr std::size_t kQueryMemory = std::size_t{1} << 30;
+
+// Writes rows as an Arrow IPC file into a new shared-memory object sized by
+// a first, counting pass. Returns its size, or 0 on failure.
+inline std::size_t write_shm_arrow(const std::string& name, const std::vector<Expense>& rows) {
+    ArrowRows cols;
+    if (!cols.build(rows, true)) return 0;
+    const ArrowColumns c = cols.columns(cols.days.data());
+    std::size_t size = 0;
+    write_arrow(c, [&](const void*, std::size_t n) { size += n; });
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) return 0;
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { shm_unlink(name.c_str()); return 0; }
+    char* p = static_cast<char*>(map);
+    write_arrow(c, [&](const void* src, std::size_t n) { std::memcpy(p, src, n); p += n; });
+    munmap(map, size);
+    return size;
 }
-inline void csv_split_line(const std::string& line, std::vector<std::string>& cols) {
-    cols.clear();
-    std::string cur; bool in_q=false;
-    for (char c : line) {
-        if (c=='"') { in_q=!in_q; cur.push_back(c); }
-        else if (c==',' && !in_q) { cols.push_back(cur); cur.clear(); }
-        else cur.push_back(c);
+
+// Writes rows as Parquet, Arrow IPC or CSV, chosen by the path's extension.
+inline bool write_ledger_file(const std::string& path, const std::vector<Expense>& rows) {
+    if (has_extension(path, ".parquet")) {
+        std::vector<std::int32_t> days(rows.size());
+        for (std::size_t i=0;i<rows.size();++i) days[i] = static_cast<std::int32_t>(days_from_civil(rows[i].date));
+        return write_parquet_file(path, rows, days);
     }
-    cols.push_back(cur);
-    for (auto& s : cols) while (!s.empty() && (s.back()=='\r'||s.back()=='\n')) s.pop_back();
+    if (is_arrow_path(path)) {
+        ArrowRows cols;
+        return cols.build(rows, true) && write_arrow_file(path, cols.columns(cols.days.data()));
+    }
+    std::ofstream f(path);
+    if (!f) return false;
+    f << kCsvHeader << '\n';
+    for (const auto& e : rows) write_csv_row(f, e);
+    return static_cast<bool>(f);
 }
 
-struct Expense {
-    Date date{};
-    double amount{0.0};
-    std::string category;
-    std::string description;
+// Request classes. Every shard runs its queued work by stride scheduling
+// over the weights, so under load a class gets its share of the shard and
+// no more. `running` caps how many requests of a class run at once across
+// the server and `waiting` how many may queue per shard behind them;
+// zero is unlimited. Past both, a request is refused with "err busy".
+enum class WorkClass { Interactive, Dashboard, Bulk, Maintenance };
+constexpr std::size_t kWorkClasses = 4;
+struct WorkPolicy {
+    unsigned weight;
+    std::size_t running, waiting;
 };
+constexpr WorkPolicy kWorkPolicy[kWorkClasses] = {
+    { 16, 0, 0 },   // interactive: ping, add, indexed queries
+    {  4, 8, 256 }, // dashboard: queries that scan
+    {  1, 1, 4 },   // bulk: export
+    {  1, 1, 1 },   // maintenance: reload
+};
+constexpr std::size_t kSliceRows = 4096;   // rows a bulk step copies before yielding
+constexpr std::chrono::microseconds kDrainBudget{2000};   // queued work run between polls
 
-class ExpenseManager {
+class ExpenseServer {
 public:
-    void add(const Expense& e) { expenses_.push_back(e); } 
+    // Partitions the rows by month over `shards` shards.
+    ExpenseServer(std::vector<Expense> rows, std::size_t shards) {
+        for (std::size_t i=0;i<std::max<std::size_t>(1, shards);++i) shards_.push_back(std::make_unique<Shard>(*this, i));
+        std::vector<std::vector<Expense>> parts(shards_.size());
+        for (auto& e : rows) parts[owner_(e.date)].push_back(std::move(e));
+        for (std::size_t i=0;i<parts.size();++i) if (!parts[i].empty()) shards_[i]->mgr_->add_batch(std::move(parts[i]));
+    }
+    ~ExpenseServer() {
+        shards_.clear();
+        if (listen_fd_ >= 0) { close(listen_fd_); unlink(path_.c_str()); }
+    }
+    ExpenseServer(const ExpenseServer&) = delete;
+    ExpenseServer& operator=(const ExpenseServer&) = delete;
 
-    std::vector<Expense> all() const { return expenses_; }
+    std::size_t shard_count() const { return shards_.size(); }
 
-    std::vector<Expense> filter_by_date_range(const Date& from, const Date& to) const {
-        std::vector<Expense> out;
-        for (const auto& e : expenses_) if (date_le(from,e.date) && date_le(e.date,to)) out.push_back(e);
-        return out;
+    // Per-query deadline and scratch-memory cap; zero disables either. Call before run().
+    void set_query_limits(std::chrono::milliseconds timeout, std::size_t memory) {
+        query_timeout_ = timeout; query_memory_ = memory;
     }
-    std::vector<Expense> filter_by_category(const std::string& cat) const {
-        std::vector<Expense> out;
-        for (const auto& e : expenses_) if (iequals(e.category, cat)) out.push_back(e);
-        return out;
+
+    // Journals each shard's partition to <base>.<shard>. Call before run().
+    bool attach_journals(const std::string& base, std::string& err) {
+        for (std::size_t i=0;i<shards_.size();++i) {
+            std::string path = base + "." + std::to_string(i);
+            if (!shards_[i]->mgr_->attach_journal(path)) { err = "cannot open journal " + path; return false; }
+            shards_[i]->journal_ = path;
+        }
+        return true;
     }
-    std::vector<Expense> search(const std::string& q) const {
-        std::vector<Expense> out;
-        for (const auto& e : expenses_) if (icontains(e.category,q) || icontains(e.description,q)) out.push_back(e);
-        return out;
+
+    bool listen(const std::string& path, std::string& err) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof addr.sun_path) { err = "invalid socket path"; return false; }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) { err = std::strerror(errno); return false; }
+        // A leftover socket file from a server that is gone is replaced; a live one is not.
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0) {
+            close(fd); err = path + " is in use by another server"; return false;
+        }
+        if (errno == ECONNREFUSED) unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 || ::listen(fd, 128) < 0) {
+            err = std::strerror(errno); close(fd); return false;
+        }
+        listen_fd_ = fd; path_ = path;
+        return true;
     }
 
-    double total(const std::vector<Expense>& list) const {
-        double s=0.0; for (const auto& e : list) s += e.amount; return s;
+    // Runs one thread per shard, plus one for file I/O, until SIGINT or SIGTERM.
+    void run() {
+        sigset_t mask; sigemptyset(&mask); sigaddset(&mask, SIGINT); sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);  // inherited by the other threads
+        int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+        std::thread worker([this] { work_(); });
+        std::vector<std::thread> threads;
+        for (auto& s : shards_) threads.emplace_back([&s] { s->loop(); });
+        signalfd_siginfo info;
+        while (read(sig_fd, &info, sizeof info) < 0 && errno == EINTR) {}
+        close(sig_fd);
+        for (auto& s : shards_) { Shard* sh = s.get(); sh->post([sh] { sh->stop_ = true; }); }
+        for (auto& t : threads) t.join();
+        {
+            std::lock_guard<std::mutex> lk(jobs_mu_);
+            stopping_ = true;
+        }
+        jobs_cv_.notify_one();
+        worker.join();
     }
-    std::map<std::string,double> totals_by_category(const std::vector<Expense>& list) const {
-        std::map<std::string,double> m;
-        for (const auto& e : list) m[to_lower(e.category)] += e.amount;
-        return m;
+
+private:
+    class Shard {
+    public:
+        Shard(ExpenseServer& server, std::size_t index)
+            : server_(server), index_(index), mgr_(std::make_unique<ExpenseManager>()),
+              wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+        ~Shard() {
+            for (auto& kv : conns_) drop_(kv.second);
+            close(wake_fd_);
+        }
+
+        // Queues fn to run on this shard's thread under class cls. Callable
+        // from any thread. A class that was idle rejoins at the current
+        // pass, so it cannot bank credit while it has nothing to run.
+        void post(std::function<void()> fn, WorkClass cls = WorkClass::Interactive) {
+            const auto k = static_cast<std::size_t>(cls);
+            {
+                std::lock_guard<std::mutex> lk(mu_);
+                if (queues_[k].empty()) pass_[k] = std::max(pass_[k], now_pass_);
+                queues_[k].push_back(std::move(fn));
+            }
+            std::uint64_t one = 1;
+            ssize_t n = write(wake_fd_, &one, sizeof one);
+            (void)n;
+        }
+
+        void loop() {
+            std::vector<pollfd> fds;
+            std::vector<std::uint64_t> ids;
+            bool busy = false;   // queued work left over from the last drain
+            while (!stop_) {
+                const bool acceptor = index_ == 0 && server_.listen_fd_ >= 0;
+                fds.assign({ { wake_fd_, POLLIN, 0 } });
+                if (acceptor) fds.push_back({ server_.listen_fd_, POLLIN, 0 });
+                const std::size_t base = fds.size();
+                ids.clear();
+                for (const auto& kv : conns_) {
+                    const Conn& c = kv.second;
+                    fds.push_back({ c.fd, static_cast<short>((c.eof ? 0 : POLLIN) | (c.out.empty() ? 0 : POLLOUT)), 0 });
+                    ids.push_back(kv.first);
+                }
+                if (::poll(fds.data(), fds.size(), busy ? 0 : -1) < 0) { if (errno == EINTR) continue; break; }
+                if (fds[0].revents || busy) busy = drain_();
+                if (acceptor && (fds[1].revents & POLLIN)) accept_();
+                for (std::size_t i=0;i<ids.size();++i) {
+                    auto it = conns_.find(ids[i]);
+                    if (it == conns_.end()) continue;
+                    Conn& c = it->second;
+                    short ev = fds[base+i].revents;
+                    if ((ev & POLLIN) && !read_(ids[i], c)) c.closed = true;
+                    // POLLHUP: the peer is gone both ways, so nothing pending
+                    // can be delivered. Without this the fd would report
+                    // POLLHUP on every poll while responses are outstanding.
+                    if (ev & (POLLHUP | POLLERR)) c.closed = true;
+                    settle_(c);
+                }
+                for (auto it = conns_.begin(); it != conns_.end(); ) {
+                    if (it->second.closed) { drop_(it->second); it = conns_.erase(it); }
+                    else ++it;
+                }
+            }
+        }
+
+    private:
+        friend class ExpenseServer;
+        struct Conn {
+            int fd{-1};
+            std::string in, out;
+            std::size_t sent{0};   // bytes of out already written
+            // Responses not yet sent, in request order; empty until computed.
+            std::deque<std::optional<std::string>> pending;
+            std::uint64_t first_seq{0};   // request number of pending.front()
+            std::size_t tagged{0};   // tagged requests not yet answered
+            bool shm{false}, eof{false}, closed{false};
+            std::set<std::string> regions;
+            std::unordered_map<std::string, std::shared_ptr<QueryBudget>> running;  // tagged queries
+            std::unordered_map<std::uint64_t, std::shared_ptr<QueryBudget>> inflight;  // untagged, by seq
+        };
+        // Where a response goes: the in-order slot seq, or straight out
+        // under its tag.
+        struct Ticket {
+            std::uint64_t conn, seq;
+            std::string tag;
+        };
+        // Adds for this shard's months read by another shard, which is
+        // answered once they are applied.
+        struct AddBatch {
+            Shard* origin;
+            std::vector<Expense> rows;
+            std::vector<Ticket> tickets;
+        };
+        // A query fanned out to every shard, collected on its origin shard.
+        struct Gather {
+            Ticket to;
+            WorkClass cls;
+            std::shared_ptr<QueryBudget> budget;
+            std::string text, err;
+            std::vector<QueryResult> parts;
+            std::size_t remaining;
+        };
+        // An export: every shard copies its rows in slices, then the
+        // background thread writes the file.
+        struct Export {
+            Ticket to;
+            std::string path;
+            bool reloaded{false};
+            std::vector<std::vector<Expense>> parts;
+            std::size_t remaining;
+        };
+
+        ExpenseServer& server_;
+        const std::size_t index_;
+        std::unique_ptr<ExpenseManager> mgr_;
+        std::atomic<std::uint64_t> generation_{0};   // bumped whenever mgr_ is replaced
+        std::string journal_;   // this partition's journal, kept across reloads
+        QueryCache queries_;
+        int wake_fd_;
+        std::mutex mu_;
+        std::array<std::deque<std::function<void()>>, kWorkClasses> queues_;   // guarded by mu_
+        std::array<std::uint64_t, kWorkClasses> pass_{};                        // guarded by mu_
+        std::uint64_t now_pass_{0};                                            // guarded by mu_
+        std::array<std::deque<std::function<void()>>, kWorkClasses> waiting_;  // not yet admitted
+        bool stop_{false};
+        std::unordered_map<std::uint64_t, Conn> conns_;
+        std::vector<std::pair<Ticket, Expense>> adds_;   // adds read but not yet applied
+        std::mutex inbox_mu_;
+        std::vector<AddBatch> inbox_;   // guarded by inbox_mu_: adds other shards sent here
+        std::uint64_t next_conn_{0}, next_region_{0};
+        std::size_t next_shard_{0};
+
+        // Runs queued work for up to kDrainBudget. The next task comes from
+        // the non-empty class with the lowest pass, which then advances by
+        // the inverse of its weight. Returns true if work is left.
+        bool drain_() {
+            std::uint64_t n;
+            while (read(wake_fd_, &n, sizeof n) > 0) {}
+            const auto until = std::chrono::steady_clock::now() + kDrainBudget;
+            while (!stop_) {
+                std::function<void()> fn;
+                {
+                    std::lock_guard<std::mutex> lk(mu_);
+                    std::size_t pick = kWorkClasses;
+                    for (std::size_t k=0;k<kWorkClasses;++k) {
+                        if (!queues_[k].empty() && (pick == kWorkClasses || pass_[k] < pass_[pick])) pick = k;
+                    }
+                    if (pick == kWorkClasses) return false;
+                    fn = std::move(queues_[pick].front());
+                    queues_[pick].pop_front();
+                    now_pass_ = pass_[pick];
+                    pass_[pick] += 1680 / kWorkPolicy[pick].weight;   // 1680 divides evenly by every weight
+                }
+                fn();
+                if (std::chrono::steady_clock::now() >= until) return true;
+            }
+            return false;
+        }
+        // Starts start() now if its class has a free slot server-wide,
+        // otherwise parks it until one frees, or refuses it when the
+        // class's wait queue is full. Returns false if it was refused.
+        bool admit_(WorkClass cls, const Ticket& t, std::function<void()> start) {
+            auto& q = waiting_[static_cast<std::size_t>(cls)];
+            if (q.empty() && server_.acquire_(cls)) { start(); return true; }
+            if (q.size() >= kWorkPolicy[static_cast<std::size_t>(cls)].waiting) { complete_(t, "err busy\n"); return false; }
+            q.push_back(std::move(start));
+            return true;
+        }
+        void readmit_(WorkClass cls) {
+            auto& q = waiting_[static_cast<std::size_t>(cls)];
+            while (!q.empty() && server_.acquire_(cls)) {
+                auto start = std::move(q.front());
+                q.pop_front();
+                start();
+            }
+        }
+
+        // Hands new connections to the shards in turn.
+        void accept_() {
+            while (true) {
+                int fd = accept4(server_.listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) return;
+                Shard* target = server_.shards_[next_shard_++ % server_.shards_.size()].get();
+                if (target == this) adopt_(fd);
+                else target->post([target, fd] { target->adopt_(fd); });
+            }
+        }
+        void adopt_(int fd) {
+            if (stop_) { close(fd); return; }
+            Conn c; c.fd = fd;
+            conns_.emplace(next_conn_++, std::move(c));
+        }
+        // Nobody will read what a departed client's queries produce.
+        void drop_(Conn& c) {
+            cancel_queries_(c);
+            for (const auto& name : c.regions) shm_unlink(name.c_str());
+            c.regions.clear();
+            if (c.fd >= 0) close(c.fd);
+            c.fd = -1;
+        }
+        void cancel_queries_(Conn& c) {
+            for (auto& kv : c.running) kv.second->cancel();
+            for (auto& kv : c.inflight) kv.second->cancel();
+            c.running.clear(); c.inflight.clear();
+        }
+        // Reads what is available and handles every complete line. Returns
+        // false on a read error or an overlong line; at end of input sets
+        // eof, so the connection closes once its responses are sent.
+        bool read_(std::uint64_t id, Conn& c) {
+            char buf[65536];
+            while (true) {
+                ssize_t n = ::read(c.fd, buf, sizeof buf);
+                if (n > 0) { c.in.append(buf, static_cast<std::size_t>(n)); continue; }
+                if (n < 0 && errno == EINTR) continue;
+                if (n == 0) c.eof = true;
+                else if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                std::size_t start = 0, nl;
+                while ((nl = c.in.find('\n', start)) != std::string::npos) {
+                    std::string line = c.in.substr(start, nl - start);
+                    if (!line.empty() && line.back() == '\r') line.pop_back();
+                    handle_(id, c, std::move(line));
+                    start = nl + 1;
+                }
+                flush_adds_();
+                c.in.erase(0, start);
+                return c.in.size() <= kMaxRequestLine;
+            }
+        }
+        bool flush_(Conn& c) {
+            while (c.sent < c.out.size()) {
+                ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+                if (n > 0) { c.sent += static_cast<std::size_t>(n); continue; }
+                if (n < 0 && errno == EINTR) continue;
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+            c.out.clear(); c.sent = 0;
+            return true;
+        }
+        // Moves finished responses to the output in order and writes them.
+        void settle_(Conn& c) {
+            while (!c.pending.empty() && c.pending.front()) {
+                c.out += *c.pending.front();
+                c.pending.pop_front(); ++c.first_seq;
+            }
+            if (!c.closed && !c.out.empty() && !flush_(c)) c.closed = true;
+            if (c.eof && c.out.empty() && c.pending.empty() && !c.tagged) c.closed = true;
+        }
+        void complete_(const Ticket& t, std::string response) {
+            auto it = conns_.find(t.conn);
+            if (it == conns_.end()) return;  // the client has gone
+            Conn& c = it->second;
+            if (t.tag.empty()) c.pending[t.seq - c.first_seq] = std::move(response);
+            else { c.out += '#' + t.tag + ' ' + response; --c.tagged; }
+            settle_(c);
+        }
+
+        void handle_(std::uint64_t id, Conn& c, std::string line) {
+            Ticket t{ id, 0, std::string() };
+            if (!line.empty() && line[0] == '#') {
+                auto sp = line.find(' ');
+                t.tag = line.substr(1, sp == std::string::npos ? sp : sp - 1);
+                line.erase(0, sp == std::string::npos ? line.size() : sp + 1);
+            }
+            if (t.tag.empty()) { t.seq = c.first_seq + c.pending.size(); c.pending.emplace_back(); }
+            else ++c.tagged;
+            auto sp = line.find(' ');
+            std::string verb = line.substr(0, sp), arg = sp == std::string::npos ? std::string() : line.substr(sp + 1);
+            if (verb == "add") {
+                std::vector<Expense> rows;
+                parse_csv_line(arg, rows);
+                if (rows.size() != 1) complete_(t, "err invalid row\n");
+                else adds_.emplace_back(std::move(t), std::move(rows[0]));
+                return;
+            }
+            flush_adds_();  // later requests see earlier adds
+            if (verb == "ping") {
+                complete_(t, "ok pong\n");
+            } else if (verb == "query" || verb == "summary") {
+                fan_out_(std::move(t), verb == "summary" ? "group by category sum amount" : arg);
+            } else if (verb == "export" && !arg.empty()) {
+                auto x = std::make_shared<Export>();
+                x->to = std::move(t); x->path = arg;
+                admit_(WorkClass::Bulk, x->to, [this, x] { start_export_(x); });
+            } else if (verb == "reload" && !arg.empty()) {
+                admit_(WorkClass::Maintenance, t, [this, t, arg] { start_reload_(t, arg); });
+            } else if (verb == "shm" && (arg == "on" || arg == "off")) {
+                c.shm = arg == "on";
+                complete_(t, "ok\n");
+            } else if (verb == "cancel") {
+                auto it = c.running.find(arg);
+                if (it == c.running.end()) { complete_(t, "err no running query " + arg + "\n"); return; }
+                it->second->cancel();
+                complete_(t, "ok\n");
+            } else if (verb == "release") {
+                if (c.regions.erase(arg)) { shm_unlink(arg.c_str()); complete_(t, "ok\n"); }
+                else complete_(t, "err unknown region\n");
+            } else {
+                complete_(t, "err unknown request\n");
+            }
+        }
+        // Applies the pending adds as one batch per owning shard, then
+        // answers them. A remote owner gets its batch through its add inbox
+        // rather than as a plain post: work of different classes does not
+        // run in posting order, so every query part, export and reload
+        // applies the inbox first and sees the adds sent before it.
+        void flush_adds_() {
+            if (adds_.empty()) return;
+            const std::size_t n = server_.shards_.size();
+            std::vector<std::vector<Expense>> rows(n);
+            std::vector<std::vector<Ticket>> tickets(n);
+            for (auto& a : adds_) {
+                std::size_t k = server_.owner_(a.second.date);
+                rows[k].push_back(std::move(a.second));
+                tickets[k].push_back(std::move(a.first));
+            }
+            adds_.clear();
+            for (std::size_t k=0;k<n;++k) {
+                if (rows[k].empty()) continue;
+                Shard* owner = server_.shards_[k].get();
+                if (owner == this) {
+                    mgr_->add_batch(std::move(rows[k]));
+                    const char* reply = add_reply_();
+                    for (const auto& t : tickets[k]) complete_(t, reply);
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lk(owner->inbox_mu_);
+                    owner->inbox_.push_back(AddBatch{ this, std::move(rows[k]), std::move(tickets[k]) });
+                }
+                owner->post([owner] { owner->apply_adds_(); });
+            }
+        }
+        // Applies the add batches other shards have delivered, in delivery
+        // order, and sends each origin its acknowledgements.
+        void apply_adds_() {
+            std::vector<AddBatch> batches;
+            {
+                std::lock_guard<std::mutex> lk(inbox_mu_);
+                batches.swap(inbox_);
+            }
+            for (auto& b : batches) {
+                mgr_->add_batch(std::move(b.rows));
+                b.origin->post([origin = b.origin, done = std::move(b.tickets), reply = add_reply_()] {
+                    for (const auto& t : done) origin->complete_(t, reply);
+                });
+            }
+        }
+        const char* add_reply_() const {
+            return mgr_->journal().failed() ? "err journal write failed\n" : "ok\n";
+        }
+
+        // Queries served from an index are interactive; scans are dashboard work.
+        void fan_out_(Ticket t, const std::string& text) {
+            std::string err;
+            auto q = queries_.get(text, err);
+            if (q && q->param_count()) err = "query parameters are not supported";
+            if (!q || !err.empty()) { complete_(t, "err " + err + "\n"); return; }
+            auto g = std::make_shared<Gather>();
+            g->cls = q->access() == QAccess::Scan ? WorkClass::Dashboard : WorkClass::Interactive;
+            g->budget = std::make_shared<QueryBudget>();
+            if (server_.query_timeout_.count()) g->budget->set_timeout(server_.query_timeout_);
+            if (server_.query_memory_) g->budget->set_memory_limit(server_.query_memory_);
+            Conn& c = conns_.at(t.conn);
+            if (t.tag.empty()) c.inflight[t.seq] = g->budget;
+            else c.running[t.tag] = g->budget;
+            g->to = std::move(t); g->text = text;
+            if (!admit_(g->cls, g->to, [this, g] { start_query_(g); })) untrack_(c, *g);
+        }
+        // Forgets an answered query's budget, unless a later query has
+        // taken over its tag.
+        static void untrack_(Conn& c, const Gather& g) {
+            if (g.to.tag.empty()) { c.inflight.erase(g.to.seq); return; }
+            auto r = c.running.find(g.to.tag);
+            if (r != c.running.end() && r->second == g.budget) c.running.erase(r);
+        }
+        void start_query_(std::shared_ptr<Gather> g) {
+            g->parts.resize(server_.shards_.size());
+            g->remaining = server_.shards_.size();
+            for (std::size_t k=0;k<server_.shards_.size();++k) {
+                Shard* s = server_.shards_[k].get();
+                s->post([s, origin = this, g, k] {
+                    // Runs on shard s: only its own cache and partition are used.
+                    s->apply_adds_();
+                    QueryResult part; std::string perr;
+                    auto sq = s->queries_.get(g->text, perr);
+                    if (sq) sq->execute_partial(*s->mgr_, {}, part, perr, g->budget.get());
+                    origin->post([origin, g, k, part = std::move(part), perr]() mutable {
+                        g->parts[k] = std::move(part);
+                        if (!perr.empty()) g->err = perr;
+                        if (--g->remaining == 0) origin->finish_(*g);
+                    }, g->cls);
+                }, g->cls);
+            }
+        }
+        void finish_(Gather& g) {
+            server_.release_(g.cls);
+            auto it = conns_.find(g.to.conn);
+            if (it == conns_.end()) return;
+            untrack_(it->second, g);
+            if (!g.err.empty()) { complete_(g.to, "err " + g.err + "\n"); return; }
+            std::string err;
+            auto q = queries_.get(g.text, err);
+            if (!q) { complete_(g.to, "err " + err + "\n"); return; }
+            QueryResult res = q->merge(std::move(g.parts));
+            Conn& c = it->second;
+            std::ostringstream out;
+            if (res.grouped) {
+                out << "groups " << res.groups.size() << '\n' << std::fixed << std::setprecision(2);
+                for (const auto& gr : res.groups) out << csv_escape(gr.key) << ',' << gr.count << ',' << gr.value << '\n';
+            } else if (c.shm && res.rows.size() >= kShmMinRows) {
+                std::string name = "/et-" + std::to_string(getpid()) + "-" + std::to_string(index_) + "-" + std::to_string(next_region_++);
+                std::size_t bytes = write_shm_arrow(name, res.rows);
+                if (!bytes) { complete_(g.to, "err cannot create shared memory\n"); return; }
+                c.regions.insert(name);
+                out << "shm " << name << ' ' << bytes << ' ' << res.rows.size() << '\n';
+            } else {
+                out << "rows " << res.rows.size() << '\n';
+                for (const auto& e : res.rows) write_csv_row(out, e);
+            }
+            complete_(g.to, out.str());
+        }
+
+        void start_export_(std::shared_ptr<Export> x) {
+            x->parts.resize(server_.shards_.size());
+            x->remaining = server_.shards_.size();
+            for (std::size_t k=0;k<server_.shards_.size();++k) {
+                Shard* s = server_.shards_[k].get();
+                const std::uint64_t gen = s->generation_.load();
+                s->post([s, origin = this, x, k, gen] {
+                    s->apply_adds_();
+                    s->export_slice_(origin, x, k, gen, 0);
+                }, WorkClass::Bulk);
+            }
+        }
+        // Copies one slice of this shard's rows and requeues the rest, so
+        // other work runs between slices. Rows added meanwhile are included;
+        // a reload since generation gen was read fails the export.
+        void export_slice_(Shard* origin, std::shared_ptr<Export> x, std::size_t k, std::uint64_t gen, std::size_t from) {
+            bool reloaded = generation_.load() != gen;
+            std::size_t to = reloaded ? from : std::min(mgr_->size(), from + kSliceRows);
+            if (from == 0) x->parts[k].reserve(mgr_->size());  // no regrowth copying inside a slice
+            for (std::size_t i=from;i<to;++i) x->parts[k].push_back(mgr_->at(i));
+            if (to < mgr_->size() && !reloaded) {
+                post([this, origin, x, k, gen, to] { export_slice_(origin, x, k, gen, to); }, WorkClass::Bulk);
+                return;
+            }
+            origin->post([origin, x, reloaded] {
+                if (reloaded) x->reloaded = true;
+                if (--x->remaining == 0) origin->write_export_(x);
+            }, WorkClass::Bulk);
+        }
+        void write_export_(std::shared_ptr<Export> x) {
+            if (x->reloaded) {
+                server_.release_(WorkClass::Bulk);
+                complete_(x->to, "err ledger reloaded during export\n");
+                return;
+            }
+            server_.background_([origin = this, x] {
+                std::vector<Expense> rows;
+                for (auto& p : x->parts) {
+                    std::move(p.begin(), p.end(), std::back_inserter(rows));
+                    std::vector<Expense>().swap(p);
+                }
+                bool ok = write_ledger_file(x->path, rows);
+                std::string response = ok ? "ok " + std::to_string(rows.size()) + "\n" : "err cannot write " + x->path + "\n";
+                origin->post([origin, x, response] {
+                    origin->server_.release_(WorkClass::Bulk);
+                    origin->complete_(x->to, response);
+                }, WorkClass::Bulk);
+            });
+        }
+
+        // Loading and indexing happen on the background thread; each shard
+        // then swaps in its new partition in one step.
+        void start_reload_(const Ticket& t, const std::string& path) {
+            server_.background_([origin = this, t, path] {
+                ExpenseServer& server = origin->server_;
+                ExpenseManager all;
+                std::string err;
+                bool ok = is_arrow_path(path) ? all.load_arrow(path, err) : all.load_csv(path);
+                if (!ok) {
+                    std::string response = "err cannot load " + path + (err.empty() ? "" : ": " + err) + "\n";
+                    origin->post([origin, t, response] {
+                        origin->server_.release_(WorkClass::Maintenance);
+                        origin->complete_(t, response);
+                    }, WorkClass::Maintenance);
+                    return;
+                }
+                const std::size_t n = server.shards_.size(), rows = all.size();
+                std::vector<std::vector<Expense>> parts(n);
+                for (auto& e : all.all()) parts[server.owner_(e.date)].push_back(std::move(e));
+                auto fresh = std::make_shared<std::vector<std::unique_ptr<ExpenseManager>>>();
+                for (auto& p : parts) {
+                    fresh->push_back(std::make_unique<ExpenseManager>());
+                    if (!p.empty()) fresh->back()->add_batch(std::move(p));
+                }
+                auto remaining = std::make_shared<std::size_t>(n);
+                for (std::size_t k=0;k<n;++k) {
+                    Shard* s = server.shards_[k].get();
+                    s->post([s, origin, t, fresh, k, remaining, rows] {
+                        // The old partition is freed on the background thread too.
+                        s->apply_adds_();
+                        std::shared_ptr<ExpenseManager> old(std::move(s->mgr_));
+                        s->mgr_ = std::move((*fresh)[k]);
+                        ++s->generation_;
+                        s->server_.background_([old] {});
+                        if (!s->journal_.empty()) s->mgr_->attach_journal(s->journal_);
+                        origin->post([origin, t, remaining, rows] {
+                            if (--*remaining) return;
+                            origin->server_.release_(WorkClass::Maintenance);
+                            origin->complete_(t, "ok " + std::to_string(rows) + "\n");
+                        }, WorkClass::Maintenance);
+                    }, WorkClass::Maintenance);
+                }
+            });
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::chrono::milliseconds query_timeout_{kQueryTimeout};
+    std::size_t query_memory_{kQueryMemory};
+    std::array<std::atomic<std::size_t>, kWorkClasses> running_{};
+    int listen_fd_{-1};
+    std::string path_;
+    std::mutex jobs_mu_;
+    std::condition_variable jobs_cv_;
+    std::deque<std::function<void()>> jobs_;   // guarded by jobs_mu_
+    bool stopping_{false};                      // guarded by jobs_mu_
+
+    std::size_t owner_(const Date& d) const {
+        return static_cast<std::size_t>(d.y * 12 + d.m - 1) % shards_.size();
     }
 
-    // Optional persistence
-    bool save_csv(const std::string& path) const {
-        std::ofstream f(path); if (!f) return false;
-        f << "date,amount,category,description\n";
-        for (const auto& e : expenses_) {
-            f << to_string(e.date) << ',' << e.amount << ','
-              << csv_escape(e.category) << ',' << csv_escape(e.description) << '\n';
+    bool acquire_(WorkClass cls) {
+        const auto k = static_cast<std::size_t>(cls);
+        const std::size_t limit = kWorkPolicy[k].running;
+        if (!limit) return true;
+        std::size_t cur = running_[k].load();
+        while (cur < limit) if (running_[k].compare_exchange_weak(cur, cur + 1)) return true;
+        return false;
+    }
+    // Frees a slot and lets every shard admit what it has waiting.
+    void release_(WorkClass cls) {
+        const auto k = static_cast<std::size_t>(cls);
+        if (!kWorkPolicy[k].running) return;
+        running_[k].fetch_sub(1);
+        for (auto& s : shards_) { Shard* sh = s.get(); sh->post([sh, cls] { sh->readmit_(cls); }); }
+    }
+
+    // File I/O for bulk and maintenance work runs on one background thread,
+    // off the shard loops. Jobs still queued at shutdown are dropped.
+    void background_(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lk(jobs_mu_);
+            jobs_.push_back(std::move(job));
+        }
+        jobs_cv_.notify_one();
+    }
+    void work_() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lk(jobs_mu_);
+                jobs_cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+                if (stopping_) return;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+};
+#endif
+
+#ifdef __linux__
+// ---- Load generator ----
+// `--loadgen <socket>` drives a running server from local client threads
+// for capacity planning and soak tests. Each client opens its own
+// connection and sends a weighted mix of synthetic requests, keeping up to
+// `pipeline` of them in flight. Every interval it prints throughput, latency
+// percentiles, errors and the server's resident memory (found through the
+// socket's peer pid). At the end it prints per-request totals and how much
+// the server grew after warm-up. With a growth limit set, a soak that grows
+// past it fails.
+struct LoadOptions {
+    std::string socket;
+    std::size_t clients{8}, pipeline{1};
+    std::chrono::seconds duration{10}, interval{1}, warmup{2};
+    // Relative weights of add, filter, search and summary requests.
+    std::array<unsigned, 4> mix{ { 40, 30, 20, 10 } };
+    std::optional<double> max_growth_mib;
+};
+
+class LoadGenerator {
+public:
+    static constexpr std::size_t kKinds = 4;
+    static constexpr const char* kKindNames[kKinds] = { "add", "filter", "search", "summary" };
+
+    explicit LoadGenerator(LoadOptions opt) : opt_(std::move(opt)), clients_(opt_.clients) {}
+
+    // Parses "add=W,filter=W,search=W,summary=W" in any order; kinds left
+    // out get weight 0. False on an unknown or repeated kind, a weight that
+    // is not a plain number up to kMaxWeight, or weights that are all 0.
+    static constexpr unsigned kMaxWeight = 1000000;
+    static bool parse_mix(const std::string& text, std::array<unsigned, kKinds>& mix) {
+        std::array<unsigned, kKinds> out{};
+        std::array<bool, kKinds> seen{};
+        std::istringstream ss(text);
+        std::string item;
+        unsigned total = 0;
+        while (std::getline(ss, item, ',')) {
+            auto eq = item.find('=');
+            if (eq == std::string::npos) return false;
+            std::size_t k = 0;
+            while (k < kKinds && item.compare(0, eq, kKindNames[k]) != 0) ++k;
+            const std::string w = item.substr(eq + 1);
+            if (k == kKinds || seen[k] || w.empty() || w.size() > 7 ||
+                w.find_first_not_of("0123456789") != std::string::npos) return false;
+            out[k] = static_cast<unsigned>(std::stoul(w));
+            if (out[k] > kMaxWeight) return false;
+            seen[k] = true;
+            total += out[k];
         }
+        if (!total) return false;
+        mix = out;
         return true;
     }
-    bool load_csv(const std::string& path) {
-        std::ifstream f(path); if (!f) return false;
-        std::string line; expenses_.clear();
-        if (std::getline(f,line)) {
-            if (line.rfind("date,amount,category,description",0)!=0) parse_csv_line(line);
+
+    // Runs the load and prints the report. Returns false on a failed soak or
+    // if no client could connect.
+    bool run(std::ostream& out) {
+        int probe = connect_();
+        if (probe < 0) { out << "Cannot connect to " << opt_.socket << '\n'; return false; }
+        server_pid_ = peer_pid_(probe);
+        close(probe);
+
+        std::vector<std::thread> threads;
+        for (std::size_t i=0;i<clients_.size();++i) threads.emplace_back([this, i] { client_(i); });
+        out << std::setw(6) << "t(s)" << std::setw(10) << "req/s" << std::setw(9) << "p50ms" << std::setw(9) << "p95ms"
+            << std::setw(9) << "p99ms" << std::setw(9) << "maxms" << std::setw(8) << "errors" << std::setw(10) << "rss(MiB)" << '\n';
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::pair<double, double>> rss;   // (seconds, MiB) after warm-up
+        std::optional<double> rss_start = rss_mib_();
+        for (auto next = start + opt_.interval; next <= start + opt_.duration; next += opt_.interval) {
+            std::this_thread::sleep_until(next);
+            Sample s = collect_();
+            const double t = std::chrono::duration<double>(next - start).count();
+            const double secs = std::chrono::duration<double>(opt_.interval).count();
+            auto mib = rss_mib_();
+            if (mib && next - start > opt_.warmup) rss.emplace_back(t, *mib);
+            std::sort(s.all.begin(), s.all.end());
+            out << std::setw(6) << std::fixed << std::setprecision(0) << t
+                << std::setw(10) << static_cast<double>(s.all.size()) / secs << std::setprecision(2)
+                << std::setw(9) << percentile_(s.all, 0.50) << std::setw(9) << percentile_(s.all, 0.95)
+                << std::setw(9) << percentile_(s.all, 0.99) << std::setw(9) << (s.all.empty() ? 0.0 : s.all.back())
+                << std::setw(8) << s.errors << std::setw(10) << std::setprecision(1);
+            if (mib) out << *mib; else out << '-';
+            out << std::endl;
+        }
+        stop_ = true;
+        for (auto& t : threads) t.join();
+
+        out << std::setw(9) << "request" << std::setw(10) << "count" << std::setw(9) << "p50ms"
+            << std::setw(9) << "p99ms" << std::setw(9) << "maxms" << std::setw(8) << "errors" << '\n';
+        std::size_t connected = 0;
+        for (std::size_t k=0;k<kKinds;++k) {
+            std::vector<double> lat;
+            std::size_t errors = 0;
+            for (auto& c : clients_) {
+                std::lock_guard<std::mutex> lk(c.mu);
+                lat.insert(lat.end(), c.total[k].begin(), c.total[k].end());
+                errors += c.total_errors[k];
+            }
+            std::sort(lat.begin(), lat.end());
+            out << std::setw(9) << kKindNames[k] << std::setw(10) << lat.size() << std::setprecision(2)
+                << std::setw(9) << percentile_(lat, 0.50) << std::setw(9) << percentile_(lat, 0.99)
+                << std::setw(9) << (lat.empty() ? 0.0 : lat.back()) << std::setw(8) << errors << '\n';
+        }
+        for (auto& c : clients_) connected += c.connected;
+        if (!connected) { out << "No client could connect.\n"; return false; }
+
+        if (!rss_start || rss.size() < 2) { out << "Server memory: not available\n"; return true; }
+        const double growth = rss.back().second - rss.front().second, slope = slope_(rss) * 60.0;
+        out << std::setprecision(1) << "Server memory: " << *rss_start << " MiB at start, " << rss.back().second
+            << " MiB at end; " << growth << " MiB after warm-up (" << slope << " MiB/min)\n";
+        if (opt_.max_growth_mib && growth > *opt_.max_growth_mib) {
+            out << "Memory grew past the " << *opt_.max_growth_mib << " MiB limit.\n";
+            return false;
         }
-        while (std::getline(f,line)) parse_csv_line(line);
         return true;
     }
 
 private:
-    std::vector<Expense> expenses_;
+    // Latencies in milliseconds. The reporter swaps out `interval` every
+    // tick; `total` keeps everything for the final table.
+    struct Client {
+        std::mutex mu;
+        std::vector<double> interval;
+        std::size_t interval_errors{0};
+        std::array<std::vector<double>, kKinds> total;
+        std::array<std::size_t, kKinds> total_errors{};
+        bool connected{false};
+    };
+    struct Sample {
+        std::vector<double> all;
+        std::size_t errors{0};
+    };
 
-    void parse_csv_line(const std::string& line) {
-        std::vector<std::string> cols; csv_split_line(line, cols);
-        if (cols.size() < 4) return;
-        auto d = parse_date(cols[0]); if (!d) return;
-        double amt=0.0; try { amt = std::stod(cols[1]); } catch (...) { return; }
-        Expense e{ *d, amt, csv_unescape(cols[2]), csv_unescape(cols[3]) };
-        expenses_.push_back(std::move(e));
+    LoadOptions opt_;
+    std::vector<Client> clients_;
+    std::atomic<bool> stop_{false};
+    pid_t server_pid_{0};
+
+    int connect_() const {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (opt_.socket.size() >= sizeof addr.sun_path) return -1;
+        std::memcpy(addr.sun_path, opt_.socket.c_str(), opt_.socket.size() + 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) { close(fd); fd = -1; }
+        return fd;
+    }
+    static pid_t peer_pid_(int fd) {
+        ucred cred{};
+        socklen_t len = sizeof cred;
+        return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ? cred.pid : 0;
+    }
+    std::optional<double> rss_mib_() const {
+        if (!server_pid_) return std::nullopt;
+        std::ifstream f("/proc/" + std::to_string(server_pid_) + "/status");
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) return std::stod(line.substr(6)) / 1024.0;
+        }
+        return std::nullopt;
+    }
+    static double percentile_(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0.0;
+        return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * static_cast<double>(sorted.size())))];
+    }
+    // Least-squares slope of MiB over seconds.
+    static double slope_(const std::vector<std::pair<double, double>>& pts) {
+        double n = static_cast<double>(pts.size()), sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (const auto& p : pts) { sx += p.first; sy += p.second; sxx += p.first * p.first; sxy += p.first * p.second; }
+        double d = n * sxx - sx * sx;
+        return d == 0 ? 0.0 : (n * sxy - sx * sy) / d;
+    }
+    Sample collect_() {
+        Sample s;
+        for (auto& c : clients_) {
+            std::lock_guard<std::mutex> lk(c.mu);
+            s.all.insert(s.all.end(), c.interval.begin(), c.interval.end());
+            c.interval.clear();
+            s.errors += c.interval_errors;
+            c.interval_errors = 0;
+        }
+        return s;
+    }
+
+    static std::string request_(std::size_t kind, std::mt19937_64& rng) {
+        static const char* kCats[] = { "food/groceries", "food/dining", "travel/flights", "travel/hotels",
+                                       "rent", "utilities", "transport", "health", "fun", "gifts" };
+        auto pick = [&](std::size_t n) { return static_cast<std::size_t>(rng() % n); };
+        auto date = [&] {
+            Date d{ 2020 + static_cast<int>(pick(6)), 1 + static_cast<int>(pick(12)), 1 + static_cast<int>(pick(28)) };
+            return to_string(d);
+        };
+        switch (kind) {
+            case 0: {
+                std::ostringstream s;
+                s << "add " << date() << ',' << pick(50000) / 100.0 << ',' << kCats[pick(10)] << ",merchant " << pick(5000);
+                return s.str();
+            }
+            case 1:
+                if (pick(2)) {
+                    std::string a = date(), b = date();
+                    if (b < a) std::swap(a, b);
+                    return "query where category=" + std::string(kCats[pick(10)]) + " and date>=" + a + " and date<=" + b + " limit 50";
+                } else {
+                    std::size_t lo = pick(500);
+                    return "query where amount>=" + std::to_string(lo) + " and amount<=" + std::to_string(lo + 1) + " limit 50";
+                }
+            case 2: return "query where desc~\"merchant " + std::to_string(pick(5000)) + "\" limit 50";
+            default: return "summary";
+        }
+    }
+
+    void client_(std::size_t index) {
+        Client& me = clients_[index];
+        int fd = connect_();
+        if (fd < 0) return;
+        me.connected = true;
+        std::mt19937_64 rng(index * 0x9E3779B97F4A7C15ull + 1);
+        std::array<unsigned, kKinds> cum{};
+        unsigned sum = 0;
+        for (std::size_t k=0;k<kKinds;++k) cum[k] = sum += opt_.mix[k];
+        struct Sent { std::size_t kind; std::chrono::steady_clock::time_point at; };
+        std::deque<Sent> inflight;
+        std::string in;
+        std::size_t pos = 0;
+        // Next complete line from the socket, or nullopt at end of stream.
+        auto line = [&]() -> std::optional<std::string> {
+            while (true) {
+                auto nl = in.find('\n', pos);
+                if (nl != std::string::npos) { std::string l = in.substr(pos, nl - pos); pos = nl + 1; return l; }
+                in.erase(0, pos); pos = 0;
+                char buf[65536];
+                ssize_t n = ::read(fd, buf, sizeof buf);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return std::nullopt;
+                in.append(buf, static_cast<std::size_t>(n));
+            }
+        };
+        while (!stop_ || !inflight.empty()) {
+            std::string batch;
+            while (!stop_ && inflight.size() < opt_.pipeline) {
+                unsigned r = sum ? static_cast<unsigned>(rng() % sum) : 0;
+                std::size_t kind = 0;
+                while (kind + 1 < kKinds && r >= cum[kind]) ++kind;
+                batch += request_(kind, rng) + '\n';
+                inflight.push_back({ kind, std::chrono::steady_clock::now() });
+            }
+            if (!batch.empty() && send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(batch.size())) break;
+            if (inflight.empty()) break;
+            auto head = line();
+            if (!head) break;
+            std::istringstream hs(*head);
+            std::string status; std::size_t n = 0;
+            hs >> status >> n;
+            if (status == "rows" || status == "groups") for (std::size_t i=0;i<n;++i) if (!line()) break;
+            const Sent s = inflight.front();
+            inflight.pop_front();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s.at).count();
+            std::lock_guard<std::mutex> lk(me.mu);
+            me.interval.push_back(ms);
+            me.total[s.kind].push_back(ms);
+            if (status == "err") { ++me.interval_errors; ++me.total_errors[s.kind]; }
+        }
+        close(fd);
     }
 };
+#endif
 
 // ---- UI helpers ----
 inline void print_header() {
@@ -172,6 +5142,11 @@ inline void print_row(const Expense& e, std::size_t idx) {
 inline std::string prompt_line(const std::string& label) {
     std::cout << label; std::string s; std::getline(std::cin, s); return s;
 }
+inline std::optional<std::size_t> prompt_index(const std::string& label, std::size_t n) {
+    std::string s = prompt_line(label);
+    try { std::size_t pos=0; auto v = std::stoul(s, &pos); if (pos==s.size() && v<n) return v; } catch (...) {}
+    return std::nullopt;
+}
 inline Date prompt_date(const std::string& label) {
     std::cout << label << " (YYYY-MM-DD): ";
     while (true) { std::string s; std::getline(std::cin, s); auto d = parse_date(s); if (d) return *d; std::cout << "Invalid date. Try again: "; }
@@ -187,13 +5162,426 @@ inline Expense prompt_expense() {
     return e;
 }
 
+inline RecurrenceRule prompt_recurrence() {
+    RecurrenceRule r;
+    std::cout << "First occurrence:\n";
+    Expense e = prompt_expense();
+    r.start = e.date; r.amount = e.amount; r.category = e.category; r.description = e.description;
+    while (true) {
+        std::string f = to_lower(prompt_line("Repeat (d)aily, (w)eekly, (m)onthly, (y)early: "));
+        if (f=="d") { r.freq = Freq::Daily; break; }
+        if (f=="w") { r.freq = Freq::Weekly; break; }
+        if (f=="m" || f.empty()) { r.freq = Freq::Monthly; break; }
+        if (f=="y") { r.freq = Freq::Yearly; break; }
+    }
+    std::string n = prompt_line("Every how many periods [1]: ");
+    try { if (!n.empty()) r.interval = std::max(1, std::stoi(n)); } catch (...) {}
+    while (true) {
+        std::string u = prompt_line("Until (YYYY-MM-DD, blank for no end): ");
+        if (u.empty()) break;
+        if (auto d = parse_date(u)) { r.until = *d; break; }
+        std::cout << "Invalid date. ";
+    }
+    return r;
+}
+inline std::optional<double> prompt_amount(const std::string& label) {
+    std::string s = prompt_line(label);
+    try { std::size_t pos=0; double v = std::stod(s, &pos); if (pos==s.size()) return v; } catch (...) {}
+    return std::nullopt;
+}
+// Optional date and category restrictions; blank answers leave them open.
+inline ExpenseFilter prompt_filter() {
+    ExpenseFilter f;
+    if (auto d = parse_date(prompt_line("  From (YYYY-MM-DD, blank for any): "))) f.from = *d;
+    if (auto d = parse_date(prompt_line("  To (YYYY-MM-DD, blank for any): "))) f.to = *d;
+    std::string cat = prompt_line("  Category (blank for any): ");
+    if (!cat.empty()) f.category = cat;
+    return f;
+}
+inline void print_list(const std::vector<Expense>& list, const char* total_label, double total) {
+    print_header();
+    for (std::size_t i=0;i<list.size();++i) print_row(list[i], i);
+    std::cout << total_label << ": " << std::fixed << std::setprecision(2) << total << '\n';
+}
+inline void print_groups(const std::vector<GroupRow>& groups) {
+    std::cout << " Key                  |  Count |      Value\n";
+    std::cout << "----------------------+--------+-----------\n";
+    for (const auto& g : groups) {
+        std::cout << ' ' << std::setw(20) << std::left << g.key << std::right << " | " << std::setw(6) << g.count
+                  << " | " << std::fixed << std::setprecision(2) << std::setw(10) << g.value << '\n';
+    }
+}
+inline void print_pivot(const PivotTable& pt) {
+    std::size_t nc = pt.categories.size();
+    std::cout << std::setw(10) << std::left << "Period" << std::right;
+    for (const auto& c : pt.categories) std::cout << " | " << std::setw(std::max<int>(10, static_cast<int>(c.size()))) << c;
+    std::cout << '\n';
+    for (std::size_t r=0;r<pt.periods.size();++r) {
+        std::cout << std::setw(10) << std::left << pt.periods[r] << std::right;
+        for (std::size_t c=0;c<nc;++c) {
+            std::cout << " | " << std::setw(std::max<int>(10, static_cast<int>(pt.categories[c].size())))
+                      << std::fixed << std::setprecision(2) << pt.sums[r*nc + c];
+        }
+        std::cout << '\n';
+    }
+}
+// While alive, Ctrl-C cancels the budget's scan instead of ending the program.
+class InterruptScope {
+public:
+    explicit InterruptScope(QueryBudget& b) { active_.store(&b); prev_ = std::signal(SIGINT, on_interrupt_); }
+    ~InterruptScope() { std::signal(SIGINT, prev_); active_.store(nullptr); }
+    InterruptScope(const InterruptScope&) = delete;
+    InterruptScope& operator=(const InterruptScope&) = delete;
+
+private:
+    static inline std::atomic<QueryBudget*> active_{nullptr};
+    void (*prev_)(int);
+    static void on_interrupt_(int) { if (auto* b = active_.load()) b->cancel(); }
+};
+// Runs scan(budget) under an InterruptScope. False, after saying so, if it was cancelled.
+template <class F>
+bool run_interruptible(F scan) {
+    QueryBudget budget;
+    {
+        InterruptScope scope(budget);
+        scan(&budget);
+    }
+    if (!budget.stopped()) return true;
+    std::cout << "Cancelled.\n";
+    return false;
+}
+// Menu entries 2-7 and 15-21 only read the ledger; they are shared with follower mode.
+// Returns false if `ch` is not one of them.
+inline bool handle_read_choice(const ExpenseManager& mgr, QueryCache& queries, const std::string& ch) {
+    if (ch=="2") {
+        auto list = mgr.all(); print_list(list, "Total", mgr.total(list));
+    } else if (ch=="3") {
+        Date from = prompt_date("From"), to = prompt_date("To");
+        if (!date_le(from, to)) { std::cout << "From must be <= To.\n"; return true; }
+        std::vector<Expense> list;
+        if (!run_interruptible([&](QueryBudget* b) { list = mgr.filter_by_date_range(from, to, b); })) return true;
+        print_list(list, "Range total", mgr.total(list));
+    } else if (ch=="4") {
+        std::string cat = prompt_line("Category: ");
+        std::vector<Expense> list;
+        if (!run_interruptible([&](QueryBudget* b) { list = mgr.filter_by_category(cat, b); })) return true;
+        print_list(list, "Category total", mgr.total(list));
+    } else if (ch=="5") {
+        std::string q = prompt_line("Search text: ");
+        std::vector<Expense> list;
+        if (!run_interruptible([&](QueryBudget* b) { list = mgr.search(q, b); })) return true;
+        print_list(list, "Search total", mgr.total(list));
+    } else if (ch=="6") {
+        auto list = mgr.all(); auto by = mgr.totals_by_category();
+        std::cout << "Totals by category:\n";
+        for (const auto& kv : by) {
+            std::cout << "  " << std::setw(12) << std::left << kv.first << " : "
+                      << std::fixed << std::setprecision(2) << kv.second << '\n';
+        }
+        std::cout << "Overall total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
+    } else if (ch=="7") {
+        std::string path = prompt_line("Save path (.csv, .arrow or .parquet): ");
+        bool ok = is_arrow_path(path) ? mgr.save_arrow(path)
+                : has_extension(path, ".parquet") ? mgr.save_parquet(path) : mgr.save_csv(path);
+        std::cout << (ok ? "Saved.\n" : "Failed to save.\n");
+    } else if (ch=="15") {
+        auto lo = prompt_amount("Minimum amount: ");
+        auto hi = prompt_amount("Maximum amount (blank for none): ");
+        if (!lo) { std::cout << "Invalid amount.\n"; return true; }
+        auto list = mgr.filter_by_amount(*lo, hi ? *hi : std::numeric_limits<double>::infinity(), prompt_filter());
+        print_list(list, "Amount range total", mgr.total(list));
+    } else if (ch=="16") {
+        auto n = prompt_index("How many: ", std::numeric_limits<std::size_t>::max());
+        if (!n) { std::cout << "Invalid count.\n"; return true; }
+        auto list = mgr.top_by_amount(*n, prompt_filter());
+        print_list(list, "Top total", mgr.total(list));
+    } else if (ch=="17") {
+        std::string cat = prompt_line("Category: ");
+        Date from = prompt_date("From"), to = prompt_date("To");
+        if (!date_le(from, to)) { std::cout << "From must be <= To.\n"; return true; }
+        auto list = mgr.filter_by_category_in_range(cat, from, to);
+        print_list(list, "Category range total", mgr.category_total_in_range(cat, from, to));
+    } else if (ch=="18") {
+        std::string text = prompt_line("Query: "), err;
+        auto q = queries.get(text, err);
+        if (!q) { std::cout << "Query error: " << err << '\n'; return true; }
+        std::vector<std::string> args;
+        for (std::size_t i=0;i<q->param_count();++i) args.push_back(prompt_line("  ?" + std::to_string(i+1) + " = "));
+        QueryResult res;
+        bool ok = false;
+        if (!run_interruptible([&](QueryBudget* b) { ok = q->execute(mgr, args, res, err, b); })) return true;
+        if (!ok) { std::cout << "Query error: " << err << '\n'; return true; }
+        std::cout << "(plan: " << q->access_name() << ")\n";
+        if (res.grouped) print_groups(res.groups);
+        else print_list(res.rows, "Query total", mgr.total(res.rows));
+    } else if (ch=="19") {
+        std::string per = to_lower(prompt_line("Rows by (m)onth or (w)eek [m]: "));
+        std::optional<Date> from, to;
+        if (auto d = parse_date(prompt_line("From (YYYY-MM-DD, blank for earliest): "))) from = *d;
+        if (auto d = parse_date(prompt_line("To (YYYY-MM-DD, blank for latest): "))) to = *d;
+        print_pivot(mgr.pivot(per=="w" ? PivotPeriod::Week : PivotPeriod::Month, from, to));
+    } else if (ch=="20") {
+        const auto& det = mgr.anomalies();
+        std::cout << det.flagged_count() << " row(s) flagged at " << det.threshold() << " sigma";
+        if (det.flags().size() < det.flagged_count()) std::cout << " (latest " << det.flags().size() << " shown)";
+        std::cout << ":\n";
+        for (const auto& f : det.flags()) {
+            std::cout << "  " << to_string(f.e.date) << ' ' << std::fixed << std::setprecision(2) << std::setw(10) << f.e.amount
+                      << "  " << f.e.category << "  " << f.e.description << "  (mean " << f.mean
+                      << ", z " << std::setprecision(1) << f.z << ")\n";
+        }
+    } else if (ch=="21") {
+        Date from = prompt_date("From"), to = prompt_date("To");
+        bool by_spend = to_lower(prompt_line("Rank by (s)pend or (f)requency [s]: ")) != "f";
+        auto top = mgr.top_merchants(from, to, 10, by_spend);
+        std::cout << "Top merchants by " << (by_spend ? "spend" : "frequency")
+                  << " (whole months; true value lies between low and high):\n";
+        for (const auto& h : top) {
+            std::cout << "  " << std::setw(28) << std::left << h.key << std::right << std::fixed << std::setprecision(2)
+                      << "  low " << std::setw(10) << h.estimate - h.error << "  high " << std::setw(10) << h.estimate << '\n';
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
 } // namespace et
 
-int main() {
+#ifndef ET_NO_MAIN
+// Prints the journal's records from a byte offset, one per line, then the
+// offset to resume from. This is the consumer end for scripts and reports.
+static int dump_changes(const std::string& path, std::uint64_t offset) {
+    et::ChangeCursor cur(path, offset);
+    std::vector<et::Change> batch;
+    while (cur.poll(batch, 64) > 0) {
+        for (const auto& c : batch) {
+            std::cout << c.seq << ' ' << et::change_kind_name(c.kind) << ' ' << c.row;
+            if (c.kind == et::ChangeKind::SetCategory) {
+                std::cout << ' ' << et::csv_escape(c.e.category);
+            } else if (c.kind == et::ChangeKind::DeleteRange) {
+                std::cout << ' ' << et::to_string(c.e.date) << ' ' << et::to_string(et::unpack_date(static_cast<std::int32_t>(c.row)));
+            } else if (c.kind != et::ChangeKind::Truncate && c.kind != et::ChangeKind::Reset) {
+                std::cout << ' ' << et::to_string(c.e.date) << ' ' << c.e.amount << ' '
+                          << et::csv_escape(c.e.category) << ' ' << et::csv_escape(c.e.description);
+            }
+            std::cout << '\n';
+        }
+        batch.clear();
+    }
+    if (cur.corrupt()) { std::cerr << "Journal is corrupt at offset " << cur.offset() << '\n'; return 1; }
+    std::cout << "next-offset " << cur.offset() << '\n';
+    return 0;
+}
+
+// Tails a CSV file until the user presses Enter, importing each batch of
+// completed lines as it is appended. Uses inotify where available.
+static void run_tail(et::ExpenseManager& mgr, et::CsvTail& tail) {
+    auto report = [&](std::size_t n) {
+        if (n) std::cout << "+" << n << " row(s) (offset " << tail.offset() << ", " << mgr.size() << " total)\n" << std::flush;
+    };
+    report(tail.poll(mgr));
+    if (tail.failed()) { std::cout << "Corrupt compressed data in " << tail.path() << ".\n"; return; }
+#ifdef __linux__
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, tail.path().c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+        std::cout << "Cannot watch " << tail.path() << ".\n";
+        if (fd >= 0) close(fd);
+        return;
+    }
+    std::cout << "Tailing " << tail.path() << "; press Enter to stop.\n" << std::flush;
+    bool done = false;
+    while (!done) {
+        if (std::cin.rdbuf()->in_avail() > 0) break;
+        pollfd fds[2] = { { fd, POLLIN, 0 }, { 0, POLLIN, 0 } };
+        if (::poll(fds, 2, -1) < 0) { if (errno == EINTR) continue; break; }
+        if (fds[1].revents) break;
+        if (!(fds[0].revents & POLLIN)) continue;
+        alignas(inotify_event) char buf[4096];
+        ssize_t len = read(fd, buf, sizeof buf);
+        for (ssize_t i = 0; i < len; ) {
+            const auto* ev = reinterpret_cast<const inotify_event*>(buf + i);
+            if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) done = true;
+            i += static_cast<ssize_t>(sizeof(inotify_event) + ev->len);
+        }
+        report(tail.poll(mgr));
+        if (tail.failed()) break;
+    }
+    close(fd);
+    if (tail.failed()) std::cout << "Corrupt compressed data in " << tail.path() << "; stopped tailing.\n";
+    else if (done) std::cout << "File was moved or deleted; stopped tailing.\n";
+    else { std::string line; std::getline(std::cin, line); }
+#else
+    std::cout << "Live tailing needs inotify (Linux); imported the current contents only.\n";
+#endif
+}
+
+// Read-only replica: replays the leader's journal into a local manager and
+// serves the read menu. Each query first applies every complete frame the
+// leader has committed, so answers lag the leader by at most one in-flight
+// operation.
+static int run_follower(const std::string& path) {
+    et::ExpenseManager mgr;
+    et::QueryCache queries;
+    et::ChangeCursor cur(path);
+    std::vector<et::Change> batch;
+    auto catch_up = [&]() -> bool {
+        while (cur.poll(batch, 64) > 0) {
+            for (const auto& c : batch) {
+                if (!mgr.apply_change(c)) {
+                    std::cerr << "Journal diverged at seq " << c.seq << '\n';
+                    return false;
+                }
+            }
+            batch.clear();
+        }
+        if (cur.corrupt()) { std::cerr << "Journal is corrupt at offset " << cur.offset() << '\n'; return false; }
+        return true;
+    };
+    if (!catch_up()) return 1;
+
+    while (true) {
+        std::cout << "\n==== Expense Tracker (follower of " << path << ") ====\n"
+                  << "2) View all\n"
+                  << "3) Filter by date range\n"
+                  << "4) Filter by category\n"
+                  << "5) Search (category/description)\n"
+                  << "6) Summary (totals by category & overall)\n"
+                  << "7) Save (CSV, Arrow or Parquet)\n"
+                  << "15) Filter by amount range\n"
+                  << "16) Largest expenses\n"
+                  << "17) Category within date range\n"
+                  << "18) Query\n"
+                  << "19) Pivot report (period x category)\n"
+                  << "20) Flagged unusual expenses\n"
+                  << "21) Top merchants\n"
+                  << "s) Replication status\n"
+                  << "q) Quit\n"
+                  << "Choose: ";
+        std::string ch;
+        if (!std::getline(std::cin, ch)) break;
+        if (!catch_up()) return 1;
+        if (ch=="s" || ch=="S") {
+            std::cout << "Rows: " << mgr.size() << ", journal offset: " << cur.offset() << '\n';
+        } else if (ch=="q" || ch=="Q") {
+            std::cout << "Bye!\n"; break;
+        } else if (!et::handle_read_choice(mgr, queries, ch)) {
+            std::cout << "Read-only follower; invalid choice.\n";
+        }
+    }
+    return 0;
+}
+
+#ifdef __linux__
+// Serves the ledger (optionally loaded from a CSV or Arrow file) to local
+// clients until interrupted, split over `shards` threads. With a journal
+// base, shard i streams its changes to <journal>.<i>.
+static int run_server(const std::string& socket_path, const std::string& ledger,
+                      const std::string& journal, std::size_t shards,
+                      std::optional<std::size_t> timeout_ms, std::optional<std::size_t> memory_mib) {
+    et::ExpenseManager mgr;
+    std::string err;
+    if (!ledger.empty()) {
+        bool ok = et::is_arrow_path(ledger) ? mgr.load_arrow(ledger, err) : mgr.load_csv(ledger);
+        if (!ok) { std::cerr << "Cannot load " << ledger << (err.empty() ? "" : ": " + err) << '\n'; return 1; }
+    }
+    const std::size_t rows = mgr.size();
+    et::ExpenseServer server(mgr.all(), shards);
+    server.set_query_limits(timeout_ms ? std::chrono::milliseconds(*timeout_ms) : et::kQueryTimeout,
+                            memory_mib ? *memory_mib << 20 : et::kQueryMemory);
+    if (!journal.empty() && !server.attach_journals(journal, err)) { std::cerr << err << '\n'; return 1; }
+    if (!server.listen(socket_path, err)) { std::cerr << "Cannot listen: " << err << '\n'; return 1; }
+    std::cerr << "Serving " << rows << " row(s) on " << socket_path << " with " << server.shard_count() << " shard(s)\n";
+    server.run();
+    return 0;
+}
+
+// Parses `--loadgen <socket> [options]` and drives the server; exit status 1
+// when the soak fails.
+static int run_loadgen(const std::vector<std::string>& args) {
+    const char* usage = "usage: --loadgen <socket> [--clients N] [--pipeline N] [--duration s] [--interval s]"
+                        " [--warmup s] [--mix add=W,filter=W,search=W,summary=W] [--max-growth MiB]\n";
+    et::LoadOptions opt;
+    auto number = [&](std::size_t& i, double& v) {
+        if (i+1 >= args.size()) return false;
+        try { std::size_t pos = 0; v = std::stod(args[++i], &pos); return pos == args[i].size() && v >= 0; } catch (...) { return false; }
+    };
+    for (std::size_t i=1;i<args.size();++i) {
+        const std::string& a = args[i];
+        double v = 0;
+        if (a=="--mix") {
+            if (i+1 >= args.size() || !et::LoadGenerator::parse_mix(args[++i], opt.mix)) { std::cerr << usage; return 2; }
+        } else if (a=="--clients" || a=="--pipeline") {
+            if (!number(i, v) || v < 1) { std::cerr << usage; return 2; }
+            (a=="--clients" ? opt.clients : opt.pipeline) = static_cast<std::size_t>(v);
+        } else if (a=="--duration" || a=="--interval" || a=="--warmup") {
+            if (!number(i, v)) { std::cerr << usage; return 2; }
+            (a=="--duration" ? opt.duration : a=="--interval" ? opt.interval : opt.warmup) = std::chrono::seconds(static_cast<long>(v));
+        } else if (a=="--max-growth") {
+            if (!number(i, v)) { std::cerr << usage; return 2; }
+            opt.max_growth_mib = v;
+        } else if (opt.socket.empty()) {
+            opt.socket = a;
+        } else {
+            std::cerr << usage; return 2;
+        }
+    }
+    if (opt.socket.empty() || opt.interval.count() < 1) { std::cerr << usage; return 2; }
+    et::LoadGenerator gen(std::move(opt));
+    return gen.run(std::cout) ? 0 : 1;
+}
+#endif
+
+int main(int argc, char** argv) {
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
 
-    et::ExpenseManager mgr; 
+    std::vector<std::string> args(argv+1, argv+argc);
+    if (!args.empty() && args[0]=="--changes") {
+        if (args.size() < 2) { std::cerr << "usage: --changes <journal> [offset]\n"; return 2; }
+        std::uint64_t off = 0;
+        if (args.size() > 2) { try { off = std::stoull(args[2]); } catch (...) { std::cerr << "Invalid offset.\n"; return 2; } }
+        return dump_changes(args[1], off);
+    }
+    if (!args.empty() && args[0]=="--follow") {
+        if (args.size() < 2) { std::cerr << "usage: --follow <journal>\n"; return 2; }
+        return run_follower(args[1]);
+    }
+    if (!args.empty() && args[0]=="--serve") {
+        const char* usage = "usage: --serve <socket> [ledger.csv|ledger.arrow] [--shards N] [--journal base]"
+                            " [--query-timeout ms] [--query-memory MiB]\n";
+        std::string socket_path, ledger, journal;
+        std::size_t shards = std::max(1u, std::thread::hardware_concurrency());
+        std::optional<std::size_t> timeout_ms, memory_mib;
+        for (std::size_t i=1;i<args.size();++i) {
+            if (args[i]=="--shards" && i+1 < args.size()) {
+                try { shards = std::stoul(args[++i]); } catch (...) { shards = 0; }
+                if (shards == 0 || shards > 1024) { std::cerr << "Invalid shard count.\n"; return 2; }
+            } else if ((args[i]=="--query-timeout" || args[i]=="--query-memory") && i+1 < args.size()) {
+                auto& v = args[i]=="--query-timeout" ? timeout_ms : memory_mib;
+                try { v = std::stoul(args[++i]); } catch (...) { std::cerr << "Invalid " << args[i-1] << ".\n"; return 2; }
+            } else if (args[i]=="--journal" && i+1 < args.size()) journal = args[++i];
+            else if (socket_path.empty()) socket_path = args[i];
+            else if (ledger.empty()) ledger = args[i];
+            else { std::cerr << usage; return 2; }
+        }
+        if (socket_path.empty()) { std::cerr << usage; return 2; }
+#ifdef __linux__
+        return run_server(socket_path, ledger, journal, shards, timeout_ms, memory_mib);
+#else
+        std::cerr << "Server mode needs Linux.\n"; return 2;
+#endif
+    }
+    if (!args.empty() && args[0]=="--loadgen") {
+#ifdef __linux__
+        return run_loadgen(args);
+#else
+        std::cerr << "Load generation needs Linux.\n"; return 2;
+#endif
+    }
+
+    et::ExpenseManager mgr;
+    et::QueryCache queries;
 
     while (true) {
         std::cout << "\n==== Expense Tracker (C++) ====\n"
@@ -203,53 +5591,124 @@ int main() {
                   << "4) Filter by category\n"
                   << "5) Search (category/description)\n"
                   << "6) Summary (totals by category & overall)\n"
-                  << "7) Save to CSV\n"
-                  << "8) Load from CSV\n"
+                  << "7) Save (CSV, Arrow or Parquet)\n"
+                  << "8) Load (CSV or Arrow)\n"
                   << "9) Quit\n"
+                  << "10) Edit expense\n"
+                  << "11) Delete expense\n"
+                  << "12) Attach change journal\n"
+                  << "13) Add recurring expense\n"
+                  << "14) Skip/override a recurring occurrence\n"
+                  << "15) Filter by amount range\n"
+                  << "16) Largest expenses\n"
+                  << "17) Category within date range\n"
+                  << "18) Query\n"
+                  << "19) Pivot report (period x category)\n"
+                  << "20) Flagged unusual expenses\n"
+                  << "21) Top merchants\n"
+                  << "22) Load categorization rules\n"
+                  << "23) Bulk recategorize (set category where ...)\n"
+                  << "24) Purge a date range\n"
+                  << "25) Apply retention (keep N years)\n"
+                  << "26) Tail a growing CSV file\n"
+                  << "27) Import CSV or Arrow (append)\n"
+                  << "u) Undo    r) Redo\n"
                   << "Choose: ";
         std::string ch; std::getline(std::cin, ch);
 
         if (ch=="1") {
-            auto e = et::prompt_expense(); mgr.add(e); std::cout << "Added.\n";
-        } else if (ch=="2") {
-            auto list = mgr.all(); et::print_header();
-            for (std::size_t i=0;i<list.size();++i) et::print_row(list[i], i);
-            std::cout << "Total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
-        } else if (ch=="3") {
+            auto e = et::prompt_expense();
+            auto flagged = mgr.anomalies().flagged_count();
+            mgr.add(e); std::cout << "Added.\n";
+            if (mgr.anomalies().flagged_count() != flagged) {
+                const auto& f = mgr.anomalies().flags().back();
+                std::cout << "Unusual for this category: " << std::fixed << std::setprecision(1)
+                          << f.z << " sigma from its typical " << std::setprecision(2) << f.mean << ".\n";
+            }
+        } else if (ch=="8") {
+            std::string path = et::prompt_line("Load path (.csv or .arrow): "), err;
+            if (et::is_arrow_path(path)) {
+                if (mgr.load_arrow(path, err)) std::cout << "Loaded.\n";
+                else std::cout << "Failed to load: " << err << '\n';
+            } else {
+                std::cout << (mgr.load_csv(path) ? "Loaded.\n" : "Failed to load.\n");
+            }
+        } else if (ch=="10") {
+            auto idx = et::prompt_index("ID to edit: ", mgr.size());
+            if (!idx) { std::cout << "Invalid ID.\n"; continue; }
+            auto e = et::prompt_expense(); mgr.edit(*idx, e); std::cout << "Updated.\n";
+        } else if (ch=="11") {
+            auto idx = et::prompt_index("ID to delete: ", mgr.size());
+            if (!idx) { std::cout << "Invalid ID.\n"; continue; }
+            mgr.remove(*idx); std::cout << "Deleted.\n";
+        } else if (ch=="12") {
+            std::string path = et::prompt_line("Journal path (e.g., expenses.journal): ");
+            std::cout << (mgr.attach_journal(path) ? "Journaling.\n" : "Failed to open journal.\n");
+        } else if (ch=="13") {
+            auto id = mgr.add_recurring(et::prompt_recurrence());
+            std::cout << "Added recurring rule " << id << ".\n";
+        } else if (ch=="14") {
+            const auto& rules = mgr.recurring();
+            for (std::size_t i=0;i<rules.size();++i) {
+                std::cout << std::setw(4) << i << " | from " << et::to_string(rules[i].start)
+                          << " | " << std::fixed << std::setprecision(2) << std::setw(10) << rules[i].amount
+                          << " | " << rules[i].category << " | " << rules[i].description << '\n';
+            }
+            auto id = et::prompt_index("Rule ID: ", rules.size());
+            if (!id) { std::cout << "Invalid rule.\n"; continue; }
+            et::Date on = et::prompt_date("Occurrence date");
+            std::string how = et::to_lower(et::prompt_line("(s)kip or (o)verride? "));
+            bool ok;
+            if (how=="o") { std::cout << "Replacement:\n"; ok = mgr.override_occurrence(*id, on, et::prompt_expense()); }
+            else ok = mgr.skip_occurrence(*id, on);
+            std::cout << (ok ? "Done.\n" : "No occurrence on that date.\n");
+        } else if (ch=="22") {
+            std::string path = et::prompt_line("Rules CSV path (keyword,category per line): ");
+            et::CategoryRules rules;
+            if (!rules.load(path)) { std::cout << "Failed to load rules.\n"; continue; }
+            std::size_t n = rules.size();
+            mgr.set_rules(std::move(rules));
+            std::cout << "Loaded " << n << " rule(s).\n";
+        } else if (ch=="23") {
+            std::string cat = et::prompt_line("New category: ");
+            std::string where = et::prompt_line("Rows (e.g., where desc~\"uber\"): "), err;
+            if (cat.empty()) { std::cout << "Category is required.\n"; continue; }
+            auto n = et::update_category_where(mgr, where, cat, err);
+            if (!n) std::cout << "Query error: " << err << '\n';
+            else std::cout << "Recategorized " << *n << " row(s).\n";
+        } else if (ch=="24") {
             et::Date from = et::prompt_date("From"), to = et::prompt_date("To");
             if (!et::date_le(from, to)) { std::cout << "From must be <= To.\n"; continue; }
-            auto list = mgr.filter_by_date_range(from, to); et::print_header();
-            for (std::size_t i=0;i<list.size();++i) et::print_row(list[i], i);
-            std::cout << "Range total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
-        } else if (ch=="4") {
-            std::string cat = et::prompt_line("Category: ");
-            auto list = mgr.filter_by_category(cat); et::print_header();
-            for (std::size_t i=0;i<list.size();++i) et::print_row(list[i], i);
-            std::cout << "Category total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
-        } else if (ch=="5") {
-            std::string q = et::prompt_line("Search text: ");
-            auto list = mgr.search(q); et::print_header();
-            for (std::size_t i=0;i<list.size();++i) et::print_row(list[i], i);
-            std::cout << "Search total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
-        } else if (ch=="6") {
-            auto list = mgr.all(); auto by = mgr.totals_by_category(list);
-            std::cout << "Totals by category:\n";
-            for (const auto& kv : by) {
-                std::cout << "  " << std::setw(12) << std::left << kv.first << " : "
-                          << std::fixed << std::setprecision(2) << kv.second << '\n';
-            }
-            std::cout << "Overall total: " << std::fixed << std::setprecision(2) << mgr.total(list) << '\n';
-        } else if (ch=="7") {
-            std::string path = et::prompt_line("Save CSV path (e.g., expenses.csv): ");
-            std::cout << (mgr.save_csv(path) ? "Saved.\n" : "Failed to save.\n");
-        } else if (ch=="8") {
-            std::string path = et::prompt_line("Load CSV path: ");
-            std::cout << (mgr.load_csv(path) ? "Loaded.\n" : "Failed to load.\n");
+            std::cout << "Purged " << mgr.remove_date_range(from, to) << " row(s); undo history cleared.\n";
+        } else if (ch=="25") {
+            std::string s = et::prompt_line("Years to keep: ");
+            int years = 0;
+            try { years = std::stoi(s); } catch (...) {}
+            if (years < 1) { std::cout << "Invalid number of years.\n"; continue; }
+            std::cout << "Purged " << mgr.apply_retention(years, et::today()) << " row(s); undo history cleared.\n";
+        } else if (ch=="26") {
+            et::CsvTail tail(et::prompt_line("CSV path to tail: "));
+            if (!tail.readable()) { std::cout << "Cannot open file.\n"; continue; }
+            if (et::to_lower(et::prompt_line("Import existing rows too? (y/n) [n]: ")) != "y") tail.seek_to_end();
+            run_tail(mgr, tail);
+        } else if (ch=="27") {
+            std::string path = et::prompt_line("Import path (.csv or .arrow): "), err;
+            if (et::is_arrow_path(path)) {
+                if (mgr.import_arrow(path, err)) std::cout << "Imported.\n";
+                else std::cout << "Failed to import: " << err << '\n';
+            } else {
+                std::cout << (mgr.import_csv(path) ? "Imported.\n" : "Failed to import.\n");
+            }
+        } else if (ch=="u" || ch=="U") {
+            std::cout << (mgr.undo() ? "Undone.\n" : "Nothing to undo.\n");
+        } else if (ch=="r" || ch=="R") {
+            std::cout << (mgr.redo() ? "Redone.\n" : "Nothing to redo.\n");
         } else if (ch=="9" || ch=="q" || ch=="Q") {
             std::cout << "Bye!\n"; break;
-        } else {
+        } else if (!et::handle_read_choice(mgr, queries, ch)) {
             std::cout << "Invalid choice.\n";
         }
     }
     return 0;
 }
+#endif
@@ -0,0 +1,1549 @@
+// Unit tests for expense_tracker.cpp. Build and run from the repository root:
+//   g++ -std=c++17 -O2 -pthread tests/expense_tracker_test.cpp -o et_test && ./et_test
+// Add -DET_WITH_ZLIB ... -lz to include the gzip tests.
+// Each TEST registers itself; main runs them all and fails if any CHECK did.
+#define ET_NO_MAIN
+#include "../expense_tracker.cpp"
+
+#include <numeric>
+
+namespace {
+
+struct TestCase { const char* name; void (*fn)(); };
+std::vector<TestCase>& registry() { static std::vector<TestCase> t; return t; }
+int failures = 0;
+
+#define TEST(name) \
+    void name(); \
+    const bool name##_registered = (registry().push_back({ #name, name }), true); \
+    void name()
+#define CHECK(cond) \
+    do { if (!(cond)) { ++failures; std::cerr << __FILE__ << ':' << __LINE__ << ": CHECK(" #cond ") failed\n"; } } while (0)
+
+// A path in the temp directory, removed (with any sidecars) when it goes out of scope.
+struct TempPath {
+    std::string path;
+    explicit TempPath(const std::string& name)
+        : path((std::filesystem::temp_directory_path() / ("et_test_" + std::to_string(::getpid()) + "_" + name)).string()) {}
+    ~TempPath() {
+        std::error_code ec;
+        for (const char* ext : { "", ".idx", ".idx.tmp", ".recurring" }) std::filesystem::remove(path + ext, ec);
+    }
+};
+
+std::vector<et::Change> read_journal(const std::string& path, bool& corrupt) {
+    et::ChangeCursor cur(path);
+    std::vector<et::Change> out;
+    while (cur.poll(out) > 0) {}
+    corrupt = cur.corrupt();
+    return out;
+}
+
+void append_bytes(const std::string& path, const std::string& bytes) {
+    std::ofstream f(path, std::ios::binary | std::ios::app);
+    f.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+bool same_rows(const std::vector<et::Expense>& a, const std::vector<et::Expense>& b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (et::to_string(a[i].date) != et::to_string(b[i].date) || a[i].amount != b[i].amount ||
+            a[i].category != b[i].category || a[i].description != b[i].description) return false;
+    }
+    return true;
+}
+
+et::RecurrenceRule monthly_rent() {
+    et::RecurrenceRule r;
+    r.start = et::Date{2024,1,31}; r.amount = 1200.5; r.category = "Housing/Rent"; r.description = "rent, flat 2";
+    r.freq = et::Freq::Monthly;
+    return r;
+}
+
+// ---- Categories ----
+
+TEST(category_totals_roll_up_the_tree) {
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,1}, 10.0, "Travel/Flights", "out" });
+    m.add({ et::Date{2024,1,2}, 5.0, "Food", "lunch" });
+    m.add({ et::Date{2024,1,3}, 2.0, "travel / Trains", "metro" });
+    m.add({ et::Date{2024,1,4}, 1.0, "Travel", "map" });
+    m.add({ et::Date{2024,1,5}, 4.0, "Travel/Flights/Fees", "bag" });
+    auto by = m.totals_by_category();
+    CHECK(by["travel"] == 17.0 && by["travel/flights"] == 14.0 && by["food"] == 5.0);
+    CHECK(by == m.totals_by_category(m.all()));
+    CHECK(m.filter_by_category("Travel/Flights").size() == 2);
+    CHECK(m.filter_by_category("travel").size() == 4);
+
+    const auto& cats = m.categories();
+    auto travel = *cats.find("travel"), food = *cats.find("food");
+    auto sub = cats.subtree(travel);
+    CHECK(sub.last - sub.first == 4);
+    CHECK(cats.contains(sub, *cats.find("travel/flights/fees")) && !cats.contains(sub, food));
+}
+
+TEST(category_ranges_after_loading_csv) {
+    TempPath ledger("ranges.csv");
+    {
+        et::ExpenseManager m;
+        m.add({ et::Date{2024,3,1}, 10.0, "Travel/Flights", "out" });
+        m.add({ et::Date{2024,1,5}, 4.0, "Travel/Trains", "metro" });
+        m.add({ et::Date{2024,2,1}, 5.0, "Food", "lunch" });
+        m.add({ et::Date{2024,6,1}, 7.0, "Travel/Flights", "back" });
+        CHECK(m.save_csv(ledger.path));
+    }
+    et::ExpenseManager m;
+    CHECK(m.load_csv(ledger.path));
+    auto rows = m.filter_by_category_in_range("travel", et::Date{2024,1,1}, et::Date{2024,3,31});
+    CHECK(rows.size() == 2);
+    CHECK(m.category_total_in_range("travel", et::Date{2024,1,1}, et::Date{2024,12,31}) == 21.0);
+    CHECK(m.category_total_in_range("travel/flights", et::Date{2024,4,1}, et::Date{2024,12,31}) == 7.0);
+
+    std::string err;
+    auto q = et::prepare_query("where category=travel and date>=2024-02-01 and date<=2024-12-31", err);
+    CHECK(q && q->access() == et::QAccess::CategoryDate);
+    et::QueryResult res;
+    CHECK(q && q->execute(m, {}, res, err));
+    CHECK(res.rows.size() == 2);
+}
+
+// ---- Amount index ----
+
+std::vector<std::uint32_t> index_range(const et::AmountIndex& ix, std::int64_t lo, std::int64_t hi) {
+    std::vector<std::uint32_t> rows;
+    ix.range(lo, hi, [&](std::uint32_t r) { rows.push_back(r); return true; });
+    return rows;
+}
+std::vector<std::uint32_t> set_range(const std::set<et::AmountIndex::Key>& ref, std::int64_t lo, std::int64_t hi) {
+    std::vector<std::uint32_t> rows;
+    for (auto it = ref.lower_bound({lo, 0}); it != ref.end() && it->cents <= hi; ++it) rows.push_back(it->row);
+    return rows;
+}
+
+TEST(amount_index_splits_leaves_and_inner_nodes) {
+    // Enough keys, inserted in shuffled order, for a tree three levels deep.
+    et::AmountIndex ix;
+    std::set<et::AmountIndex::Key> ref;
+    std::mt19937 rng(7);
+    std::vector<std::uint32_t> rows(20000);
+    std::iota(rows.begin(), rows.end(), 0u);
+    std::shuffle(rows.begin(), rows.end(), rng);
+    for (auto r : rows) {
+        et::AmountIndex::Key k{ static_cast<std::int64_t>(rng() % 5000) - 1000, r };
+        ix.insert(k); ref.insert(k);
+    }
+    CHECK(ix.size() == ref.size());
+    CHECK(index_range(ix, std::numeric_limits<std::int64_t>::min(), std::numeric_limits<std::int64_t>::max()) ==
+          set_range(ref, std::numeric_limits<std::int64_t>::min(), std::numeric_limits<std::int64_t>::max()));
+    for (auto [lo, hi] : { std::pair<std::int64_t, std::int64_t>{-1000, -1000}, {0, 0}, {-5, 17}, {1234, 3999}, {3999, 5000}, {9000, 9999} })
+        CHECK(index_range(ix, lo, hi) == set_range(ref, lo, hi));
+}
+
+TEST(amount_index_erase_keeps_ranges_and_top_n) {
+    std::vector<et::AmountIndex::Key> keys;
+    for (std::uint32_t r = 0; r < 3000; ++r) keys.push_back({ static_cast<std::int64_t>((r * 37) % 1000), r });
+    et::AmountIndex ix;
+    ix.build(keys);
+    std::set<et::AmountIndex::Key> ref(keys.begin(), keys.end());
+
+    // Empty whole leaves in the middle and at both ends, then refill some.
+    for (const auto& k : keys) if (k.cents < 100 || k.cents >= 900 || (k.cents >= 400 && k.cents < 600)) { CHECK(ix.erase(k)); ref.erase(k); }
+    CHECK(!ix.erase({ 50, 0 }));
+    for (std::uint32_t r = 3000; r < 3100; ++r) { et::AmountIndex::Key k{ 500, r }; ix.insert(k); ref.insert(k); }
+    CHECK(ix.size() == ref.size());
+    CHECK(index_range(ix, 0, 1000) == set_range(ref, 0, 1000));
+    CHECK(index_range(ix, 400, 599) == set_range(ref, 400, 599));
+    CHECK(index_range(ix, 0, 99).empty());
+
+    std::vector<std::uint32_t> top, want;
+    ix.descending([&](std::uint32_t r) { top.push_back(r); return top.size() < 10; });
+    for (auto it = ref.rbegin(); it != ref.rend() && want.size() < 10; ++it) want.push_back(it->row);
+    CHECK(top == want);
+}
+
+TEST(amount_index_top_n_through_the_manager) {
+    et::ExpenseManager m;
+    std::vector<double> amounts;
+    for (int i = 0; i < 500; ++i) {
+        amounts.push_back((i * 7919) % 1000 / 4.0);
+        m.add({ et::Date{2024,1,1 + i % 28}, amounts.back(), i % 2 ? "Food" : "Fuel", "x" });
+    }
+    std::sort(amounts.rbegin(), amounts.rend());
+    auto top = m.top_by_amount(5);
+    CHECK(top.size() == 5);
+    for (std::size_t i = 0; i < top.size(); ++i) CHECK(top[i].amount == amounts[i]);
+    CHECK(m.filter_by_amount(amounts[4], 1e9).size() == 5);
+}
+
+// ---- Query language ----
+
+std::shared_ptr<et::PreparedQuery> prepare(const std::string& text) {
+    std::string err;
+    auto q = et::prepare_query(text, err);
+    if (!q) std::cerr << "prepare_query(" << text << "): " << err << '\n';
+    return q;
+}
+
+// Four categories across a year; amounts are exact multiples of 2.25.
+void fill_query_fixture(et::ExpenseManager& m) {
+    const char* cats[] = { "Food", "Travel/Flights", "Travel/Trains", "Fuel" };
+    for (int i = 0; i < 200; ++i)
+        m.add({ et::Date{2024, 1 + i % 12, 1 + i % 28}, (i % 37) * 2.25, cats[i % 4], i % 5 ? "shop" : "Uber ride" });
+}
+
+TEST(query_parse_errors) {
+    std::string err;
+    for (const char* bad : { "where", "where colour=red", "where amount~3", "where amount >", "where date>=2024-13-01",
+                             "group by day", "order by size", "limit ten", "where amount>1 extra" }) {
+        err.clear();
+        CHECK(!et::prepare_query(bad, err));
+        CHECK(!err.empty());
+    }
+    auto q = prepare("WHERE Category = ? AND amount >= ? group by month");
+    CHECK(q && q->param_count() == 2 && !q->is_filter_only());
+}
+
+TEST(query_planner_picks_access_path) {
+    auto cd = prepare("where category=travel and date>=2024-01-01 and date<=2024-06-30");
+    auto half = prepare("where category=travel and date>=2024-01-01");
+    auto amt = prepare("where amount>=10 and date>=2024-01-01");
+    auto ne = prepare("where amount!=10");
+    CHECK(cd && cd->access() == et::QAccess::CategoryDate);
+    CHECK(half && half->access() == et::QAccess::Scan);
+    CHECK(amt && amt->access() == et::QAccess::Amount);
+    CHECK(ne && ne->access() == et::QAccess::Scan);
+}
+
+TEST(query_access_paths_match_a_scan) {
+    et::ExpenseManager m;
+    fill_query_fixture(m);
+    auto count = [&](const std::string& text, const std::vector<std::string>& args = {}) {
+        auto q = prepare(text);
+        et::QueryResult res; std::string err;
+        if (!q || !q->execute(m, args, res, err)) return std::size_t(~0);
+        return res.rows.size();
+    };
+    auto scan = [&](auto pred) {
+        std::size_t n = 0;
+        for (const auto& e : m.all()) n += pred(e);
+        return n;
+    };
+    const et::Date from{2024,3,1}, to{2024,8,31};
+    CHECK(count("where category=? and date>=? and date<=?", { "travel", "2024-03-01", "2024-08-31" }) ==
+          scan([&](const et::Expense& e) { return e.category.rfind("Travel", 0) == 0 && et::date_le(from, e.date) && et::date_le(e.date, to); }));
+    CHECK(count("where amount>=20 and amount<40") == scan([](const et::Expense& e) { return e.amount >= 20 && e.amount < 40; }));
+    CHECK(count("where desc~\"UBER\" and category!=food") ==
+          scan([](const et::Expense& e) { return e.description == "Uber ride" && e.category != "Food"; }));
+}
+
+TEST(query_groups_order_and_limit) {
+    et::ExpenseManager m;
+    fill_query_fixture(m);
+    auto q = prepare("where category=travel group by category sum amount order by sum desc");
+    et::QueryResult res; std::string err;
+    CHECK(q && q->execute(m, {}, res, err) && res.grouped);
+    double travel = 0;
+    for (const auto& e : m.all()) if (e.category.rfind("Travel", 0) == 0) travel += e.amount;
+    CHECK(res.groups.size() == 2);
+    if (res.groups.size() == 2) {
+        CHECK(res.groups[0].value >= res.groups[1].value);
+        CHECK(res.groups[0].value + res.groups[1].value == travel);
+    }
+    auto top = prepare("order by amount desc limit 3");
+    res = {};
+    CHECK(top && top->execute(m, {}, res, err) && res.rows.size() == 3);
+    if (res.rows.size() == 3) CHECK(res.rows[0].amount == 36 * 2.25 && res.rows[2].amount <= res.rows[0].amount);
+}
+
+// ---- Pivot ----
+
+// Sum and count of the (period, category) cell, or {-1, 0} if either is missing.
+std::pair<double, std::uint32_t> pivot_cell(const et::PivotTable& pt, const std::string& period, const std::string& cat) {
+    auto r = std::find(pt.periods.begin(), pt.periods.end(), period);
+    auto c = std::find(pt.categories.begin(), pt.categories.end(), cat);
+    if (r == pt.periods.end() || c == pt.categories.end()) return { -1.0, 0 };
+    std::size_t i = static_cast<std::size_t>(r - pt.periods.begin()) * pt.categories.size() + static_cast<std::size_t>(c - pt.categories.begin());
+    return { pt.sums[i], pt.counts[i] };
+}
+
+TEST(pivot_buckets_by_month) {
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,31}, 10.0, "Food", "a" });
+    m.add({ et::Date{2024,1,1}, 5.0, "Food", "b" });
+    m.add({ et::Date{2024,3,1}, 7.0, "Travel", "c" });
+    m.add({ et::Date{2024,3,15}, 1.5, "Food", "d" });
+    auto pt = m.pivot(et::PivotPeriod::Month);
+    CHECK((pt.periods == std::vector<std::string>{ "2024-01", "2024-02", "2024-03" }));
+    CHECK((pt.categories == std::vector<std::string>{ "food", "travel" }));
+    CHECK(pt.sums.size() == 6 && pt.counts.size() == 6);
+    CHECK(pivot_cell(pt, "2024-01", "food") == std::make_pair(15.0, 2u));
+    CHECK(pivot_cell(pt, "2024-02", "food") == std::make_pair(0.0, 0u));
+    CHECK(pivot_cell(pt, "2024-03", "travel") == std::make_pair(7.0, 1u));
+
+    // Bounds clip rows; with both given, recurring occurrences count too.
+    auto rent = monthly_rent();
+    m.add_recurring(rent);
+    pt = m.pivot(et::PivotPeriod::Month, et::Date{2024,2,1}, et::Date{2024,3,31});
+    CHECK((pt.periods == std::vector<std::string>{ "2024-02", "2024-03" }));
+    CHECK(pivot_cell(pt, "2024-03", "food") == std::make_pair(1.5, 1u));
+    CHECK(pivot_cell(pt, "2024-02", "housing/rent") == std::make_pair(rent.amount, 1u));
+    CHECK(pivot_cell(pt, "2024-01", "food").first == -1.0);
+}
+
+TEST(pivot_weeks_start_on_monday) {
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,7}, 1.0, "Food", "sunday" });
+    m.add({ et::Date{2024,1,8}, 2.0, "Food", "monday" });
+    m.add({ et::Date{2024,1,14}, 4.0, "Food", "sunday" });
+    m.add({ et::Date{1969,12,28}, 8.0, "Food", "before the epoch, sunday" });
+    m.add({ et::Date{1969,12,29}, 16.0, "Food", "before the epoch, monday" });
+    auto pt = m.pivot(et::PivotPeriod::Week, et::Date{2024,1,1}, et::Date{2024,1,14});
+    CHECK((pt.periods == std::vector<std::string>{ "2024-01-01", "2024-01-08" }));
+    CHECK(pivot_cell(pt, "2024-01-01", "food") == std::make_pair(1.0, 1u));
+    CHECK(pivot_cell(pt, "2024-01-08", "food") == std::make_pair(6.0, 2u));
+    pt = m.pivot(et::PivotPeriod::Week, et::Date{1969,12,20}, et::Date{1970,1,4});
+    CHECK((pt.periods == std::vector<std::string>{ "1969-12-15", "1969-12-22", "1969-12-29" }));
+    CHECK(pivot_cell(pt, "1969-12-22", "food") == std::make_pair(8.0, 1u));
+    CHECK(pivot_cell(pt, "1969-12-29", "food") == std::make_pair(16.0, 1u));
+}
+
+TEST(pivot_threads_agree) {
+    et::ExpenseManager m;
+    std::vector<et::Expense> rows;
+    const char* cats[] = { "Food", "Travel/Flights", "Fuel" };
+    for (int i = 0; i < 200000; ++i) rows.push_back({ et::Date{2020 + i % 4, 1 + i % 12, 1 + i % 28}, (i % 97) * 0.25, cats[i % 3], "x" });
+    m.add_batch(std::move(rows));
+    for (auto per : { et::PivotPeriod::Month, et::PivotPeriod::Week }) {
+        auto one = m.pivot(per, std::nullopt, std::nullopt, 1), four = m.pivot(per, std::nullopt, std::nullopt, 4);
+        CHECK(one.periods == four.periods && one.categories == four.categories);
+        CHECK(one.sums == four.sums && one.counts == four.counts);
+        CHECK(std::accumulate(one.counts.begin(), one.counts.end(), 0u) == 200000u);
+    }
+}
+
+// ---- Streaming statistics ----
+
+// Twenty steady coffees, then one outlier.
+void fill_coffee(et::ExpenseManager& m) {
+    for (int i = 0; i < 20; ++i) m.add({ et::Date{2024,1,1 + i}, 3.0 + (i % 3) * 0.25, "Food", "Cafe Nero " + std::to_string(i) });
+    m.add({ et::Date{2024,1,25}, 90.0, "Food", "Cafe Nero" });
+}
+
+TEST(loading_resets_anomaly_statistics) {
+    TempPath ledger("calm.csv");
+    {
+        et::ExpenseManager m;
+        m.add({ et::Date{2024,2,1}, 3.0, "Food", "tea" });
+        CHECK(m.save_csv(ledger.path));
+    }
+    et::ExpenseManager m;
+    fill_coffee(m);
+    CHECK(m.anomalies().flagged_count() == 1);
+    CHECK(m.load_csv(ledger.path));
+    CHECK(m.anomalies().flagged_count() == 0 && m.anomalies().flags().empty());
+    // The loaded ledger's history is all the detector knows: no warm-up, no flag.
+    m.add({ et::Date{2024,2,2}, 90.0, "Food", "tea" });
+    CHECK(m.anomalies().flagged_count() == 0);
+}
+
+TEST(followers_match_leader_statistics) {
+    TempPath j("stats.journal");
+    et::ExpenseManager leader;
+    CHECK(leader.attach_journal(j.path));
+    fill_coffee(leader);
+    leader.add({ et::Date{2024,1,26}, 12.0, "Travel", "Uber trip" });
+    leader.undo();
+    leader.remove(3);
+    leader.undo();
+
+    et::ExpenseManager follower;
+    bool corrupt = true;
+    for (const auto& c : read_journal(j.path, corrupt)) CHECK(follower.apply_change(c));
+    CHECK(!corrupt);
+    CHECK(follower.anomalies().flagged_count() == leader.anomalies().flagged_count());
+    CHECK(follower.anomalies().flagged_count() >= 1);
+    const et::Date from{2024,1,1}, to{2024,1,31};
+    for (bool by_spend : { false, true }) {
+        auto a = leader.top_merchants(from, to, 5, by_spend), b = follower.top_merchants(from, to, 5, by_spend);
+        CHECK(a.size() == b.size());
+        for (std::size_t i = 0; i < a.size() && i < b.size(); ++i) CHECK(a[i].key == b[i].key && a[i].estimate == b[i].estimate);
+    }
+}
+
+TEST(undoing_an_add_retracts_merchant_counts) {
+    et::ExpenseManager m;
+    const et::Date from{2024,1,1}, to{2024,1,31};
+    m.add({ et::Date{2024,1,3}, 5.0, "Food", "Cafe Nero" });
+    m.add({ et::Date{2024,1,4}, 7.0, "Food", "CAFE NERO 22" });
+    m.add_batch({ { et::Date{2024,1,5}, 2.0, "Food", "cafe nero" }, { et::Date{2024,1,6}, 1.0, "Food", "Pret" } });
+    auto top = m.top_merchants(from, to, 5, true);
+    CHECK(!top.empty() && top[0].key == "cafe nero" && top[0].estimate == 14.0);
+    m.undo(); m.undo();
+    top = m.top_merchants(from, to, 5, true);
+    CHECK(!top.empty() && top[0].key == "cafe nero" && top[0].estimate == 5.0);
+    m.redo();
+    top = m.top_merchants(from, to, 5, false);
+    CHECK(!top.empty() && top[0].key == "cafe nero" && top[0].estimate == 2.0);
+}
+
+// ---- Categorization rules ----
+
+// Reference matcher: the lowest-indexed rule whose keyword occurs in text.
+const std::string* naive_match(const std::vector<std::pair<std::string, std::string>>& rules, const std::string& text) {
+    std::string low = et::to_lower(text);
+    for (const auto& r : rules) if (low.find(et::to_lower(r.first)) != std::string::npos) return &r.second;
+    return nullptr;
+}
+
+TEST(rules_match_overlapping_keywords_by_priority) {
+    et::CategoryRules rules;
+    CHECK(rules.match("anything") == nullptr);
+    rules.add_rule("hers", "A"); rules.add_rule("he", "B"); rules.add_rule("she", "C"); rules.add_rule("his", "D");
+    rules.add_rule("", "ignored");
+    CHECK(rules.size() == 4);
+    CHECK(rules.match("ushers") == nullptr);  // not compiled yet
+    rules.compile();
+    auto is = [&](const char* text, const char* want) {
+        const std::string* got = rules.match(text);
+        return want ? got && *got == want : got == nullptr;
+    };
+    CHECK(is("ushers", "A"));       // "she" and "he" end earlier, but "hers" is rule 0
+    CHECK(is("USHE", "B"));         // case-insensitive; "he" beats "she"
+    CHECK(is("this", "D"));
+    CHECK(is("h\xe9rs", nullptr)); // bytes outside every keyword share one class
+    CHECK(is("", nullptr));
+}
+
+TEST(rules_agree_with_a_naive_matcher) {
+    std::mt19937 rng(11);
+    const std::string alphabet = "abcAB -\xff";
+    auto random_text = [&](std::size_t len) {
+        std::string t;
+        for (std::size_t i = 0; i < len; ++i) t.push_back(alphabet[rng() % alphabet.size()]);
+        return t;
+    };
+    std::vector<std::pair<std::string, std::string>> ref;
+    et::CategoryRules rules;
+    for (int i = 0; i < 30; ++i) {
+        std::string kw = random_text(1 + rng() % 4);
+        ref.emplace_back(kw, "cat" + std::to_string(i));
+        rules.add_rule(kw, ref.back().second);
+    }
+    rules.compile();
+    for (int i = 0; i < 2000; ++i) {
+        std::string text = random_text(rng() % 24);
+        const std::string* a = rules.match(text);
+        const std::string* b = naive_match(ref, text);
+        CHECK((a == nullptr) == (b == nullptr));
+        if (a && b) CHECK(*a == *b);
+    }
+}
+
+TEST(rules_categorize_new_rows) {
+    et::CategoryRules rules;
+    rules.add_rule("uber", "Travel/Taxi");
+    rules.add_rule("eats", "Food");
+    et::ExpenseManager m;
+    m.set_rules(rules);
+    m.add({ et::Date{2024,1,1}, 9.0, "", "UBER EATS 123" });
+    m.add({ et::Date{2024,1,2}, 9.0, "Groceries", "uber" });
+    auto rows = m.all();
+    CHECK(rows.size() == 2 && rows[0].category == "Travel/Taxi" && rows[1].category == "Groceries");
+}
+
+// ---- Bulk recategorization ----
+
+TEST(update_category_where_touches_only_matching_rows) {
+    et::ExpenseManager m;
+    fill_query_fixture(m);
+    const et::Date from{2024,1,1}, to{2024,12,31};
+    const auto before = m.all();
+    const double taxi_total = m.total(m.search("uber"));
+    std::size_t already = 0;
+    for (const auto& e : before) already += e.description == "Uber ride" && e.category == "Travel/Trains";
+    std::string err;
+    auto n = et::update_category_where(m, "where desc~\"uber\"", "Travel/Trains", err);
+    CHECK(n && *n == m.search("uber").size() - already);
+    for (std::size_t i = 0; i < m.size(); ++i) {
+        const bool uber = before[i].description == "Uber ride";
+        CHECK(m.at(i).category == (uber ? "Travel/Trains" : before[i].category));
+        CHECK(m.at(i).amount == before[i].amount && m.at(i).description == before[i].description);
+    }
+    double trains = 0;
+    for (const auto& e : m.all()) if (e.category == "Travel/Trains") trains += e.amount;
+    CHECK(m.category_total_in_range("travel/trains", from, to) == trains);
+    CHECK(m.totals_by_category()["travel/trains"] == trains);
+    CHECK(trains >= taxi_total);
+
+    CHECK(m.undo());
+    CHECK(same_rows(m.all(), before));
+    CHECK(m.filter_by_category_in_range("travel/trains", from, to).size() ==
+          m.filter_by_category("travel/trains").size());
+    CHECK(m.redo());
+    CHECK(m.totals_by_category()["travel/trains"] == trains);
+}
+
+TEST(update_category_where_rejects_more_than_a_where_clause) {
+    et::ExpenseManager m;
+    fill_query_fixture(m);
+    const auto before = m.all();
+    std::string err;
+    for (const char* bad : { "where amount>1 group by month", "where category=?", "order by amount", "where amount>" }) {
+        err.clear();
+        CHECK(!et::update_category_where(m, bad, "Food", err));
+        CHECK(!err.empty());
+    }
+    CHECK(same_rows(m.all(), before));
+    auto none = et::update_category_where(m, "where amount>100000", "Food", err);
+    CHECK(none && *none == 0);
+}
+
+TEST(update_category_where_is_one_journal_frame) {
+    TempPath j("recat.journal");
+    et::ExpenseManager leader;
+    fill_query_fixture(leader);
+    CHECK(leader.attach_journal(j.path));
+    et::ChangeCursor cur(j.path);
+    std::vector<et::Change> snapshot;
+    CHECK(cur.poll(snapshot) == 1);
+    std::string err;
+    auto n = et::update_category_where(leader, "where category=food and amount>=40", "Food/Treats", err);
+    CHECK(n && *n > 0);
+    std::vector<et::Change> frame;
+    CHECK(cur.poll(frame) == 1);
+    CHECK(n && frame.size() == *n);
+    for (const auto& c : frame) CHECK(c.kind == et::ChangeKind::SetCategory && c.e.category == "Food/Treats");
+
+    et::ExpenseManager follower;
+    for (const auto& c : snapshot) CHECK(follower.apply_change(c));
+    for (const auto& c : frame) CHECK(follower.apply_change(c));
+    CHECK(same_rows(follower.all(), leader.all()));
+    CHECK(follower.totals_by_category() == leader.totals_by_category());
+}
+
+// ---- Retention ----
+
+void fill_cafe_visits(et::ExpenseManager& m) {
+    m.add({ et::Date{2024,1,10}, 5.0, "Food", "Cafe Nero" });
+    m.add({ et::Date{2024,1,20}, 6.0, "Food", "Cafe Nero" });
+    m.add({ et::Date{2024,2,5}, 7.0, "Food", "Cafe Nero" });
+    m.add({ et::Date{2024,3,2}, 8.0, "Food", "Pret" });
+    m.add({ et::Date{2024,3,25}, 9.0, "Food", "Cafe Nero" });
+}
+
+// Estimate for key, or 0 if the sketch no longer counts it.
+double merchant_estimate(const et::ExpenseManager& m, const et::Date& from, const et::Date& to, const std::string& key, bool by_spend) {
+    for (const auto& h : m.top_merchants(from, to, 64, by_spend)) if (h.key == key) return h.estimate;
+    return 0.0;
+}
+
+TEST(purging_a_range_retracts_the_boundary_months) {
+    et::ExpenseManager m;
+    fill_cafe_visits(m);
+    CHECK(m.remove_date_range(et::Date{2024,1,15}, et::Date{2024,3,10}) == 3);
+    CHECK(m.size() == 2);
+    CHECK(m.at(0).date.d == 10 && m.at(1).date.d == 25);
+    CHECK(m.filter_by_amount(0, 100).size() == 2 && m.total(m.all()) == 14.0);
+    const et::Date jan{2024,1,1}, jan_end{2024,1,31}, feb{2024,2,1}, feb_end{2024,2,29}, mar{2024,3,1}, mar_end{2024,3,31};
+    CHECK(merchant_estimate(m, jan, jan_end, "cafe nero", true) == 5.0);
+    CHECK(merchant_estimate(m, jan, jan_end, "cafe nero", false) == 1.0);
+    CHECK(m.top_merchants(feb, feb_end, 5, true).empty());
+    CHECK(merchant_estimate(m, mar, mar_end, "pret", false) == 0.0);
+    CHECK(merchant_estimate(m, mar, mar_end, "cafe nero", true) == 9.0);
+}
+
+TEST(purges_clear_the_undo_log) {
+    et::ExpenseManager m;
+    fill_cafe_visits(m);
+    CHECK(m.undo() && m.can_redo());
+    CHECK(m.remove_date_range(et::Date{2030,1,1}, et::Date{2030,12,31}) == 0);
+    CHECK(!m.can_undo() && !m.can_redo());
+}
+
+TEST(retention_replays_on_followers) {
+    TempPath j("retention.journal");
+    et::ExpenseManager leader;
+    CHECK(leader.attach_journal(j.path));
+    fill_cafe_visits(leader);
+    // One year before 2025-02-15: rows up to 2024-02-14 go.
+    CHECK(leader.apply_retention(1, et::Date{2025,2,15}) == 3);
+    CHECK(leader.size() == 2 && leader.at(0).date.m == 3);
+
+    et::ExpenseManager follower;
+    bool corrupt = true;
+    for (const auto& c : read_journal(j.path, corrupt)) CHECK(follower.apply_change(c));
+    CHECK(!corrupt);
+    CHECK(same_rows(follower.all(), leader.all()));
+    const et::Date from{2024,1,1}, to{2024,12,31};
+    CHECK(merchant_estimate(follower, from, to, "cafe nero", true) == merchant_estimate(leader, from, to, "cafe nero", true));
+    CHECK(merchant_estimate(leader, from, to, "cafe nero", true) == 9.0);
+}
+
+// ---- CSV tailing ----
+
+TEST(tail_waits_for_the_end_of_a_partial_line) {
+    TempPath file("tail.csv");
+    const std::string head = std::string(et::kCsvHeader) + "\n2024-01-01,1,Food,a\n2024-01-02,2,Food,b\n";
+    append_bytes(file.path, head + "2024-01-03,3,Fo");
+    et::ExpenseManager m;
+    et::CsvTail tail(file.path);
+    CHECK(tail.readable());
+    CHECK(tail.poll(m) == 2 && m.size() == 2);
+    CHECK(tail.offset() == head.size());
+    CHECK(tail.poll(m) == 0);
+
+    append_bytes(file.path, "od,c");
+    CHECK(tail.poll(m) == 0 && tail.offset() == head.size());
+    append_bytes(file.path, "\nnot a row\n2024-01-04,4,Fuel,d\n");
+    CHECK(tail.poll(m) == 2 && m.size() == 4);
+    CHECK(m.at(2).description == "c" && m.at(2).category == "Food" && m.at(3).amount == 4.0);
+    CHECK(!tail.failed());
+
+    // A tail resumed at a saved offset reads only what follows it.
+    et::ExpenseManager resumed;
+    et::CsvTail again(file.path, tail.offset());
+    append_bytes(file.path, "2024-01-05,5,Fuel,e\n");
+    CHECK(again.poll(resumed) == 1 && resumed.at(0).description == "e");
+}
+
+TEST(tail_restarts_when_the_file_shrinks) {
+    TempPath file("shrink.csv");
+    append_bytes(file.path, "2024-01-01,1,Food,a\n2024-01-02,2,Food,b\n2024-01-03,3,Food,c\n");
+    et::ExpenseManager m;
+    et::CsvTail tail(file.path);
+    CHECK(tail.poll(m) == 3);
+    std::filesystem::remove(file.path);
+    append_bytes(file.path, "2024-02-01,9,Fuel,new\n");
+    CHECK(tail.poll(m) == 1 && m.size() == 4 && m.at(3).description == "new");
+
+    et::CsvTail skip(file.path);
+    skip.seek_to_end();
+    append_bytes(file.path, "2024-02-02,1,Fuel,later\n");
+    et::ExpenseManager other;
+    CHECK(skip.poll(other) == 1 && other.at(0).description == "later");
+}
+
+// ---- Compressed input ----
+#ifdef ET_WITH_ZLIB
+
+// One gzip member holding `text`.
+std::string gzip_member(const std::string& text) {
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, text.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+    zs.avail_in = static_cast<uInt>(text.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+std::string csv_rows(int first, int n) {
+    std::string text;
+    for (int i = first; i < first + n; ++i) text += "2024-01-01," + std::to_string(i) + ",Food,row " + std::to_string(i) + "\n";
+    return text;
+}
+
+TEST(gzip_decoder_streams_blocks_before_the_member_ends) {
+    // Over two blocks of output from one member, fed a byte range at a time.
+    std::string text(3 * et::Decompressor::kBlock, 'x');
+    std::string gz = gzip_member(text);
+    et::Decompressor dec(et::Codec::Gzip);
+    std::size_t out = 0;
+    auto sink = [&](const char*, std::size_t n) { out += n; };
+    CHECK(dec.feed(gz.data(), gz.size() - 8, sink));
+    CHECK(out >= 2 * et::Decompressor::kBlock);  // output arrives without the trailer
+    CHECK(!dec.idle());
+    CHECK(dec.feed(gz.data() + gz.size() - 8, 8, sink) && dec.flush(sink));
+    CHECK(dec.idle() && out == text.size());
+    CHECK(!dec.feed("garbage!", 8, sink));
+    CHECK(!dec.flush(sink));
+    dec.reset();
+    CHECK(dec.feed(gz.data(), gz.size(), sink));
+}
+
+TEST(load_csv_reads_gzip_members) {
+    TempPath ledger("members.csv.gz");
+    append_bytes(ledger.path, gzip_member(std::string(et::kCsvHeader) + "\n" + csv_rows(0, 3000)));
+    append_bytes(ledger.path, gzip_member(csv_rows(3000, 10)));
+    et::ExpenseManager m;
+    CHECK(m.load_csv(ledger.path));
+    CHECK(m.size() == 3010);
+
+    TempPath cut("cut.csv.gz");
+    std::string gz = gzip_member(csv_rows(0, 100));
+    append_bytes(cut.path, gz.substr(0, gz.size() / 2));
+    CHECK(!m.load_csv(cut.path));
+}
+
+TEST(tail_follows_a_growing_gzip_file) {
+    TempPath file("tail.csv.gz");
+    std::string a = gzip_member(csv_rows(0, 50)), b = gzip_member(csv_rows(50, 5));
+    append_bytes(file.path, a.substr(0, a.size() - 4));
+    et::ExpenseManager m;
+    et::CsvTail tail(file.path);
+    std::size_t seen = tail.poll(m);
+    append_bytes(file.path, a.substr(a.size() - 4) + b);
+    seen += tail.poll(m);
+    CHECK(!tail.failed());
+    CHECK(seen == 55 && m.size() == 55);
+    CHECK(tail.offset() == a.size() + b.size());
+
+    append_bytes(file.path, "not gzip at all");
+    CHECK(tail.poll(m) == 0);
+    CHECK(tail.failed());
+}
+
+#endif
+
+// ---- Arrow IPC ----
+
+std::string read_file(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+void fill_awkward_rows(et::ExpenseManager& m) {
+    m.add({ et::Date{1999,12,31}, -12.5, "Travel/Flights", "refund, \"late\"" });
+    m.add({ et::Date{2024,2,29}, 0.01, "Food", "" });
+    m.add({ et::Date{2038,1,19}, 1e9, "Caf\xc3\xa9", "na\xc3\xafve \xe2\x82\xac" });
+    m.add({ et::Date{2024,2,29}, 3.0, "Food", "again" });
+}
+
+TEST(arrow_round_trips_a_ledger) {
+    TempPath file("ledger.arrow");
+    et::ExpenseManager src;
+    fill_awkward_rows(src);
+    CHECK(src.save_arrow(file.path));
+    std::string bytes = read_file(file.path);
+    CHECK(bytes.compare(0, 8, std::string("ARROW1\0\0", 8)) == 0);
+    CHECK(bytes.size() > 6 && bytes.compare(bytes.size() - 6, 6, "ARROW1") == 0);
+
+    et::ExpenseManager m;
+    std::string err;
+    CHECK(m.load_arrow(file.path, err));
+    CHECK(same_rows(m.all(), src.all()));
+    CHECK(m.import_arrow(file.path, err));
+    CHECK(m.size() == 2 * src.size());
+}
+
+TEST(arrow_round_trips_an_empty_ledger) {
+    TempPath file("empty.arrow");
+    et::ExpenseManager src;
+    CHECK(src.save_arrow(file.path));
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,1}, 1.0, "a", "b" });
+    std::string err;
+    CHECK(m.load_arrow(file.path, err));
+    CHECK(m.size() == 0);
+}
+
+TEST(arrow_rejects_truncated_files) {
+    TempPath file("whole.arrow"), cut("cut.arrow");
+    et::ExpenseManager src;
+    fill_awkward_rows(src);
+    CHECK(src.save_arrow(file.path));
+    std::string bytes = read_file(file.path);
+    for (std::size_t keep : { std::size_t{0}, std::size_t{5}, std::size_t{64}, bytes.size() / 2 }) {
+        std::filesystem::remove(cut.path);
+        append_bytes(cut.path, bytes.substr(0, keep));
+        et::ExpenseManager m;
+        std::string err;
+        CHECK(!m.load_arrow(cut.path, err));
+        CHECK(!err.empty());
+    }
+}
+
+TEST(stream_digest_ignores_how_input_is_split) {
+    const std::string text = "the quick brown fox jumps over the lazy dog";
+    et::StreamDigest whole;
+    whole.update(text.data(), text.size());
+    for (std::size_t step : { 1, 2, 3, 5, 7, 9, 16 }) {
+        et::StreamDigest pieces;
+        for (std::size_t at = 0; at < text.size(); at += step)
+            pieces.update(text.data() + at, std::min(step, text.size() - at));
+        pieces.update(nullptr, 0);
+        CHECK(pieces.value() == whole.value());
+    }
+}
+
+TEST(arrow_index_file_is_adopted_only_when_current) {
+    TempPath file("indexed.arrow");
+    {
+        et::ExpenseManager src;
+        fill_query_fixture(src);
+        CHECK(src.save_arrow(file.path));
+    }
+    CHECK(std::filesystem::exists(et::index_file_path(file.path)));
+    auto summary = [](const et::ExpenseManager& m) {
+        std::ostringstream out;
+        for (const auto& e : m.top_by_amount(5)) out << e.amount << ';';
+        out << m.category_total_in_range("travel", et::Date{2024,2,1}, et::Date{2024,9,30}) << ';'
+            << m.filter_by_category_in_range("food", et::Date{2024,1,1}, et::Date{2024,6,30}).size();
+        return out.str();
+    };
+    et::ExpenseManager fresh;
+    fill_query_fixture(fresh);
+    std::string err;
+    et::ExpenseManager adopted;
+    CHECK(adopted.load_arrow(file.path, err));
+    CHECK(summary(adopted) == summary(fresh));
+
+    // A damaged index file is ignored and rewritten.
+    append_bytes(et::index_file_path(file.path), "x");
+    et::ExpenseManager rebuilt;
+    CHECK(rebuilt.load_arrow(file.path, err));
+    CHECK(summary(rebuilt) == summary(fresh));
+}
+
+TEST(arrow_index_file_ignores_rule_categories) {
+    TempPath file("ruled.arrow");
+    {
+        et::ExpenseManager src;
+        for (int i = 0; i < 20; ++i) src.add({ et::Date{2024,1,1 + i}, 1.0 + i, "Uncategorized", i % 2 ? "UBER trip" : "corner shop" });
+        CHECK(src.save_arrow(file.path));
+    }
+    std::filesystem::remove(et::index_file_path(file.path));
+    const et::Date from{2024,1,1}, to{2024,12,31};
+    std::string err;
+    {
+        et::CategoryRules rules;
+        rules.add_rule("uber", "Travel/Taxi");
+        et::ExpenseManager m;
+        m.set_rules(rules);
+        CHECK(m.load_arrow(file.path, err));
+        CHECK(m.filter_by_category_in_range("travel", from, to).size() == 10);
+    }
+    CHECK(!std::filesystem::exists(et::index_file_path(file.path)));
+    for (int pass = 0; pass < 2; ++pass) {  // the second pass adopts the index file the first wrote
+        et::ExpenseManager m;
+        CHECK(m.load_arrow(file.path, err));
+        CHECK(m.filter_by_category_in_range("uncategorized", from, to).size() == 20);
+        CHECK(m.filter_by_category_in_range("travel", from, to).empty());
+        CHECK(m.category_total_in_range("uncategorized", from, to) == 210.0);
+        CHECK(m.totals_by_category().count("travel/taxi") == 0);
+    }
+    CHECK(std::filesystem::exists(et::index_file_path(file.path)));
+}
+
+// ---- Parquet ----
+
+std::string bytes_of(std::initializer_list<int> v) {
+    std::string s;
+    for (int b : v) s.push_back(static_cast<char>(b));
+    return s;
+}
+
+// Minimal readers for the encodings, written from the Parquet spec.
+struct ByteReader {
+    const std::string& s;
+    std::size_t pos{0};
+    std::uint64_t varint() {
+        std::uint64_t v = 0;
+        for (int shift = 0; pos < s.size(); shift += 7) {
+            auto b = static_cast<unsigned char>(s[pos++]);
+            v |= std::uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        return v;
+    }
+    std::int64_t zigzag() { auto v = varint(); return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1); }
+    // n values of `width` bits, LSB first.
+    std::vector<std::uint64_t> unpack(std::size_t n, unsigned width) {
+        std::vector<std::uint64_t> out(n);
+        std::size_t bit = pos * 8;
+        for (auto& v : out) {
+            for (unsigned b = 0; b < width; ++b, ++bit)
+                v |= std::uint64_t((static_cast<unsigned char>(s[bit / 8]) >> (bit % 8)) & 1) << b;
+        }
+        pos += (n * width + 7) / 8;
+        return out;
+    }
+};
+
+std::vector<std::int32_t> delta_decode(const std::string& s) {
+    ByteReader r{ s };
+    std::size_t block = r.varint(), minis = r.varint(), total = r.varint();
+    std::vector<std::int32_t> out;
+    if (!total) return out;
+    out.push_back(static_cast<std::int32_t>(r.zigzag()));
+    while (out.size() < total) {
+        std::int64_t lo = r.zigzag();
+        std::vector<unsigned> width(minis);
+        for (auto& w : width) w = static_cast<unsigned char>(s[r.pos++]);
+        for (std::size_t m = 0; m < minis && out.size() < total; ++m) {
+            for (auto d : r.unpack(block / minis, width[m])) {
+                if (out.size() == total) break;
+                out.push_back(static_cast<std::int32_t>(out.back() + lo + static_cast<std::int64_t>(d)));
+            }
+        }
+    }
+    return out;
+}
+
+std::vector<std::uint64_t> rle_decode(const std::string& s, unsigned width, std::size_t n) {
+    ByteReader r{ s };
+    std::vector<std::uint64_t> out;
+    while (out.size() < n && r.pos < s.size()) {
+        std::uint64_t h = r.varint();
+        if (h & 1) {
+            for (auto v : r.unpack((h >> 1) * 8, width)) out.push_back(v);
+        } else {
+            std::uint64_t v = 0;
+            for (unsigned b = 0; b < (width + 7) / 8; ++b) v |= std::uint64_t(static_cast<unsigned char>(s[r.pos++])) << (8 * b);
+            out.insert(out.end(), h >> 1, v);
+        }
+    }
+    out.resize(std::min(out.size(), n));
+    return out;
+}
+
+TEST(parquet_varints_and_bit_packing) {
+    std::string s;
+    et::put_varint(s, 300); CHECK(s == bytes_of({ 0xAC, 0x02 }));
+    s.clear(); et::put_zigzag(s, -1); et::put_zigzag(s, 1); et::put_zigzag(s, -64); CHECK(s == bytes_of({ 0x01, 0x02, 0x7F }));
+    // The spec's example: 0..7 packed 3 bits wide.
+    std::uint64_t v[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    s.clear(); et::bitpack(s, v, 8, 3);
+    CHECK(s == bytes_of({ 0x88, 0xC6, 0xFA }));
+    CHECK(et::bit_width(0) == 0 && et::bit_width(1) == 1 && et::bit_width(255) == 8 && et::bit_width(256) == 9);
+}
+
+TEST(thrift_compact_fields_and_lists) {
+    et::ThriftWriter w;
+    w.i32(1, 5);                  // short form: delta 1, type i32
+    w.binary(3, "ab");
+    w.i64(20, -1);                // delta 17: long form with the id
+    w.begin_struct(21); w.boolean(1, true); w.end_struct();
+    w.list(22, et::ThriftWriter::kI32, 3); w.value(1); w.value(2); w.value(3);
+    w.list(23, et::ThriftWriter::kBinary, 15);
+    for (int i = 0; i < 15; ++i) w.value(std::string());
+    std::string want = bytes_of({ 0x15, 0x0A, 0x28, 0x02, 'a', 'b', 0x06, 0x28, 0x01, 0x1C, 0x11, 0x00,
+                                  0x19, 0x35, 0x02, 0x04, 0x06, 0x19, 0xF8, 0x0F });
+    want += std::string(15, '\0');
+    want.push_back('\0');
+    CHECK(w.finish() == want);
+}
+
+TEST(parquet_delta_and_rle_round_trip) {
+    std::mt19937 rng(5);
+    for (std::size_t n : { 0, 1, 2, 33, 128, 129, 300, 1000 }) {
+        std::vector<std::int32_t> days;
+        std::int32_t d = 19000;
+        for (std::size_t i = 0; i < n; ++i) days.push_back(d += static_cast<std::int32_t>(rng() % 7) - (i % 50 == 49 ? 400 : 0));
+        std::string enc;
+        et::parquet_detail::delta_encode(enc, days);
+        CHECK(delta_decode(enc) == days);
+    }
+    for (unsigned width : { 1u, 3u, 8u, 12u }) {
+        std::vector<std::uint64_t> idx;
+        for (int run = 0; run < 40; ++run) idx.insert(idx.end(), rng() % 20, rng() % (1u << width));
+        std::string enc;
+        et::parquet_detail::rle_hybrid(enc, idx, width);
+        CHECK(rle_decode(enc, width, idx.size()) == idx);
+    }
+}
+
+TEST(parquet_file_framing) {
+    TempPath file("ledger.parquet");
+    et::ExpenseManager m;
+    fill_awkward_rows(m);
+    CHECK(m.save_parquet(file.path));
+    std::string bytes = read_file(file.path);
+    CHECK(bytes.size() > 12 && bytes.compare(0, 4, "PAR1") == 0 && bytes.compare(bytes.size() - 4, 4, "PAR1") == 0);
+    if (bytes.size() > 12) {
+        std::uint64_t footer = et::get_le(bytes.data() + bytes.size() - 8, 4);
+        CHECK(footer > 0 && footer + 12 <= bytes.size());
+    }
+}
+
+// ---- Undo and redo ----
+
+std::string ledger_text(const et::ExpenseManager& m) {
+    std::ostringstream out;
+    for (const auto& e : m.all()) out << et::to_string(e.date) << ',' << e.amount << ',' << e.category << ',' << e.description << ';';
+    for (const auto& e : m.top_by_amount(m.size())) out << e.amount << ' ';
+    for (const auto& kv : m.totals_by_category()) out << kv.first << '=' << kv.second << ' ';
+    return out.str();
+}
+
+TEST(undo_and_redo_add_edit_and_remove) {
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,1}, 1.0, "Food", "a" });
+    m.add({ et::Date{2024,1,2}, 2.0, "Fuel", "b" });
+    m.add({ et::Date{2024,1,3}, 3.0, "Travel", "c" });
+    std::vector<std::string> states{ ledger_text(m) };
+    CHECK(m.edit(1, { et::Date{2024,1,2}, 20.0, "Travel", "b2" }));
+    states.push_back(ledger_text(m));
+    CHECK(m.remove(0));
+    CHECK(m.size() == 2 && m.at(0).description == "c");
+    states.push_back(ledger_text(m));
+
+    for (std::size_t i = states.size() - 1; i-- > 0; ) { CHECK(m.undo()); CHECK(ledger_text(m) == states[i]); }
+    for (int i = 0; i < 3; ++i) CHECK(m.undo());
+    CHECK(m.size() == 0 && !m.can_undo() && !m.undo());
+    for (int i = 0; i < 3; ++i) CHECK(m.redo());
+    CHECK(ledger_text(m) == states[0]);
+    for (std::size_t i = 1; i < states.size(); ++i) { CHECK(m.redo()); CHECK(ledger_text(m) == states[i]); }
+    CHECK(!m.can_redo() && !m.redo());
+}
+
+TEST(undo_and_redo_a_load) {
+    TempPath ledger("undo_load.csv");
+    {
+        et::ExpenseManager src;
+        src.add({ et::Date{2024,5,1}, 7.0, "Food", "loaded" });
+        CHECK(src.save_csv(ledger.path));
+    }
+    et::ExpenseManager m;
+    fill_awkward_rows(m);
+    const std::string before = ledger_text(m);
+    CHECK(m.load_csv(ledger.path));
+    const std::string loaded = ledger_text(m);
+    CHECK(m.size() == 1);
+    CHECK(m.undo() && ledger_text(m) == before);
+    CHECK(m.redo() && ledger_text(m) == loaded);
+}
+
+TEST(a_new_op_drops_the_redo_stack) {
+    et::ExpenseManager m;
+    m.add({ et::Date{2024,1,1}, 1.0, "Food", "a" });
+    m.add({ et::Date{2024,1,2}, 2.0, "Food", "b" });
+    CHECK(m.undo() && m.can_redo());
+    m.add({ et::Date{2024,1,3}, 3.0, "Food", "c" });
+    CHECK(!m.can_redo() && !m.redo());
+    CHECK(m.size() == 2 && m.at(1).description == "c");
+}
+
+TEST(undo_and_redo_do_not_feed_anomaly_statistics) {
+    et::ExpenseManager m;
+    fill_coffee(m);
+    CHECK(m.anomalies().flagged_count() == 1);
+    for (int i = 0; i < 3; ++i) { CHECK(m.remove(m.size() - 1)); CHECK(m.undo()); }
+    for (int i = 0; i < 3; ++i) { CHECK(m.remove(0)); CHECK(m.undo()); CHECK(m.redo()); CHECK(m.undo()); }
+    CHECK(m.anomalies().flagged_count() == 1 && m.anomalies().flags().size() == 1);
+    m.add({ et::Date{2024,1,26}, 95.0, "Food", "Cafe Nero" });
+    CHECK(m.anomalies().flagged_count() == 2);
+    CHECK(m.undo() && m.redo());
+    CHECK(m.anomalies().flagged_count() == 2);
+}
+
+TEST(undo_log_is_bounded) {
+    et::ExpenseManager m;
+    for (int i = 0; i < 300; ++i) m.add({ et::Date{2024,1,1}, 1.0, "Food", "x" });
+    int undone = 0;
+    while (m.undo()) ++undone;
+    CHECK(undone == 256 && m.size() == 44);
+
+    // Loads pin whole ledgers; past the byte limit only the newest is kept.
+    TempPath ledger("bounded.csv");
+    CHECK(m.save_csv(ledger.path));
+    m.set_undo_limit(1);
+    for (int i = 0; i < 3; ++i) CHECK(m.load_csv(ledger.path));
+    CHECK(m.undo() && !m.undo());
+}
+
+// ---- Change journal ----
+
+TEST(journal_truncates_torn_frame_on_open) {
+    TempPath j("torn.journal");
+    {
+        et::ExpenseManager m;
+        CHECK(m.attach_journal(j.path));
+        m.add({ et::Date{2024,1,1}, 1.0, "a", "first" });
+    }
+    // A crash mid-write: a header promising more payload than follows.
+    std::string torn;
+    et::put_le(torn, et::kJournalMagic, 4); et::put_le(torn, 100, 4); et::put_le(torn, 1, 4);
+    torn += "partial";
+    append_bytes(j.path, torn);
+
+    et::ExpenseManager m;
+    CHECK(m.attach_journal(j.path));
+    m.add({ et::Date{2024,1,2}, 2.0, "b", "second" });
+    bool corrupt = true;
+    auto changes = read_journal(j.path, corrupt);
+    CHECK(!corrupt);
+    CHECK(!changes.empty() && changes.back().e.description == "second");
+    for (std::size_t i=1;i<changes.size();++i) CHECK(changes[i].seq == changes[i-1].seq + 1);
+}
+
+TEST(journal_frames_are_written_before_the_call_returns) {
+    TempPath j("sync.journal");
+    et::ExpenseManager m;
+    CHECK(m.attach_journal(j.path));
+    m.add_batch({ { et::Date{2024,1,1}, 1.0, "a", "x" }, { et::Date{2024,1,2}, 2.0, "a", "y" } });
+    CHECK(!m.journal().failed());
+    bool corrupt = true;
+    auto changes = read_journal(j.path, corrupt);
+    CHECK(!corrupt && changes.size() == 3 && changes.back().e.description == "y");
+}
+
+TEST(journal_keeps_long_strings) {
+    TempPath j("long.journal");
+    const std::string desc(70000, 'x');
+    {
+        et::ExpenseManager m;
+        CHECK(m.attach_journal(j.path));
+        m.add({ et::Date{2024,1,1}, 1.0, "a", desc });
+    }
+    bool corrupt = true;
+    auto changes = read_journal(j.path, corrupt);
+    CHECK(!corrupt);
+    CHECK(!changes.empty() && changes.back().e.description == desc);
+}
+
+TEST(journal_rejects_malformed_frames) {
+    et::Change c{ et::ChangeKind::Add, 1, 0, et::Expense{ et::Date{2024,1,1}, 1.0, "a", "b" } };
+    std::string rec;
+    et::encode_change(rec, c);
+    et::Change back;
+    CHECK(et::decode_change(rec.data(), rec.size(), back) == rec.size());
+    std::string bad = rec; bad[0] = 99;
+    CHECK(et::decode_change(bad.data(), bad.size(), back) == 0);
+
+    // A frame whose records do not fill its payload.
+    TempPath j("slack.journal");
+    std::string frame, payload = rec + "junk";
+    et::put_le(frame, et::kJournalMagic, 4); et::put_le(frame, payload.size(), 4); et::put_le(frame, 1, 4);
+    append_bytes(j.path, frame + payload);
+    bool corrupt = false;
+    auto changes = read_journal(j.path, corrupt);
+    CHECK(corrupt);
+    CHECK(changes.empty());
+}
+
+// ---- Recurring expenses ----
+
+TEST(recurring_rules_survive_save_and_load) {
+    TempPath ledger("rules.csv");
+    {
+        et::ExpenseManager m;
+        m.add({ et::Date{2024,1,5}, 3.0, "Food", "coffee" });
+        auto id = m.add_recurring(monthly_rent());
+        CHECK(m.skip_occurrence(id, et::Date{2024,4,30}));
+        CHECK(m.save_csv(ledger.path));
+    }
+    et::ExpenseManager m;
+    CHECK(m.load_csv(ledger.path));
+    CHECK(m.recurring().size() == 1);
+    if (m.recurring().size() == 1) {
+        const auto& r = m.recurring()[0];
+        CHECK(r.description == "rent, flat 2" && r.amount == 1200.5 && r.skipped.size() == 1);
+    }
+    // Jan..Jun minus the skipped April occurrence.
+    CHECK(m.filter_by_date_range(et::Date{2024,1,1}, et::Date{2024,6,30}).size() == 1 + 5);
+}
+
+TEST(undoing_an_override_restores_the_occurrence) {
+    et::ExpenseManager m;
+    auto id = m.add_recurring(monthly_rent());
+    const et::Date from{2024,1,1}, to{2024,3,31};
+    CHECK(m.total_in_range(from, to) == 3 * 1200.5);
+    CHECK(m.override_occurrence(id, et::Date{2024,2,29}, { et::Date{2024,2,29}, 1300.0, "Housing/Rent", "rent" }));
+    CHECK(m.size() == 1);
+    CHECK(m.total_in_range(from, to) == 2 * 1200.5 + 1300.0);
+    CHECK(m.undo());
+    CHECK(m.size() == 0);
+    CHECK(m.total_in_range(from, to) == 3 * 1200.5);
+    CHECK(m.redo());
+    CHECK(m.total_in_range(from, to) == 2 * 1200.5 + 1300.0);
+}
+
+TEST(followers_replay_recurring_rules) {
+    TempPath j("rules.journal");
+    et::ExpenseManager leader;
+    auto id = leader.add_recurring(monthly_rent());
+    CHECK(leader.attach_journal(j.path));
+    leader.add_recurring(monthly_rent());
+    leader.skip_occurrence(id, et::Date{2024,3,31});
+    leader.override_occurrence(1, et::Date{2024,2,29}, { et::Date{2024,2,29}, 1300.0, "Housing/Rent", "rent" });
+    leader.undo();
+
+    et::ExpenseManager follower;
+    bool corrupt = true;
+    for (const auto& c : read_journal(j.path, corrupt)) CHECK(follower.apply_change(c));
+    CHECK(!corrupt);
+    const et::Date from{2024,1,1}, to{2024,12,31};
+    CHECK(follower.recurring().size() == 2);
+    CHECK(follower.size() == leader.size());
+    CHECK(follower.total_in_range(from, to) == leader.total_in_range(from, to));
+}
+
+// ---- Server ----
+#ifdef __linux__
+
+// A client connection. Every read waits at most five seconds, so a missing
+// response fails the test instead of hanging it.
+struct Client {
+    int fd{-1};
+    std::string buf;
+    explicit Client(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) { ::close(fd); fd = -1; }
+    }
+    ~Client() { if (fd >= 0) ::close(fd); }
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    bool send(const std::string& text) {
+        return fd >= 0 && ::send(fd, text.data(), text.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+    }
+    std::string line() {
+        while (true) {
+            auto nl = buf.find('\n');
+            if (nl != std::string::npos) { std::string l = buf.substr(0, nl); buf.erase(0, nl + 1); return l; }
+            pollfd p{ fd, POLLIN, 0 };
+            if (fd < 0 || ::poll(&p, 1, 5000) <= 0) return "<timeout>";
+            char tmp[65536];
+            ssize_t n = ::read(fd, tmp, sizeof tmp);
+            if (n <= 0) return "<eof>";
+            buf.append(tmp, static_cast<std::size_t>(n));
+        }
+    }
+    // A status line and, for "rows <n>" and "groups <n>", its n payload lines.
+    std::vector<std::string> response() {
+        std::vector<std::string> r{ line() };
+        std::istringstream ss(r[0]);
+        std::string word;
+        ss >> word;
+        if (!word.empty() && word[0] == '#') ss >> word;
+        std::size_t n = 0;
+        if ((word == "rows" || word == "groups") && ss >> n) for (std::size_t i = 0; i < n; ++i) r.push_back(line());
+        return r;
+    }
+};
+
+// A server on a temporary socket, running on its own thread until the test
+// ends. run() blocks SIGTERM on that thread before it starts the shards, and
+// the first ping is answered by a shard, so by the time the constructor
+// returns the SIGTERM sent by the destructor can only reach run().
+struct TestServer {
+    TempPath sock{"server.sock"};
+    et::ExpenseServer server;
+    std::thread thread;
+    TestServer(std::vector<et::Expense> rows, std::size_t shards,
+               std::chrono::milliseconds timeout = et::kQueryTimeout, std::size_t memory = et::kQueryMemory)
+        : server(std::move(rows), shards) {
+        server.set_query_limits(timeout, memory);
+        std::string err;
+        CHECK(server.listen(sock.path, err));
+        thread = std::thread([this] { server.run(); });
+        Client c(sock.path);
+        CHECK(c.send("ping\n") && c.line() == "ok pong");
+    }
+    ~TestServer() {
+        pthread_kill(thread.native_handle(), SIGTERM);
+        thread.join();
+    }
+};
+
+// n rows spread over every month of 2024, in four categories.
+std::vector<et::Expense> server_rows(int n) {
+    const char* cats[] = { "Food", "Travel/Flights", "Travel/Trains", "Fuel" };
+    std::vector<et::Expense> rows;
+    for (int i = 0; i < n; ++i)
+        rows.push_back({ et::Date{2024, 1 + i % 12, 1 + i % 28}, (i % 37) * 2.25, cats[i % 4], "shop " + std::to_string(i) });
+    return rows;
+}
+
+// What the server should answer for a query over rows held in one manager.
+std::vector<std::string> expected_response(const std::vector<et::Expense>& rows, const std::string& text) {
+    et::ExpenseManager m;
+    m.add_batch(rows);
+    et::QueryResult res; std::string err;
+    auto q = prepare(text);
+    if (!q || !q->execute(m, {}, res, err)) return { "err " + err };
+    std::vector<std::string> r;
+    std::ostringstream out;
+    if (res.grouped) {
+        r.push_back("groups " + std::to_string(res.groups.size()));
+        out << std::fixed << std::setprecision(2);
+        for (const auto& g : res.groups) out << et::csv_escape(g.key) << ',' << g.count << ',' << g.value << '\n';
+    } else {
+        r.push_back("rows " + std::to_string(res.rows.size()));
+        for (const auto& e : res.rows) et::write_csv_row(out, e);
+    }
+    std::istringstream in(out.str());
+    for (std::string l; std::getline(in, l); ) r.push_back(l);
+    return r;
+}
+
+std::vector<std::string> sorted(std::vector<std::string> v) {
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+TEST(server_answers_each_request_kind) {
+    TestServer s(server_rows(40), 1);
+    Client c(s.sock.path);
+    CHECK(c.send("ping\n") && c.line() == "ok pong");
+    CHECK(c.send("add 2024-05-06,12.50,Food,\"bagel, toasted\"\n") && c.line() == "ok");
+    CHECK(c.send("add 2024-05-06,twelve,Food,bagel\n") && c.line() == "err invalid row");
+    auto rows = c.send("query where desc~\"bagel\"\n") ? c.response() : std::vector<std::string>{};
+    CHECK(rows.size() == 2 && rows[0] == "rows 1" && rows[1] == "2024-05-06,12.5,Food,\"bagel, toasted\"");
+    auto all = server_rows(40);
+    all.push_back({ et::Date{2024,5,6}, 12.5, "Food", "bagel, toasted" });
+    CHECK(c.send("summary\n") && sorted(c.response()) == sorted(expected_response(all, "group by category sum amount")));
+    CHECK(c.send("query where colour=red\n") && c.line().rfind("err ", 0) == 0);
+    CHECK(c.send("release /et-nothing\n") && c.line() == "err unknown region");
+    CHECK(c.send("frobnicate\n") && c.line() == "err unknown request");
+}
+
+TEST(server_hands_large_results_over_shared_memory) {
+    auto rows = server_rows(5000);
+    TestServer s(rows, 2);
+    Client c(s.sock.path);
+    CHECK(c.send("shm on\n") && c.line() == "ok");
+    // Below kShmMinRows the rows still come over the socket.
+    auto small = c.send("query where desc~\"shop 1\" limit 10\n") ? c.response() : std::vector<std::string>{};
+    CHECK(!small.empty() && small[0] == "rows 10");
+
+    CHECK(c.send("query where amount>=0\n"));
+    std::istringstream reply(c.line());
+    std::string word, name;
+    std::size_t bytes = 0, count = 0;
+    reply >> word >> name >> bytes >> count;
+    CHECK(word == "shm" && count == rows.size());
+    const std::string file = "/dev/shm" + name;
+    std::error_code ec;
+    CHECK(std::filesystem::file_size(file, ec) == bytes);
+    std::vector<et::Expense> got; std::string err;
+    CHECK(et::read_arrow_file(file, got, err) && got.size() == rows.size());
+    double want = 0, total = 0;
+    for (const auto& e : rows) want += e.amount;
+    for (const auto& e : got) total += e.amount;
+    CHECK(total == want);
+
+    CHECK(c.send("release " + name + "\n") && c.line() == "ok");
+    CHECK(!std::filesystem::exists(file));
+    CHECK(c.send("release " + name + "\n") && c.line() == "err unknown region");
+
+    // An object the client never released goes when it disconnects.
+    CHECK(c.send("query where amount>=0\n"));
+    reply.clear(); reply.str(c.line());
+    reply >> word >> name;
+    CHECK(word == "shm" && std::filesystem::exists("/dev/shm" + name));
+    ::close(c.fd); c.fd = -1;
+    for (int i = 0; i < 500 && std::filesystem::exists("/dev/shm" + name); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(!std::filesystem::exists("/dev/shm" + name));
+}
+
+TEST(server_merges_results_from_every_shard) {
+    auto rows = server_rows(600);
+    TestServer s(rows, 3);
+    Client c(s.sock.path);
+    for (const char* text : { "where desc~\"shop 1\"", "where amount>=20 and amount<40", "where category=travel and date>=2024-03-01" }) {
+        CHECK(c.send(std::string("query ") + text + "\n") && sorted(c.response()) == sorted(expected_response(rows, text)));
+    }
+    CHECK(c.send("query group by month sum amount\n") &&
+          sorted(c.response()) == sorted(expected_response(rows, "group by month sum amount")));
+    // A limit applies to the merged result, not to each shard's part.
+    auto top = c.send("query order by amount desc limit 5\n") ? c.response() : std::vector<std::string>{};
+    auto want = expected_response(rows, "order by amount desc limit 5");
+    CHECK(top.size() == 6 && top[0] == "rows 5");
+    auto amount = [](const std::string& line) { auto a = line.find(',') + 1; return line.substr(a, line.find(',', a) - a); };
+    for (std::size_t i = 1; i < top.size() && i < want.size(); ++i) CHECK(amount(top[i]) == amount(want[i]));
+}
+
+TEST(server_routes_adds_to_the_owning_shard) {
+    TestServer s({}, 3);
+    Client a(s.sock.path), b(s.sock.path);   // handed to different shards
+    std::string burst;
+    for (int m = 1; m <= 12; ++m) burst += "add 2024-" + std::string(m < 10 ? "0" : "") + std::to_string(m) + "-15,1,Food,new\n";
+    // The query is pipelined behind the adds and must see all of them.
+    CHECK(a.send(burst + "query where desc~\"new\"\n"));
+    for (int m = 1; m <= 12; ++m) CHECK(a.line() == "ok");
+    auto r = a.response();
+    CHECK(r.size() == 13 && r[0] == "rows 12");
+    CHECK(b.send("query where desc~\"new\" group by month\n"));
+    r = b.response();
+    CHECK(r.size() == 13 && r[0] == "groups 12");
+}
+
+TEST(server_answers_untagged_requests_in_order) {
+    auto rows = server_rows(600);
+    TestServer s(rows, 3);
+    Client c(s.sock.path);
+    CHECK(c.send("add bad\nadd 2024-02-02,3,Food,x\nquery where desc~\"shop 7\"\nping\nsummary\nping\n"));
+    CHECK(c.line() == "err invalid row");
+    CHECK(c.line() == "ok");
+    CHECK(sorted(c.response()) == sorted(expected_response(rows, "where desc~\"shop 7\"")));
+    CHECK(c.line() == "ok pong");
+    rows.push_back({ et::Date{2024,2,2}, 3.0, "Food", "x" });
+    CHECK(sorted(c.response()) == sorted(expected_response(rows, "group by category sum amount")));
+    CHECK(c.line() == "ok pong");
+}
+
+TEST(server_answers_tagged_requests_when_ready) {
+    TestServer s(server_rows(600), 1);
+    Client c(s.sock.path);
+    // The untagged query holds back the untagged ping behind it, but not the
+    // tagged requests sent after it.
+    CHECK(c.send("query where desc~\"shop\"\n#p ping\n#a add 2024-03-03,2,Food,tagged\nping\n"));
+    CHECK(c.line() == "#p ok pong");
+    CHECK(c.line() == "#a ok");
+    auto r = c.response();
+    CHECK(r.size() == 601 && r[0] == "rows 600");
+    CHECK(c.line() == "ok pong");
+}
+
+TEST(server_tagged_queries_see_earlier_adds) {
+    TestServer s(server_rows(600), 3);
+    Client c(s.sock.path);
+    CHECK(c.send("add 2024-07-07,2,Food,tagged first\n#q1 query where desc~\"first\"\n"
+                 "#a add 2024-08-08,2,Food,tagged second\n#q2 query where desc~\"tagged\"\n"));
+    std::map<std::string, std::vector<std::string>> by_tag;
+    for (int i = 0; i < 4; ++i) {
+        auto r = c.response();
+        std::string tag = r[0][0] == '#' ? r[0].substr(0, r[0].find(' ')) : "";
+        CHECK(!by_tag.count(tag));
+        by_tag[tag] = r;
+    }
+    CHECK(by_tag[""] == std::vector<std::string>{ "ok" });
+    CHECK(by_tag["#a"] == std::vector<std::string>{ "#a ok" });
+    CHECK(by_tag["#q1"].size() == 2 && by_tag["#q1"][0] == "#q1 rows 1");
+    CHECK(by_tag["#q2"].size() == 3 && by_tag["#q2"][0] == "#q2 rows 2");
+}
+
+TEST(server_answers_a_half_closed_client) {
+    auto rows = server_rows(600);
+    TestServer s(rows, 3);
+    Client c(s.sock.path);
+    // Like `printf 'summary\n' | nc -U sock`: the request, then end of input.
+    CHECK(c.send("summary\n#t query where desc~\"shop 5\"\n"));
+    ::shutdown(c.fd, SHUT_WR);
+    auto first = c.response(), second = c.response();
+    if (first[0][0] == '#') std::swap(first, second);
+    CHECK(sorted(first) == sorted(expected_response(rows, "group by category sum amount")));
+    CHECK(!second.empty() && second[0].rfind("#t rows ", 0) == 0);
+    CHECK(c.line() == "<eof>");
+}
+
+TEST(server_cancels_a_tagged_query) {
+    TestServer s(server_rows(600), 3);
+    Client c(s.sock.path);
+    CHECK(c.send("#q query where desc~\"shop\"\ncancel q\n"));
+    CHECK(c.line() == "ok");
+    CHECK(c.line() == "#q err query cancelled");
+    // Once answered, the tag is free again.
+    CHECK(c.send("cancel q\n") && c.line() == "err no running query q");
+    CHECK(c.send("#q query where desc~\"shop 1\" limit 1\n") && c.response().size() == 2);
+}
+
+TEST(server_enforces_query_limits) {
+    {
+        TestServer s(server_rows(600), 2, std::chrono::milliseconds(0), 16);
+        Client c(s.sock.path);
+        CHECK(c.send("query where desc~\"shop\"\nping\n"));
+        CHECK(c.line() == "err query exceeded its memory limit");
+        CHECK(c.line() == "ok pong");
+    }
+    {
+        TestServer s(server_rows(300000), 2, std::chrono::milliseconds(1), 0);
+        Client c(s.sock.path);
+        CHECK(c.send("query where desc~\"no such shop\"\n") && c.line() == "err query timed out");
+    }
+}
+
+TEST(server_refuses_work_past_its_class_limits) {
+    TestServer s(server_rows(600), 1);
+    Client c(s.sock.path);
+    // Maintenance runs one at a time with one more waiting; a third is refused.
+    CHECK(c.send("reload /nonexistent.csv\nreload /nonexistent.csv\nreload /nonexistent.csv\n"));
+    CHECK(c.line().rfind("err cannot load", 0) == 0);
+    CHECK(c.line().rfind("err cannot load", 0) == 0);
+    CHECK(c.line() == "err busy");
+
+    // Scans past the running and waiting limits are refused, and a refused
+    // query leaves nothing behind to cancel.
+    std::string burst;
+    for (int i = 0; i < 400; ++i) burst += "#t" + std::to_string(i) + " query where desc~\"shop 599\"\n";
+    CHECK(c.send(burst));
+    std::vector<std::string> refused;
+    std::size_t answered = 0;
+    for (int i = 0; i < 400; ++i) {
+        auto r = c.response();
+        auto sp = r[0].find(' ');
+        if (r[0].compare(sp + 1, std::string::npos, "err busy") == 0) refused.push_back(r[0].substr(1, sp - 1));
+        else answered += r.size() == 2 && r[0].compare(sp + 1, std::string::npos, "rows 1") == 0;
+    }
+    CHECK(!refused.empty() && answered + refused.size() == 400);
+    for (const auto& tag : refused) CHECK(c.send("cancel " + tag + "\n") && c.line() == "err no running query " + tag);
+    CHECK(c.send("query where desc~\"shop 599\"\n") && c.response().size() == 2);
+}
+
+TEST(server_exports_and_reloads_the_ledger) {
+    auto rows = server_rows(600);
+    TestServer s(rows, 3);
+    TempPath file("server_export.arrow");
+    Client c(s.sock.path);
+    CHECK(c.send("export " + file.path + "\n") && c.line() == "ok 600");
+    CHECK(c.send("add 2024-09-09,1,Food,extra\nreload " + file.path + "\n"));
+    CHECK(c.line() == "ok");
+    CHECK(c.line() == "ok 600");
+    // The reload replaced the ledger, extra row and all; later exports see the new one.
+    CHECK(c.send("query where desc~\"extra\"\n") && c.line() == "rows 0");
+    CHECK(c.send("export " + file.path + "\n") && c.line() == "ok 600");
+    CHECK(c.send("summary\n") && sorted(c.response()) == sorted(expected_response(rows, "group by category sum amount")));
+}
+
+// ---- Load generator ----
+
+TEST(loadgen_mix_parses_named_weights) {
+    using Mix = std::array<unsigned, et::LoadGenerator::kKinds>;
+    Mix mix{};
+    CHECK(et::LoadGenerator::parse_mix("add=1,filter=2,search=3,summary=4", mix) && (mix == Mix{ { 1, 2, 3, 4 } }));
+    CHECK(et::LoadGenerator::parse_mix("summary=5,add=7", mix) && (mix == Mix{ { 7, 0, 0, 5 } }));
+    CHECK(et::LoadGenerator::parse_mix("search=0,filter=1000000", mix) && (mix == Mix{ { 0, 1000000, 0, 0 } }));
+    for (const char* bad : { "", "add", "add=", "=3", "add=x", "add=-1", "add=+1", "add=1x", "add= 1", "add=1,,filter=1",
+                             "add=1,add=2", "delete=3", "ad=1", "adds=1", "add=0,filter=0", "add=1000001", "add=99999999999" }) {
+        CHECK(!et::LoadGenerator::parse_mix(bad, mix));
+        CHECK((mix == Mix{ { 0, 1000000, 0, 0 } }));   // left as it was
+    }
+}
+
+TEST(loadgen_drives_a_server) {
+    TestServer s(server_rows(600), 2);
+    et::LoadOptions opt;
+    opt.socket = s.sock.path;
+    opt.clients = 2; opt.pipeline = 4;
+    opt.duration = opt.interval = std::chrono::seconds(1);
+    opt.warmup = std::chrono::seconds(0);
+    CHECK(et::LoadGenerator::parse_mix("filter=1,summary=1", opt.mix));
+    et::LoadGenerator gen(opt);
+    std::ostringstream out;
+    CHECK(gen.run(out));
+    // Per-request totals: name, count, three latencies, errors.
+    std::map<std::string, std::pair<std::size_t, std::size_t>> totals;
+    std::istringstream in(out.str());
+    for (std::string l; std::getline(in, l); ) {
+        std::istringstream ls(l);
+        std::string name; std::size_t count = 0, errors = 0; double ms;
+        if (ls >> name >> count >> ms >> ms >> ms >> errors) totals[name] = { count, errors };
+    }
+    CHECK(totals["add"].first == 0 && totals["search"].first == 0);
+    CHECK(totals["filter"].first > 0 && totals["summary"].first > 0);
+    CHECK(totals["filter"].second == 0 && totals["summary"].second == 0);
+}
+
+#endif
+
+} // namespace
+
+int main() {
+    for (const auto& t : registry()) {
+        int before = failures;
+        t.fn();
+        std::cout << (failures == before ? "ok   " : "FAIL ") << t.name << '\n';
+    }
+    std::cout << registry().size() << " tests, " << failures << " failed checks\n";
+    return failures ? 1 : 0;
+}